@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../lib/shared_fields.h"
+#include "synth.h"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct run_result {
+	double seconds;
+	long peak_rss_kb;
+	int status;
+};
+
+static struct {
+	const char *output;
+	const char *directory;
+	const char *decode;
+	const char *encode;
+} options = { "bench_output.txt", "/tmp", "./decode", "./encode" };
+
+int run(const char *const argv[], const char *stdout_path,
+	struct run_result *result);
+void report(FILE * out, const char *program, const char *order,
+	    size_t size, size_t bytes, size_t packets,
+	    const struct run_result *result);
+size_t file_size(const char *path);
+
+int main(int argc, char *argv[])
+// Generates captures of each requested size in both byte orders, times
+// decode over each and encode over decode's output, and appends one
+// JSON line per run to the output file.
+{
+	struct synth_config config;
+	synth_defaults(&config);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:d:s:m:n:D:E:")) != -1) {
+		switch (opt) {
+		case 'o':
+			options.output = optarg;
+			break;
+		case 'd':
+			options.directory = optarg;
+			break;
+		case 's':
+			config.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (!synth_parse_mix(optarg, &config)) {
+				fprintf(stderr,
+					"Expected weights MESSAGE,STATUS,COMMAND,GPS; received \"%s\"\n",
+					optarg);
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'n':
+			config.noise = strtoul(optarg, NULL, 10);
+			if (config.noise > 100) {
+				fprintf(stderr,
+					"Noise must be a percentage from 0 to 100\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'D':
+			options.decode = optarg;
+			break;
+		case 'E':
+			options.encode = optarg;
+			break;
+		case '?':
+			return (INVOCATION_ERROR);
+		}
+	}
+	if (optind == argc) {
+		fprintf(stderr,
+			"Usage: %s [-o OUTPUT] [-d DIR] [-s SEED] [-m M,S,C,G] [-n NOISE%%] SIZE...\n",
+			argv[0]);
+		return (INVOCATION_ERROR);
+	}
+	FILE *out = fopen(options.output, "w");
+	if (!out) {
+		fprintf(stderr, "%s could not be opened", options.output);
+		perror(" \b");
+		return (FILE_ERROR);
+	}
+
+	char capture[4096];
+	char text[4096];
+	char rebuilt[4096];
+	snprintf(capture, sizeof(capture), "%s/bench.%d.pcap",
+		 options.directory, (int)getpid());
+	snprintf(text, sizeof(text), "%s/bench.%d.txt", options.directory,
+		 (int)getpid());
+	snprintf(rebuilt, sizeof(rebuilt), "%s/bench.%d.out.pcap",
+		 options.directory, (int)getpid());
+
+	int ret = SUCCESS;
+	for (int i = optind; i < argc && ret == SUCCESS; ++i) {
+		size_t size;
+		if (!parse_size(argv[i], &size)) {
+			fprintf(stderr, "Invalid size \"%s\"\n", argv[i]);
+			ret = INVOCATION_ERROR;
+			break;
+		}
+		for (int big = 0; big < 2; ++big) {
+			const char *order = big ? "be" : "le";
+			config.size = size;
+			config.little_endian = !big;
+			struct synth_counts counts;
+			if (synth_write(&config, capture, &counts) != 0) {
+				fprintf(stderr, "%s could not be written",
+					capture);
+				perror(" \b");
+				ret = FILE_ERROR;
+				break;
+			}
+			size_t packets = 0;
+			for (size_t t = 0; t < SYNTH_NUM_PAYLOADS; ++t) {
+				packets += counts.zerg[t];
+			}
+
+			struct run_result result;
+			const char *decode_argv[] = {
+				options.decode, capture, NULL
+			};
+			if (run(decode_argv, text, &result) != 0) {
+				ret = FILE_ERROR;
+				break;
+			}
+			// Noise records are read but are not packets, so
+			// both programs are rated on the zerg packets alone
+			report(out, "decode", order, size, counts.bytes,
+			       packets, &result);
+
+			const char *encode_argv[] = {
+				options.encode, big ? "-b" : text,
+				big ? text : rebuilt, big ? rebuilt : NULL,
+				NULL
+			};
+			if (run(encode_argv, NULL, &result) != 0) {
+				ret = FILE_ERROR;
+				break;
+			}
+			report(out, "encode", order, size, file_size(text),
+			       packets, &result);
+		}
+	}
+	unlink(capture);
+	unlink(text);
+	unlink(rebuilt);
+	if (fclose(out) != 0) {
+		ret = FILE_ERROR;
+	}
+	return (ret);
+}
+
+int run(const char *const argv[], const char *stdout_path,
+	struct run_result *result)
+// Runs argv to completion with stderr discarded and stdout sent to
+// stdout_path (or discarded too). Records wall time and peak RSS.
+// Returns 0 if the program could be run.
+{
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return (-1);
+	}
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		int out_fd = null_fd;
+		if (stdout_path) {
+			out_fd = open(stdout_path,
+				      O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		}
+		if (null_fd < 0 || out_fd < 0) {
+			_exit(127);
+		}
+		dup2(out_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		execv(argv[0], (char *const *)argv);
+		_exit(127);
+	}
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) < 0) {
+		perror("wait4");
+		return (-1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "%s could not be run\n", argv[0]);
+		return (-1);
+	}
+	result->seconds = (end.tv_sec - start.tv_sec) +
+	    (end.tv_nsec - start.tv_nsec) / 1e9;
+	result->peak_rss_kb = usage.ru_maxrss;
+	result->status = WEXITSTATUS(status);
+	return (0);
+}
+
+void report(FILE * out, const char *program, const char *order,
+	    size_t size, size_t bytes, size_t packets,
+	    const struct run_result *result)
+{
+	double seconds = result->seconds > 0 ? result->seconds : 1e-9;
+	fprintf(out,
+		"{\"program\": \"%s\", \"order\": \"%s\", \"size\": %zu, \"bytes\": %zu, \"packets\": %zu, \"seconds\": %.6f, \"packets_per_s\": %.0f, \"mb_per_s\": %.2f, \"peak_rss_kb\": %ld, \"exit\": %d}\n",
+		program, order, size, bytes, packets, result->seconds,
+		packets / seconds, bytes / seconds / (1 << 20),
+		result->peak_rss_kb, result->status);
+	fflush(out);
+	printf("%-6s %s %10zu bytes  %12.0f packets/s  %8.2f MB/s  %8ld KB peak RSS\n",
+	       program, order, bytes, packets / seconds,
+	       bytes / seconds / (1 << 20), result->peak_rss_kb);
+}
+
+size_t file_size(const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return (0);
+	}
+	return (st.st_size);
+}
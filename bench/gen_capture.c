@@ -0,0 +1,64 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/shared_fields.h"
+#include "synth.h"
+
+int main(int argc, char *argv[])
+// Writes a deterministic synthetic capture for benchmarking.
+{
+	struct synth_config config;
+	synth_defaults(&config);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:m:n:bt:")) != -1) {
+		switch (opt) {
+		case 's':
+			config.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (!synth_parse_mix(optarg, &config)) {
+				fprintf(stderr,
+					"Expected weights MESSAGE,STATUS,COMMAND,GPS; received \"%s\"\n",
+					optarg);
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'n':
+			config.noise = strtoul(optarg, NULL, 10);
+			if (config.noise > 100) {
+				fprintf(stderr,
+					"Noise must be a percentage from 0 to 100\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'b':
+			config.little_endian = false;
+			break;
+		case 't':
+			config.start_time = strtoul(optarg, NULL, 10);
+			break;
+		case '?':
+			return (INVOCATION_ERROR);
+		}
+	}
+	if (argc - optind != 2
+	    || !parse_size(argv[optind], &config.size)) {
+		fprintf(stderr,
+			"Usage: %s [-s SEED] [-m M,S,C,G] [-n NOISE%%] [-b] [-t EPOCH] SIZE OUTFILE\n",
+			argv[0]);
+		return (INVOCATION_ERROR);
+	}
+
+	struct synth_counts counts;
+	if (synth_write(&config, argv[optind + 1], &counts) != 0) {
+		fprintf(stderr, "%s could not be written", argv[optind + 1]);
+		perror(" \b");
+		return (FILE_ERROR);
+	}
+	printf("%zu bytes, %zu records: %zu message, %zu status, %zu command, %zu gps\n",
+	       counts.bytes, counts.records, counts.zerg[SYNTH_MESSAGE],
+	       counts.zerg[SYNTH_STATUS], counts.zerg[SYNTH_COMMAND],
+	       counts.zerg[SYNTH_GPS]);
+	return (SUCCESS);
+}
@@ -0,0 +1,364 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../lib/shared_fields.h"
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum microbench_defaults {
+	NUM_INPUTS = 4096,	// Power of two; cycles through the inputs
+	DEFAULT_ITERATIONS = 1 << 20,
+	DEFAULT_REPETITIONS = 15,
+	DEFAULT_WARMUP = 3
+};
+
+struct kernel {
+	const char *name;
+	const char *baseline;	// Kernel this one replaces, or NULL
+	double (*run)(size_t iterations);
+	int (*check)(void);	// Returns mismatches against baseline
+};
+
+static struct {
+	size_t iterations;
+	size_t repetitions;
+	size_t warmup;
+} options = { DEFAULT_ITERATIONS, DEFAULT_REPETITIONS, DEFAULT_WARMUP };
+
+static int int_inputs[NUM_INPUTS];
+static float float_inputs[NUM_INPUTS];
+static double double_inputs[NUM_INPUTS];
+static double coordinate_inputs[NUM_INPUTS];
+
+// Results are folded into sink so the calls cannot be optimized away
+static volatile double sink;
+
+void fill_inputs(void);
+uint64_t now_ns(void);
+uint64_t now_cycles(void);
+double run_shift_24(size_t iterations);
+double run_shift_24_bswap(size_t iterations);
+double run_reverse_float(size_t iterations);
+double run_reverse_float_bswap(size_t iterations);
+double run_reverse_double(size_t iterations);
+double run_reverse_double_bswap(size_t iterations);
+double run_format_gps(size_t iterations);
+double run_format_gps_single_fabs(size_t iterations);
+int check_shift_24_bswap(void);
+int check_reverse_float_bswap(void);
+int check_reverse_double_bswap(void);
+int check_format_gps_single_fabs(void);
+int shift_24_bswap(int num);
+float reverse_float_bswap(const float num);
+double reverse_double_bswap(const double num);
+void format_gps_single_fabs(const double num, double *degrees,
+			    double *minutes, double *seconds);
+
+// Every kernel, library or candidate, is called through one of these
+// pointers, so each call costs the same load and indirect call and
+// none gets inlined into its loop
+static int (*volatile shift_24_baseline)(int) = shift_24_bit_int;
+static float (*volatile reverse_float_baseline)(float) = reverse_float;
+static double (*volatile reverse_double_baseline)(double) = reverse_double;
+static void (*volatile format_gps_baseline)(double, double *, double *,
+					    double *) = format_gps_output;
+static int (*volatile shift_24_candidate)(int) = shift_24_bswap;
+static float (*volatile reverse_float_candidate)(float) =
+    reverse_float_bswap;
+static double (*volatile reverse_double_candidate)(double) =
+    reverse_double_bswap;
+static void (*volatile format_gps_candidate)(double, double *, double *,
+					     double *) =
+    format_gps_single_fabs;
+
+static const struct kernel kernels[] = {
+	{"shift_24_bit_int", NULL, run_shift_24, NULL},
+	{"shift_24_bswap", "shift_24_bit_int", run_shift_24_bswap,
+	 check_shift_24_bswap},
+	{"reverse_float", NULL, run_reverse_float, NULL},
+	{"reverse_float_bswap", "reverse_float", run_reverse_float_bswap,
+	 check_reverse_float_bswap},
+	{"reverse_double", NULL, run_reverse_double, NULL},
+	{"reverse_double_bswap", "reverse_double", run_reverse_double_bswap,
+	 check_reverse_double_bswap},
+	{"format_gps_output", NULL, run_format_gps, NULL},
+	{"format_gps_single_fabs", "format_gps_output",
+	 run_format_gps_single_fabs, check_format_gps_single_fabs}
+};
+
+int main(int argc, char *argv[])
+// Times each kernel over a fixed input set: warm-up passes first, then
+// the best of several repetitions is reported as ns and cycles per call.
+// Replacement kernels are checked against the function they replace.
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:w:")) != -1) {
+		switch (opt) {
+		case 'n':
+			options.iterations = strtoull(optarg, NULL, 10);
+			break;
+		case 'r':
+			options.repetitions = strtoull(optarg, NULL, 10);
+			break;
+		case 'w':
+			options.warmup = strtoull(optarg, NULL, 10);
+			break;
+		case '?':
+			return (INVOCATION_ERROR);
+		}
+	}
+	if (options.iterations == 0 || options.repetitions == 0) {
+		fprintf(stderr,
+			"Usage: %s [-n ITERATIONS] [-r REPETITIONS] [-w WARMUP]\n",
+			argv[0]);
+		return (INVOCATION_ERROR);
+	}
+	fill_inputs();
+
+	int ret = SUCCESS;
+	printf("%-24s %12s %14s  %s\n", "Kernel", "ns/call", "cycles/call",
+	       "Check");
+	for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+		const struct kernel *kernel = &kernels[k];
+		for (size_t i = 0; i < options.warmup; ++i) {
+			kernel->run(options.iterations);
+		}
+		double best_ns = INFINITY;
+		double best_cycles = INFINITY;
+		for (size_t i = 0; i < options.repetitions; ++i) {
+			uint64_t start_cycles = now_cycles();
+			uint64_t start_ns = now_ns();
+			sink += kernel->run(options.iterations);
+			uint64_t ns = now_ns() - start_ns;
+			uint64_t cycles = now_cycles() - start_cycles;
+			if (ns < best_ns) {
+				best_ns = ns;
+			}
+			if (cycles < best_cycles) {
+				best_cycles = cycles;
+			}
+		}
+		char check[64] = "";
+		if (kernel->check) {
+			int mismatches = kernel->check();
+			snprintf(check, sizeof(check), "%s vs %s",
+				 mismatches ? "MISMATCH" : "matches",
+				 kernel->baseline);
+			if (mismatches) {
+				ret = INVOCATION_ERROR;
+			}
+		}
+		printf("%-24s %12.3f %14.2f  %s\n", kernel->name,
+		       best_ns / options.iterations,
+		       best_cycles / options.iterations, check);
+	}
+	return (ret);
+}
+
+void fill_inputs(void)
+// Deterministic inputs spanning each field's range, including negative
+// 24-bit values and coordinates in both hemispheres.
+{
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	for (size_t i = 0; i < NUM_INPUTS; ++i) {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		uint64_t bits = state * 0x2545F4914F6CDD1DULL;
+		int_inputs[i] = (int)(uint32_t)bits;
+		float_inputs[i] = (int32_t)(bits >> 32) / 65536.0f;
+		double_inputs[i] = (int64_t)bits / 4294967296.0;
+		coordinate_inputs[i] = (bits >> 11) / 9007199254740992.0 *
+		    360 - 180;
+	}
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+uint64_t now_cycles(void)
+// Reads the timestamp counter where there is one. It ticks at a
+// constant reference rate, not the current core clock. Elsewhere
+// cycles are reported as zero.
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__rdtsc());
+#else
+	return (0);
+#endif
+}
+
+double run_shift_24(size_t iterations)
+{
+	long total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		total += shift_24_baseline(int_inputs[i & (NUM_INPUTS - 1)]);
+	}
+	return (total);
+}
+
+double run_shift_24_bswap(size_t iterations)
+{
+	long total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		total += shift_24_candidate(int_inputs[i & (NUM_INPUTS - 1)]);
+	}
+	return (total);
+}
+
+double run_reverse_float(size_t iterations)
+{
+	double total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		total +=
+		    reverse_float_baseline(float_inputs[i & (NUM_INPUTS - 1)]);
+	}
+	return (total);
+}
+
+double run_reverse_float_bswap(size_t iterations)
+{
+	double total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		total +=
+		    reverse_float_candidate(float_inputs[i & (NUM_INPUTS - 1)]);
+	}
+	return (total);
+}
+
+double run_reverse_double(size_t iterations)
+{
+	double total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		total += reverse_double_baseline(double_inputs
+						 [i & (NUM_INPUTS - 1)]);
+	}
+	return (total);
+}
+
+double run_reverse_double_bswap(size_t iterations)
+{
+	double total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		total += reverse_double_candidate(double_inputs
+						  [i & (NUM_INPUTS - 1)]);
+	}
+	return (total);
+}
+
+double run_format_gps(size_t iterations)
+{
+	double total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		double degrees, minutes, seconds;
+		format_gps_baseline(coordinate_inputs[i & (NUM_INPUTS - 1)],
+				    &degrees, &minutes, &seconds);
+		total += degrees + minutes + seconds;
+	}
+	return (total);
+}
+
+double run_format_gps_single_fabs(size_t iterations)
+{
+	double total = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		double degrees, minutes, seconds;
+		format_gps_candidate(coordinate_inputs[i & (NUM_INPUTS - 1)],
+				     &degrees, &minutes, &seconds);
+		total += degrees + minutes + seconds;
+	}
+	return (total);
+}
+
+int check_shift_24_bswap(void)
+{
+	int mismatches = 0;
+	for (size_t i = 0; i < NUM_INPUTS; ++i) {
+		mismatches += shift_24_bswap(int_inputs[i]) !=
+		    shift_24_bit_int(int_inputs[i]);
+	}
+	return (mismatches);
+}
+
+int check_reverse_float_bswap(void)
+// Compares bit patterns, since reversed bytes are often NaNs.
+{
+	int mismatches = 0;
+	for (size_t i = 0; i < NUM_INPUTS; ++i) {
+		float expected = reverse_float(float_inputs[i]);
+		float actual = reverse_float_bswap(float_inputs[i]);
+		mismatches += memcmp(&expected, &actual, sizeof(actual)) != 0;
+	}
+	return (mismatches);
+}
+
+int check_reverse_double_bswap(void)
+{
+	int mismatches = 0;
+	for (size_t i = 0; i < NUM_INPUTS; ++i) {
+		double expected = reverse_double(double_inputs[i]);
+		double actual = reverse_double_bswap(double_inputs[i]);
+		mismatches += memcmp(&expected, &actual, sizeof(actual)) != 0;
+	}
+	return (mismatches);
+}
+
+int check_format_gps_single_fabs(void)
+{
+	int mismatches = 0;
+	for (size_t i = 0; i < NUM_INPUTS; ++i) {
+		double expected[3];
+		double actual[3];
+		format_gps_output(coordinate_inputs[i], &expected[0],
+				  &expected[1], &expected[2]);
+		format_gps_single_fabs(coordinate_inputs[i], &actual[0],
+				       &actual[1], &actual[2]);
+		mismatches += memcmp(expected, actual, sizeof(actual)) != 0;
+	}
+	return (mismatches);
+}
+
+int shift_24_bswap(int num)
+// shift_24_bit_int() as one byte swap and an arithmetic shift.
+{
+	return ((int32_t)__builtin_bswap32(num) >> 8);
+}
+
+float reverse_float_bswap(const float num)
+{
+	uint32_t bits;
+	memcpy(&bits, &num, sizeof(bits));
+	bits = __builtin_bswap32(bits);
+	float ret_val;
+	memcpy(&ret_val, &bits, sizeof(ret_val));
+	return (ret_val);
+}
+
+double reverse_double_bswap(const double num)
+{
+	uint64_t bits;
+	memcpy(&bits, &num, sizeof(bits));
+	bits = __builtin_bswap64(bits);
+	double ret_val;
+	memcpy(&ret_val, &bits, sizeof(ret_val));
+	return (ret_val);
+}
+
+void format_gps_single_fabs(const double num, double *degrees,
+			    double *minutes, double *seconds)
+// format_gps_output() with the absolute value computed once.
+{
+	double magnitude = fabs(num);
+	*degrees = floor(magnitude);
+	*minutes = floor((magnitude - *degrees) * 60);
+	*seconds = (magnitude - *degrees - (*minutes / 60)) * 3600;
+}
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/shared_fields.h"
+#include "synth.h"
+#include <arpa/inet.h>
+
+enum synth_constants {
+	ZERG_PORT = 3751,
+	MIN_FRAME = 60,
+	MAX_FRAME = 256,
+	OUTPUT_BUFFER = 1 << 20
+};
+
+static uint64_t next_random(uint64_t *state);
+static unsigned int pick(uint64_t *state, unsigned int bound);
+static size_t build_payload(uint64_t *state, unsigned int type,
+			    uint16_t src, unsigned char *payload,
+			    size_t sequence);
+static size_t build_frame(unsigned char *frame, const unsigned char *zerg,
+			  size_t zerg_len, uint16_t ethertype,
+			  uint16_t port);
+static void put_be16(unsigned char *dst, uint16_t value);
+static void put_be32(unsigned char *dst, uint32_t value);
+
+void synth_defaults(struct synth_config *config)
+// Fills config with the mix used by "make bench": mostly GPS and status
+// traffic, a fifth of the records non-zerg noise, little endian.
+{
+	config->seed = 1;
+	config->mix[SYNTH_MESSAGE] = 1;
+	config->mix[SYNTH_STATUS] = 2;
+	config->mix[SYNTH_COMMAND] = 2;
+	config->mix[SYNTH_GPS] = 3;
+	config->noise = 20;
+	config->little_endian = true;
+	config->start_time = 1700000000;
+	config->size = 1 << 20;
+}
+
+int synth_parse_mix(const char *arg, struct synth_config *config)
+// Parses "MESSAGE,STATUS,COMMAND,GPS" weights. Returns 1 on success.
+{
+	unsigned int mix[SYNTH_NUM_PAYLOADS];
+	int consumed = 0;
+	if (sscanf(arg, "%u,%u,%u,%u%n", &mix[0], &mix[1], &mix[2], &mix[3],
+		   &consumed) != 4 || arg[consumed]) {
+		return (0);
+	}
+	if (mix[0] + mix[1] + mix[2] + mix[3] == 0) {
+		return (0);
+	}
+	memcpy(config->mix, mix, sizeof(mix));
+	return (1);
+}
+
+int synth_write(const struct synth_config *config, const char *path,
+		struct synth_counts *counts)
+// Writes a capture of about config->size bytes to path. The same
+// config always produces the same bytes. Returns 0 on success.
+{
+	FILE *fo = fopen(path, "wb");
+	if (!fo) {
+		return (-1);
+	}
+	setvbuf(fo, NULL, _IOFBF, OUTPUT_BUFFER);
+	memset(counts, 0, sizeof(*counts));
+
+	struct pcap_header fh = { 0xA1B2C3D4, 2, 4, 0, 0, 65535, 1 };
+	if (!config->little_endian) {
+		fh.magic_number = htonl(fh.magic_number);
+		fh.major_version = htons(fh.major_version);
+		fh.minor_version = htons(fh.minor_version);
+		fh.max_capture_len = htonl(fh.max_capture_len);
+		fh.link_layer_type = htonl(fh.link_layer_type);
+	}
+	fwrite(&fh, sizeof(fh), 1, fo);
+	counts->bytes = sizeof(fh);
+
+	unsigned int total_weight = 0;
+	for (size_t i = 0; i < SYNTH_NUM_PAYLOADS; ++i) {
+		total_weight += config->mix[i];
+	}
+	// xorshift state must never be zero
+	uint64_t state = config->seed ^ 0x9E3779B97F4A7C15ULL;
+	uint32_t seconds = config->start_time;
+
+	while (counts->bytes < config->size) {
+		unsigned char zerg[MAX_FRAME];
+		unsigned char frame[MAX_FRAME + 64];
+		size_t frame_len;
+		seconds += pick(&state, 3) == 2;
+		uint32_t micros = pick(&state, 1000000);
+		uint16_t src = 1 + pick(&state, 64);
+		uint16_t dst = 1 + pick(&state, 64);
+
+		if (pick(&state, 100) < config->noise) {
+			// Case: Non-zerg traffic, half IPv6 and half
+			// UDP to another port
+			memset(zerg, 0, 30);
+			if (pick(&state, 2)) {
+				frame_len = build_frame(frame, zerg, 30, 0x86DD,
+							ZERG_PORT);
+			} else {
+				frame_len = build_frame(frame, zerg, 30, 0x0800,
+							53);
+			}
+		} else {
+			unsigned int roll = pick(&state, total_weight);
+			unsigned int type = 0;
+			while (roll >= config->mix[type]) {
+				roll -= config->mix[type++];
+			}
+			size_t sequence = counts->records + 1;
+			size_t payload_len = build_payload(&state, type, src,
+							   zerg + 12,
+							   sequence);
+			size_t zerg_len = payload_len + 12;
+			zerg[0] = 1 << 4 | type;
+			zerg[1] = zerg_len >> 16;
+			zerg[2] = zerg_len >> 8;
+			zerg[3] = zerg_len;
+			put_be16(zerg + 4, src);
+			put_be16(zerg + 6, dst);
+			put_be32(zerg + 8, sequence);
+			frame_len = build_frame(frame, zerg, zerg_len, 0x0800,
+						ZERG_PORT);
+			++counts->zerg[type];
+		}
+
+		struct packet_header ph = { seconds, micros, frame_len,
+			frame_len
+		};
+		if (!config->little_endian) {
+			ph.unix_epoch = htonl(ph.unix_epoch);
+			ph.us_from_epoch = htonl(ph.us_from_epoch);
+			ph.data_capture_len = htonl(ph.data_capture_len);
+			ph.untruncated_len = htonl(ph.untruncated_len);
+		}
+		fwrite(&ph, sizeof(ph), 1, fo);
+		fwrite(frame, frame_len, 1, fo);
+		counts->bytes += sizeof(ph) + frame_len;
+		++counts->records;
+	}
+	if (fclose(fo) != 0) {
+		return (-1);
+	}
+	return (0);
+}
+
+static uint64_t next_random(uint64_t *state)
+// xorshift64*; fast and deterministic for a given seed.
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (*state * 0x2545F4914F6CDD1DULL);
+}
+
+static unsigned int pick(uint64_t *state, unsigned int bound)
+// Returns a value in [0, bound).
+{
+	return ((next_random(state) >> 32) * bound >> 32);
+}
+
+static size_t build_payload(uint64_t *state, unsigned int type,
+			    uint16_t src, unsigned char *payload,
+			    size_t sequence)
+// Writes a random but well-formed payload of the given type in network
+// byte order. Returns its length.
+{
+	static const char *const words[] = {
+		"hive", "spawn", "creep", "swarm", "brood", "evolve"
+	};
+	static const unsigned int commands[] = { 0, 1, 2, 4, 5, 6, 7 };
+	size_t len = 0;
+	union {
+		float f;
+		uint32_t u;
+	} single;
+	union {
+		double d;
+		uint64_t u;
+	} wide;
+
+	switch (type) {
+	case SYNTH_MESSAGE:
+		for (unsigned int i = 1 + pick(state, 8); i > 0; --i) {
+			const char *word = words[pick(state, 6)];
+			size_t word_len = strlen(word);
+			memcpy(payload + len, word, word_len);
+			len += word_len;
+			payload[len++] = i > 1 ? ' ' : '.';
+		}
+		break;
+	case SYNTH_STATUS:
+		{
+			uint32_t hp = pick(state, 1000);
+			uint32_t max_hp = hp + pick(state, 1000);
+			payload[0] = hp >> 16;
+			payload[1] = hp >> 8;
+			payload[2] = hp;
+			payload[3] = pick(state, 20);
+			payload[4] = max_hp >> 16;
+			payload[5] = max_hp >> 8;
+			payload[6] = max_hp;
+			payload[7] = pick(state, 16);
+			single.f = 0.25f * (1 + pick(state, 64));
+			put_be32(payload + 8, single.u);
+			len = 12 + sprintf((char *)payload + 12, "Unit%u", src);
+		}
+		break;
+	case SYNTH_COMMAND:
+		{
+			unsigned int command = commands[pick(state, 7)];
+			put_be16(payload, command);
+			len = 2;
+			if (command == 1) {
+				put_be16(payload + 2, pick(state, 500));
+				single.f = 0.5f * pick(state, 720);
+				put_be32(payload + 4, single.u);
+				len = 8;
+			} else if (command == 5) {
+				payload[2] = pick(state, 2);
+				payload[3] = 0;
+				put_be32(payload + 4, pick(state, 50));
+				len = 8;
+			} else if (command == 7) {
+				put_be16(payload + 2, 0);
+				put_be32(payload + 4, 1 + pick(state, sequence));
+				len = 8;
+			}
+		}
+		break;
+	case SYNTH_GPS:
+		wide.d = pick(state, 360000000) / 1e6 - 180;
+		put_be32(payload, wide.u >> 32);
+		put_be32(payload + 4, wide.u);
+		wide.d = pick(state, 180000000) / 1e6 - 90;
+		put_be32(payload + 8, wide.u >> 32);
+		put_be32(payload + 12, wide.u);
+		for (size_t i = 0; i < 4; ++i) {
+			single.f = pick(state, 100000) / 100.0f;
+			put_be32(payload + 16 + 4 * i, single.u);
+		}
+		len = 32;
+		break;
+	}
+	return (len);
+}
+
+static size_t build_frame(unsigned char *frame, const unsigned char *zerg,
+			  size_t zerg_len, uint16_t ethertype, uint16_t port)
+// Wraps zerg_len bytes in Ethernet, IPv4 and UDP headers, padding the
+// frame to the Ethernet minimum. Returns the frame length.
+{
+	memset(frame, 0, 42);
+	memset(frame, 0x01, 6);
+	memset(frame + 6, 0x02, 6);
+	put_be16(frame + 12, ethertype);
+	frame[14] = 4 << 4 | 5;
+	put_be16(frame + 16, 20 + 8 + zerg_len);
+	frame[22] = 64;
+	frame[23] = 17;
+	put_be16(frame + 34, 1234);
+	put_be16(frame + 36, port);
+	put_be16(frame + 38, 8 + zerg_len);
+	memcpy(frame + 42, zerg, zerg_len);
+	size_t len = 42 + zerg_len;
+	if (len < MIN_FRAME) {
+		memset(frame + len, 0, MIN_FRAME - len);
+		len = MIN_FRAME;
+	}
+	return (len);
+}
+
+static void put_be16(unsigned char *dst, uint16_t value)
+{
+	dst[0] = value >> 8;
+	dst[1] = value;
+}
+
+static void put_be32(unsigned char *dst, uint32_t value)
+{
+	dst[0] = value >> 24;
+	dst[1] = value >> 16;
+	dst[2] = value >> 8;
+	dst[3] = value;
+}
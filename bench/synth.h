@@ -0,0 +1,33 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum synth_payloads {
+	SYNTH_MESSAGE,
+	SYNTH_STATUS,
+	SYNTH_COMMAND,
+	SYNTH_GPS,
+	SYNTH_NUM_PAYLOADS
+};
+
+struct synth_config {
+	uint64_t seed;
+	unsigned int mix[SYNTH_NUM_PAYLOADS];	// Relative payload weights
+	unsigned int noise;	// Percent of records that are not zerg
+	bool little_endian;
+	uint32_t start_time;	// Epoch seconds of the first record
+	size_t size;		// Stop once the capture reaches this size
+};
+
+struct synth_counts {
+	size_t bytes;
+	size_t records;
+	size_t zerg[SYNTH_NUM_PAYLOADS];
+};
+
+void synth_defaults(struct synth_config *config);
+
+int synth_parse_mix(const char *arg, struct synth_config *config);
+
+int synth_write(const struct synth_config *config, const char *path,
+		struct synth_counts *counts);
@@ -1,303 +1,632 @@
+#include <getopt.h>
+#include <errno.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "lib/shared_fields.h"
+#include "lib/readahead.h"
+#include "lib/out_stream.h"
+#include "lib/seq_index.h"
+#include "lib/unit_table.h"
+#include "lib/time_index.h"
+#include "lib/capture.h"
+#include "lib/stats.h"
+#include "lib/schema.h"
 #include <netinet/in.h>
+#include <unistd.h>
 
-enum program_defaults {
-	DEFAULT_PACKET_NUM = 5
+enum long_only_options {
+	STATS_OPTION = 256
 };
 
-int load_packets(struct zerg_header **payloads, size_t num_packets,
-		 size_t max_packets, bool little_endian, FILE * fo);
-int load_message(struct zerg_header *payloads, size_t length, FILE * fo);
-int load_status(struct zerg_header *payloads, size_t length, FILE * fo);
-int load_command(struct zerg_header *payloads, size_t length, FILE * fo);
-int load_gps(struct zerg_header *payloads, size_t length, FILE * fo);
-void destroy_payloads(struct zerg_header *payloads, int num_payloads);
-int resize_array(struct zerg_header **payloads, int max_payloads);
-void print_headers(struct zerg_header *payloads, int num_payloads);
-void print_message(struct zerg_header payload);
-void print_status(struct zerg_header payload);
-void print_command(struct zerg_header payload);
-void print_gps(struct zerg_header payload);
-void format_gps_output(const double num, double *degrees, double *minutes,
-		       double *seconds);
+static struct {
+	size_t queue_depth;
+	size_t buffer_size;
+	enum readahead_backend io_backend;
+	const char *split_prefix;
+	size_t split_src_width;
+	size_t limit;
+	size_t every;
+	size_t sample;
+	uint64_t seed;
+	bool headers_only;
+	bool sequence_check;
+	bool state;
+	size_t state_interval;
+	const char *from;
+	const char *to;
+} options = { READAHEAD_DEFAULT_DEPTH, READAHEAD_DEFAULT_BUF_SIZE,
+	READAHEAD_AUTO, NULL, 0, 0, 0, 0, 1, false, false, false, 0, NULL, NULL
+};
+
+enum shard_limits {
+	SHARD_OPEN_MAX = 256,	// Open shards; the rest are reopened later
+	SHARD_BUF_SIZE = 1 << 16	// Buffer per shard when split by source
+};
+
+static const char *const payload_names[] = {
+	"message", "status", "command", "gps"
+};
+
+static struct {
+	struct out_stream *standard;	// Used when output is not split
+	struct out_stream **shards;	// One per payload type and src range
+	size_t buckets;			// Number of zerg_src ranges per type
+	uint64_t *last_used;	// When each shard was last selected, or 0
+	uint64_t clock;
+	size_t open[SHARD_OPEN_MAX];	// Shards whose streams are open
+	size_t open_count;
+	struct out_stream *state;	// PREFIX.state when output is split
+	bool failed;		// An output could not be opened or written
+} outputs;
+
+struct sample {
+	struct zerg_header zh;
+	size_t ordinal;		// Position among the valid zerg packets
+};
+
+static struct {
+	struct sample *samples;
+	size_t count;
+	size_t next;		// Ordinal of the next packet to take
+	double weight;
+	uint64_t state;
+} reservoir;
+
+static struct seq_index *sequences;	// Set by --sequence-check
+static struct unit_table *units;	// Set by --state
+
+static struct {
+	bool active;		// Set by --from or --to
+	uint64_t from;		// Inclusive bounds in microseconds
+	uint64_t to;
+} time_range = { false, 0, UINT64_MAX };
+
+void decode_packets(struct capture *captures, size_t count);
+void sift_down(struct capture **heap, size_t count, size_t i);
+int load_headers(struct zerg_header *zh, struct capture *cap);
+int load_payload(struct zerg_header *zh, size_t length,
+		 struct readahead *fo);
+int load_message(struct zerg_header *payloads, size_t length,
+		 struct readahead *fo);
+int load_status(struct zerg_header *payloads, size_t length,
+		struct readahead *fo);
+int load_command(struct zerg_header *payloads, size_t length,
+		 struct readahead *fo);
+int load_gps(struct zerg_header *payloads, size_t length,
+	     struct readahead *fo);
+void destroy_payload(struct zerg_header *zh);
+bool sample_wanted(size_t ordinal);
+void sample_store(struct zerg_header *zh, size_t ordinal);
+double sample_random(void);
+int compare_samples(const void *a, const void *b);
+void print_samples(void);
+void print_packet(struct zerg_header payload);
+void print_state(size_t valid_packets);
+int write_output(void *out, const void *data, size_t len);
+void print_repeat_target(struct out_stream *out, struct zerg_header payload,
+			 unsigned int sequence);
+int parse_time(const char *arg, uint64_t first_time, uint64_t *time);
+int seek_time_range(struct capture *captures, size_t count);
+int open_outputs(void);
+struct out_stream *select_output(const struct zerg_header *zh);
+struct out_stream *open_shard(size_t index);
+void close_shard(size_t slot);
+size_t least_recent_shard(void);
+void shard_path(size_t index, char *path, size_t size);
+struct out_stream *state_output(void);
+int close_outputs(void);
+void close_captures(struct capture *captures, size_t count);
 
 int total_packets = 0;
 
 int main(int argc, char *argv[])
 {
-	if (argc == 1 || argc > 2) {
-		fprintf(stderr, "Usage: %s [FILE]\n", argv[0]);
+	static const struct option long_options[] = {
+		{"queue-depth", required_argument, NULL, 'q'},
+		{"buffer-size", required_argument, NULL, 'B'},
+		{"io", required_argument, NULL, 'i'},
+		{"split", required_argument, NULL, 'o'},
+		{"split-src", required_argument, NULL, 's'},
+		{"limit", required_argument, NULL, 'n'},
+		{"every", required_argument, NULL, 'e'},
+		{"sample", required_argument, NULL, 'S'},
+		{"seed", required_argument, NULL, 'r'},
+		{"headers-only", no_argument, NULL, 'H'},
+		{"sequence-check", no_argument, NULL, 'c'},
+		{"state", no_argument, NULL, 'u'},
+		{"state-interval", required_argument, NULL, 'U'},
+		{"from", required_argument, NULL, 'f'},
+		{"to", required_argument, NULL, 't'},
+#ifdef CODEC_STATS
+		{"stats", optional_argument, NULL, STATS_OPTION},
+#endif
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	size_t seed;
+	while ((opt = getopt_long(argc, argv, "q:B:i:o:s:n:e:S:r:HcuU:f:t:",
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'q':
+			if (!parse_size(optarg, &options.queue_depth)
+			    || options.queue_depth < 2) {
+				fprintf(stderr,
+					"Queue depth must be a number of at least 2\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'B':
+			if (!parse_size(optarg, &options.buffer_size)
+			    || options.buffer_size == 0) {
+				fprintf(stderr,
+					"Buffer size must be a positive size such as 512K or 4M\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'i':
+			if (strcmp(optarg, "uring") == 0) {
+				options.io_backend = READAHEAD_URING;
+			} else if (strcmp(optarg, "thread") == 0) {
+				options.io_backend = READAHEAD_THREAD;
+			} else if (strcmp(optarg, "mmap") == 0) {
+				options.io_backend = READAHEAD_MMAP;
+			} else {
+				fprintf(stderr,
+					"Expected \"uring\", \"thread\" or \"mmap\"; received \"%s\"\n",
+					optarg);
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'o':
+			options.split_prefix = optarg;
+			break;
+		case 's':
+			if (!parse_size(optarg, &options.split_src_width)
+			    || options.split_src_width == 0
+			    || options.split_src_width > 65536) {
+				fprintf(stderr,
+					"zerg_src range width must be between 1 and 65536\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'n':
+			if (!parse_size(optarg, &options.limit)
+			    || options.limit == 0) {
+				fprintf(stderr,
+					"Limit must be a positive number of packets\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'e':
+			if (!parse_size(optarg, &options.every)
+			    || options.every == 0) {
+				fprintf(stderr,
+					"--every must be a positive number of packets\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'S':
+			if (!parse_size(optarg, &options.sample)
+			    || options.sample == 0) {
+				fprintf(stderr,
+					"Sample size must be a positive number of packets\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'r':
+			if (!parse_size(optarg, &seed)) {
+				fprintf(stderr, "Seed must be a number\n");
+				return (INVOCATION_ERROR);
+			}
+			options.seed = seed;
+			break;
+		case 'H':
+			options.headers_only = true;
+			break;
+		case 'c':
+			options.sequence_check = true;
+			break;
+		case 'u':
+			options.state = true;
+			break;
+		case 'U':
+			if (!parse_size(optarg, &options.state_interval)
+			    || options.state_interval == 0) {
+				fprintf(stderr,
+					"State interval must be a positive number of packets\n");
+				return (INVOCATION_ERROR);
+			}
+			options.state = true;
+			break;
+		case 'f':
+			options.from = optarg;
+			break;
+		case 't':
+			options.to = optarg;
+			break;
+#ifdef CODEC_STATS
+		case STATS_OPTION:
+			if (stats_enable(optarg) != 0) {
+				return (INVOCATION_ERROR);
+			}
+			break;
+#endif
+		case '?':
+			return (INVOCATION_ERROR);
+		}
+	}
+	if (options.every && options.sample) {
+		fprintf(stderr, "--every and --sample cannot be combined\n");
 		return (INVOCATION_ERROR);
 	}
-	FILE *fo = fopen(argv[1], "rb");
-	if (!fo) {
-		fprintf(stderr, "%s could not be opened", argv[1]);
-		perror(" \b");
-		return (FILE_ERROR);
+	if (options.state
+	    && (options.every || options.sample || options.headers_only)) {
+		fprintf(stderr,
+			"--state needs every payload and cannot be combined with --every, --sample or --headers-only\n");
+		return (INVOCATION_ERROR);
 	}
-
-	struct zerg_header *payloads =
-	    calloc(DEFAULT_PACKET_NUM, sizeof(*payloads));
-	if (!payloads) {
+	if (options.split_src_width && !options.split_prefix) {
+		fprintf(stderr, "--split-src requires --split PREFIX\n");
+		return (INVOCATION_ERROR);
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: %s [OPTION]... FILE...\n", argv[0]);
+		return (INVOCATION_ERROR);
+	}
+	size_t count = 0;
+	struct capture *captures = calloc(argc - optind, sizeof(*captures));
+	if (!captures) {
 		fprintf(stderr, "Memory allocation error\n");
-		fclose(fo);
 		return (MEMORY_ERROR);
 	}
-
-	struct pcap_header fh;	// [f]ile [h]eader
-	bool little_endian = true;	// Denotes the endianness of the pcap headers
-	int read_items = fread(&fh, sizeof(fh), 1, fo);
-	if (read_items != 1) {
-		fprintf(stderr,
-			"%s is not of a type that is currently supported\n",
-			argv[1]);
-		fclose(fo);
-		free(payloads);
-		return (SUCCESS);
-	}
-	if (fh.magic_number == 0xA1B2C3D4) {
-		// Case: Packet has same byte order as host (Little Endian)
-		if (fh.major_version != 2 || fh.minor_version != 4) {
-			fprintf(stderr,
-				"%s is not of a type that is currently supported\n",
-				argv[1]);
-			destroy_payloads(payloads, 0);
-			fclose(fo);
-			return (SUCCESS);
+	for (int i = optind; i < argc; ++i) {
+		char *file_name = argv[i];
+		struct readahead *fo = readahead_open(file_name,
+						      options.queue_depth,
+						      options.buffer_size,
+						      options.io_backend);
+		if (!fo) {
+			fprintf(stderr, "%s could not be opened", file_name);
+			perror(" \b");
+			close_captures(captures, count);
+			return (FILE_ERROR);
 		}
-		little_endian = true;
-	} else if (fh.magic_number == 0xD4C3B2A1) {
-		// Case: Packet has reverse byte order from host (Big Endian)
-		if (ntohs(fh.major_version) != 2
-		    || ntohs(fh.minor_version) != 4) {
+		if (capture_init(&captures[count], file_name, fo) != 0) {
+			// Case: Not a pcap 2.4 capture; the others still decode
 			fprintf(stderr,
 				"%s is not of a type that is currently supported\n",
-				argv[1]);
-			destroy_payloads(payloads, 0);
-			fclose(fo);
-			return (SUCCESS);
+				file_name);
+			readahead_close(fo);
+			continue;
 		}
-		little_endian = false;
-	} else {
-		// Case: Malformed magic number
-		fprintf(stderr,
-			"%s is not of a type that is currently supported\n",
-			argv[1]);
-		destroy_payloads(payloads, 0);
-		fclose(fo);
+		++count;
+	}
+	if (count == 0) {
+		free(captures);
 		return (SUCCESS);
 	}
 
-	int num_payloads =
-	    load_packets(&payloads, 0, DEFAULT_PACKET_NUM, little_endian, fo);
-	print_headers(payloads, num_payloads);
+	if (options.from || options.to) {
+		int return_code = seek_time_range(captures, count);
+		if (return_code != SUCCESS) {
+			close_captures(captures, count);
+			return (return_code);
+		}
+	}
+
+	if (options.sample) {
+		reservoir.samples =
+		    calloc(options.sample, sizeof(*reservoir.samples));
+		// xorshift state must never be zero
+		reservoir.state = options.seed ^ 0x9E3779B97F4A7C15ULL;
+	}
+	if (options.sequence_check) {
+		sequences = seq_index_create(SEQ_INDEX_DEFAULT_SLOTS, stderr);
+	}
+	if (options.state) {
+		units = unit_table_create();
+	}
+	if (open_outputs() != 0 || (options.sample && !reservoir.samples)
+	    || (options.sequence_check && !sequences)
+	    || (options.state && !units)) {
+		fprintf(stderr, "Memory allocation error\n");
+		free(reservoir.samples);
+		seq_index_destroy(sequences);
+		unit_table_destroy(units);
+		close_captures(captures, count);
+		return (MEMORY_ERROR);
+	}
+	decode_packets(captures, count);
+	unit_table_destroy(units);
+	if (sequences) {
+		seq_index_report(sequences);
+		seq_index_destroy(sequences);
+	}
 
-	fclose(fo);
-	destroy_payloads(payloads, num_payloads);
+	close_captures(captures, count);
+	STATS_START(timer);
+	int return_code = close_outputs();
+	STATS_STOP(STAGE_FLUSH, timer);
+	if (return_code != 0) {
+		perror("Output could not be written");
+		return (FILE_ERROR);
+	}
+	if (outputs.failed) {
+		// Case: Reported when it happened
+		return (FILE_ERROR);
+	}
+	STATS_REPORT(stderr);
 
 	return (SUCCESS);
 }
 
-int load_packets(struct zerg_header **payloads, size_t num_payloads,
-		 size_t max_payloads, bool little_endian, FILE * fo)
-// Loads zerg packet headers into payloads and returns the number of
-// successfully added packets.
+void decode_packets(struct capture *captures, size_t count)
+// Streams packets from every capture in timestamp order, printing each
+// selected zerg packet as soon as it has been loaded. A min-heap holds
+// the capture with the earliest pending record at its root, so memory
+// stays constant per input. Stops reading once --limit is satisfied.
 {
-	for (;;) {
-		int return_code = 0;
-		if (num_payloads == max_payloads) {
-			return_code = resize_array(payloads, max_payloads);
-			max_payloads *= 2;
-			if (return_code == MEMORY_ERROR) {
-				destroy_payloads(*payloads, num_payloads);
-				fclose(fo);
-				fprintf(stderr, "Memory allocation Error\n");
-				exit(MEMORY_ERROR);
-			}
+	size_t valid_packets = 0;
+	size_t emitted = 0;
+
+	struct capture **heap = malloc(count * sizeof(*heap));
+	if (!heap) {
+		fprintf(stderr, "Memory allocation error\n");
+		return;
+	}
+	size_t pending = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (capture_next(&captures[i])) {
+			heap[pending++] = &captures[i];
 		}
-		struct packet_header ph;
-		struct ethernet_header eh;
-		struct ip_header ih;
-		struct udp_header uh;
-		size_t test_len = 0;
-		++total_packets;
-		long packet_start = ftell(fo);
-
-		test_len = fread(&ph, 1, sizeof(ph), fo);
-		if (test_len != sizeof(ph)) {
-			// Case: EOF reached
-			break;
+	}
+	for (size_t i = pending / 2; i-- > 0;) {
+		sift_down(heap, pending, i);
+	}
+
+	for (; pending > 0; sift_down(heap, pending, 0)) {
+		size_t counted = emitted;
+		if (options.sample || options.state) {
+			counted = valid_packets;
 		}
-		// TODO: Check packet header length for validity?
-		// Potential use of fseek and ftell to skip files
-		test_len = fread(&eh, 1, sizeof(eh), fo);
-		if (test_len != sizeof(eh)) {
-			// Case: EOF reached
+		if (options.limit && counted >= options.limit) {
+			// Case: Nothing more will be emitted; stop reading
 			break;
 		}
-		if (eh.eth_ethernet_type != 8) {
-			// Case: Ethertype was not IPv4 (8)
-			fprintf(stderr,
-				"Only IPv4 packets are currently supported; packet #%d discarded\n",
-				total_packets);
-			if (little_endian) {
-				fseek(fo,
-				      packet_start + ph.untruncated_len +
-				      sizeof(ph), SEEK_SET);
-			} else {
-				fseek(fo,
-				      packet_start + ntohl(ph.untruncated_len) +
-				      sizeof(ph), SEEK_SET);
-			}
-			continue;
-		}
-
-		test_len = fread(&ih, 1, sizeof(ih), fo);
-		if (test_len != sizeof(ih)) {
-			// Case: EOF reached
+		if (outputs.failed) {
+			// Case: Output would be incomplete; stop reading
 			break;
 		}
-		if (ih.ip_version != 4) {
-			// Case: IP Version was not 4
-			fprintf(stderr,
-				"Only IPv4 packets are currently supported; packet #%d discarded\n",
-				total_packets);
-			if (little_endian) {
-				fseek(fo,
-				      packet_start + ph.untruncated_len +
-				      sizeof(ph), SEEK_SET);
-			} else {
-				fseek(fo,
-				      packet_start + ntohl(ph.untruncated_len) +
-				      sizeof(ph), SEEK_SET);
-			}
+		struct capture *cap = heap[0];
+		struct zerg_header zh;
+		STATS_START(timer);
+		int return_code = load_headers(&zh, cap);
+		STATS_STOP(STAGE_HEADERS, timer);
+		if (return_code == 0) {
+			// Case: Capture ended inside a record
+			heap[0] = heap[--pending];
 			continue;
 		}
-		if (ih.ip_protocol != 0x11) {
-			// Case: IPv4 header next protocol was not UDP
-			fprintf(stderr,
-				"Only UDP packets are currently supported; packet #%d discarded\n",
-				total_packets);
-			if (little_endian) {
-				// TODO: Figure out why this number has to be 16 to work
-				fseek(fo,
-				      packet_start + ph.untruncated_len +
-				      sizeof(ph), SEEK_SET);
-			} else {
-				fseek(fo,
-				      packet_start + ntohl(ph.untruncated_len) +
-				      sizeof(ph), SEEK_SET);
+		if (return_code == -1) {
+			if (!capture_next(cap)) {
+				heap[0] = heap[--pending];
 			}
 			continue;
 		}
+		++valid_packets;
+		STATS_COUNT(COUNT_DECODED);
+		if (sequences) {
+			// Every valid packet is indexed, selected or not
+			seq_index_add(sequences, ntohs(zh.zerg_src),
+				      ntohl(zh.zerg_sequence),
+				      zh.zerg_packet_type, total_packets);
+		}
 
-		test_len = fread(&uh, 1, sizeof(uh), fo);
-		if (test_len != sizeof(uh)) {
-			// Case: EOF reached
-			break;
+		bool wanted = true;
+		if (options.every) {
+			wanted = (valid_packets - 1) % options.every == 0;
+		} else if (options.sample) {
+			wanted = sample_wanted(valid_packets);
 		}
-		if (ntohs(uh.udp_dst_port) != 3751) {
-			// Case: UDP destination port did not match
-			// Zerg protocol port (3751)
-			fprintf(stderr,
-				"Only packets bound for port 3751 are currently supported; packet #%d discarded\n",
-				total_packets);
-			if (little_endian) {
-				fseek(fo,
-				      packet_start + ph.untruncated_len +
-				      sizeof(ph), SEEK_SET);
-			} else {
-				fseek(fo,
-				      packet_start + ntohl(ph.untruncated_len) +
-				      sizeof(ph), SEEK_SET);
+		if (wanted && !options.headers_only) {
+			unsigned int corrected_len =
+			    shift_24_bit_int(zh.zerg_len) - 12;
+			if (!load_payload(&zh, corrected_len, cap->fo)) {
+				// Case: EOF reached inside the payload
+				STATS_COUNT(COUNT_DISCARD_TRUNCATED);
+				heap[0] = heap[--pending];
+				continue;
 			}
-			continue;
 		}
-		test_len =
-		    fread((&(*payloads)[num_payloads]), 1,
-			  sizeof((*payloads)[0]) -
-			  sizeof((*payloads)[0].zerg_payload), fo);
-		if (test_len !=
-		    sizeof((*payloads)[0]) -
-		    sizeof((*payloads)[0].zerg_payload)) {
-			// Case: EOF reached
-			break;
+		// Unselected payloads and headers-only decodes are skipped
+		// unread by moving straight to the next record
+		if (!capture_next(cap)) {
+			heap[0] = heap[--pending];
 		}
-		if ((*payloads)[num_payloads].zerg_version != 1) {
-			// Case: Ethertype was not IPv4 (8)
-			fprintf(stderr,
-				"Only version 1 Zerg packets are currently supported; packet #%d discarded\n",
-				total_packets);
-			if (little_endian) {
-				fseek(fo,
-				      packet_start + ph.untruncated_len +
-				      sizeof(ph), SEEK_SET);
-			} else {
-				fseek(fo,
-				      packet_start + ntohl(ph.untruncated_len) +
-				      sizeof(ph), SEEK_SET);
-			}
+		if (!wanted) {
 			continue;
 		}
-		return_code = 0;
-		unsigned int corrected_len =
-		    shift_24_bit_int((*payloads)[num_payloads].zerg_len);
-		corrected_len -= 12;
-		switch ((*payloads)[num_payloads].zerg_packet_type) {
-		case 0:
-			return_code =
-			    load_message(&((*payloads)[num_payloads]),
-					 corrected_len, fo);
-			break;
-		case 1:
-			return_code =
-			    load_status(&((*payloads)[num_payloads]),
-					corrected_len, fo);
-			break;
-		case 2:
-			return_code =
-			    load_command(&((*payloads)[num_payloads]),
-					 corrected_len, fo);
-			break;
-		case 3:
-			return_code =
-			    load_gps(&((*payloads)[num_payloads]),
-				     corrected_len, fo);
-			break;
-		default:
-			--num_payloads;
-			return_code = 0;
-			break;
-		}
-		if (return_code == 0) {
-			break;
-		} else if (return_code == -1) {
-			// Currently unused; use later for validation
-			// of packets mid-read
-			continue;
+		if (units) {
+			// Case: State table replaces per-packet output
+			unit_table_update(units, &zh, total_packets);
+			destroy_payload(&zh);
+			if (options.state_interval
+			    && valid_packets % options.state_interval == 0) {
+				print_state(valid_packets);
+			}
+		} else if (options.sample) {
+			sample_store(&zh, valid_packets);
 		} else {
-			++num_payloads;
+			print_packet(zh);
+			destroy_payload(&zh);
+			++emitted;
 		}
-		unsigned short len = ntohs(ih.ip_packet_length);
-
-		if (len + 14 < 60) {
-			size_t eth_padding_len = 60 - len - 14;
-			for (size_t i = 0; i < eth_padding_len; ++i) {
-				// Until padding has been removed, read one byte
-				// at a time into ph, which will be overwritten
-				// when the next packet is read anyway.
-				fread(&ph, 1, 1, fo);
-			}
+	}
+	free(heap);
+	if (options.sample) {
+		print_samples();
+	}
+	if (units) {
+		print_state(valid_packets);
+	}
+}
+
+void sift_down(struct capture **heap, size_t count, size_t i)
+// Restores the heap order below index i after its record changed.
+{
+	for (;;) {
+		size_t earliest = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+		if (left < count && capture_before(heap[left], heap[earliest])) {
+			earliest = left;
+		}
+		if (right < count
+		    && capture_before(heap[right], heap[earliest])) {
+			earliest = right;
+		}
+		if (earliest == i) {
+			return;
 		}
+		struct capture *tmp = heap[i];
+		heap[i] = heap[earliest];
+		heap[earliest] = tmp;
+		i = earliest;
+	}
+}
+
+int load_headers(struct zerg_header *zh, struct capture *cap)
+// Loads the headers of the current record of cap, whose pcap record
+// header has already been read by capture_next(), leaving the zerg
+// header in zh and the reader positioned at the start of the zerg
+// payload. Returns 1 for a valid zerg packet, -1 if the packet was
+// discarded and 0 at EOF.
+{
+	struct readahead *fo = cap->fo;
+	struct ethernet_header eh;
+	struct ip_header ih;
+	struct udp_header uh;
+	size_t test_len = 0;
+	++total_packets;
+
+	if (time_range.active
+	    && (cap->time < time_range.from || cap->time > time_range.to)) {
+		// Case: Outside --from/--to; skipped silently
+		STATS_COUNT(COUNT_DISCARD_TIME_RANGE);
+		return (-1);
+	}
+	test_len = readahead_read(fo, &eh, sizeof(eh));
+	if (test_len != sizeof(eh)) {
+		// Case: EOF reached
+		STATS_COUNT(COUNT_DISCARD_TRUNCATED);
+		return (0);
+	}
+	if (eh.eth_ethernet_type != 8) {
+		// Case: Ethertype was not IPv4 (8)
+		STATS_COUNT(COUNT_DISCARD_ETHERTYPE);
+		fprintf(stderr,
+			"Only IPv4 packets are currently supported; packet #%d discarded\n",
+			total_packets);
+		return (-1);
+	}
+
+	test_len = readahead_read(fo, &ih, sizeof(ih));
+	if (test_len != sizeof(ih)) {
+		// Case: EOF reached
+		STATS_COUNT(COUNT_DISCARD_TRUNCATED);
+		return (0);
+	}
+	if (ih.ip_version != 4) {
+		// Case: IP Version was not 4
+		STATS_COUNT(COUNT_DISCARD_IP_VERSION);
+		fprintf(stderr,
+			"Only IPv4 packets are currently supported; packet #%d discarded\n",
+			total_packets);
+		return (-1);
+	}
+	if (ih.ip_protocol != 0x11) {
+		// Case: IPv4 header next protocol was not UDP
+		STATS_COUNT(COUNT_DISCARD_PROTOCOL);
+		fprintf(stderr,
+			"Only UDP packets are currently supported; packet #%d discarded\n",
+			total_packets);
+		return (-1);
+	}
+
+	test_len = readahead_read(fo, &uh, sizeof(uh));
+	if (test_len != sizeof(uh)) {
+		// Case: EOF reached
+		STATS_COUNT(COUNT_DISCARD_TRUNCATED);
+		return (0);
+	}
+	if (ntohs(uh.udp_dst_port) != 3751) {
+		// Case: UDP destination port did not match
+		// Zerg protocol port (3751)
+		STATS_COUNT(COUNT_DISCARD_PORT);
+		fprintf(stderr,
+			"Only packets bound for port 3751 are currently supported; packet #%d discarded\n",
+			total_packets);
+		return (-1);
+	}
+	test_len = readahead_read(fo, zh, sizeof(*zh) -
+				  sizeof(zh->zerg_payload));
+	if (test_len != sizeof(*zh) - sizeof(zh->zerg_payload)) {
+		// Case: EOF reached
+		STATS_COUNT(COUNT_DISCARD_TRUNCATED);
+		return (0);
+	}
+	zh->zerg_payload = NULL;
+	if (zh->zerg_version != 1) {
+		// Case: Zerg version was not 1
+		STATS_COUNT(COUNT_DISCARD_ZERG_VERSION);
+		fprintf(stderr,
+			"Only version 1 Zerg packets are currently supported; packet #%d discarded\n",
+			total_packets);
+		return (-1);
+	}
+	if (zh->zerg_packet_type > 3
+	    || (unsigned int)shift_24_bit_int(zh->zerg_len) < 12) {
+		// Case: Unknown payload type or length shorter than header
+		STATS_COUNT(COUNT_DISCARD_MALFORMED);
+		fprintf(stderr,
+			"Malformed Zerg header; packet #%d discarded\n",
+			total_packets);
+		return (-1);
+	}
+	return (1);
+}
+
+int load_payload(struct zerg_header *zh, size_t length,
+		 struct readahead *fo)
+// Loads the payload following the zerg header zh. Returns 0 at EOF.
+{
+	int loaded = 0;
+	STATS_START(timer);
+	switch (zh->zerg_packet_type) {
+	case 0:
+		loaded = load_message(zh, length, fo);
+		break;
+	case 1:
+		loaded = load_status(zh, length, fo);
+		break;
+	case 2:
+		loaded = load_command(zh, length, fo);
+		break;
+	case 3:
+		loaded = load_gps(zh, length, fo);
+		break;
 	}
-	return (num_payloads);
+	STATS_STOP(STAGE_LOAD_MESSAGE + zh->zerg_packet_type, timer);
+	return (loaded);
 }
 
-int load_message(struct zerg_header *payloads, size_t length, FILE * fo)
+int load_message(struct zerg_header *payloads, size_t length,
+		 struct readahead *fo)
 // Loads the message payload from a given zerg packet.
 {
 	// TODO: Discard packets with letter V
@@ -306,7 +635,7 @@ int load_message(struct zerg_header *payloads, size_t length, FILE * fo)
 		fprintf(stderr, "Memory allocation error.\n");
 		return (0);
 	}
-	size_t read_length = fread(message, 1, length, fo);
+	size_t read_length = readahead_read(fo, message, length);
 	if (read_length != length) {
 		// Case: EOF
 		free(message);
@@ -324,7 +653,8 @@ int load_message(struct zerg_header *payloads, size_t length, FILE * fo)
 	return (1);
 }
 
-int load_status(struct zerg_header *payloads, size_t length, FILE * fo)
+int load_status(struct zerg_header *payloads, size_t length,
+		struct readahead *fo)
 // Loads the status payload from a given zerg packet.
 {
 	size_t string_len = length - 12;
@@ -340,7 +670,8 @@ int load_status(struct zerg_header *payloads, size_t length, FILE * fo)
 		return (0);
 	}
 
-	size_t read_length = fread(status_struct, 1, length - string_len, fo);
+	size_t read_length =
+	    readahead_read(fo, status_struct, length - string_len);
 	if (read_length != length - string_len) {
 		// Case: EOF
 		free(name);
@@ -348,7 +679,7 @@ int load_status(struct zerg_header *payloads, size_t length, FILE * fo)
 		return (0);
 	}
 
-	read_length = fread(name, 1, string_len, fo);
+	read_length = readahead_read(fo, name, string_len);
 	if (read_length != string_len) {
 		// Case: EOF
 		free(name);
@@ -361,7 +692,8 @@ int load_status(struct zerg_header *payloads, size_t length, FILE * fo)
 	return (1);
 }
 
-int load_command(struct zerg_header *payloads, size_t length, FILE * fo)
+int load_command(struct zerg_header *payloads, size_t length,
+		 struct readahead *fo)
 // Loads the command payload from a given zerg packet.
 {
 	struct zerg_command *command_struct =
@@ -369,7 +701,7 @@ int load_command(struct zerg_header *payloads, size_t length, FILE * fo)
 	if (!command_struct) {
 		return (0);
 	}
-	size_t read_length = fread(command_struct, 1, length, fo);
+	size_t read_length = readahead_read(fo, command_struct, length);
 	if (read_length != length) {
 		// Case: EOF
 		free(command_struct);
@@ -379,7 +711,8 @@ int load_command(struct zerg_header *payloads, size_t length, FILE * fo)
 	return (1);
 }
 
-int load_gps(struct zerg_header *payloads, size_t length, FILE * fo)
+int load_gps(struct zerg_header *payloads, size_t length,
+	     struct readahead *fo)
 // Loads the gps payload from a given zerg packet.
 {
 	struct zerg_gps *gps_struct = malloc(sizeof(*gps_struct));
@@ -387,7 +720,7 @@ int load_gps(struct zerg_header *payloads, size_t length, FILE * fo)
 		fprintf(stderr, "Memory allocation error.\n");
 		return (0);
 	}
-	size_t read_length = fread(gps_struct, 1, length, fo);
+	size_t read_length = readahead_read(fo, gps_struct, length);
 	if (read_length != length) {
 		// Case: EOF
 		free(gps_struct);
@@ -397,273 +730,465 @@ int load_gps(struct zerg_header *payloads, size_t length, FILE * fo)
 	return (1);
 }
 
-void destroy_payloads(struct zerg_header *payloads, int num_payloads)
-// Destroys the payloads structarray at various stages of it being
-// built and filled out. Syntax taken from Liam Echlin in array.c.
+void destroy_payload(struct zerg_header *zh)
+// Frees the payload loaded for a single zerg packet.
 {
-	for (int i = 0; i < num_payloads; ++i) {
-		switch (payloads[i].zerg_packet_type) {
-		case 0:
-			free(((struct zerg_message *)payloads[i].zerg_payload)->
-			     message);
-			free((struct zerg_message *)payloads[i].zerg_payload);
-			break;
-		case 1:
-			free(((struct zerg_status *)payloads[i].
-			      zerg_payload)->name);
-			free((struct zerg_status *)payloads[i].zerg_payload);
-			break;
-		case 2:
-			free((struct zerg_command *)payloads[i].zerg_payload);
-			break;
-		case 3:
-			free((struct zerg_gps *)payloads[i].zerg_payload);
-			break;
-		}
+	if (!zh->zerg_payload) {
+		// Case: Headers-only decode; nothing was loaded
+		return;
+	}
+	switch (zh->zerg_packet_type) {
+	case 0:
+		free(((struct zerg_message *)zh->zerg_payload)->message);
+		free((struct zerg_message *)zh->zerg_payload);
+		break;
+	case 1:
+		free(((struct zerg_status *)zh->zerg_payload)->name);
+		free((struct zerg_status *)zh->zerg_payload);
+		break;
+	case 2:
+		free((struct zerg_command *)zh->zerg_payload);
+		break;
+	case 3:
+		free((struct zerg_gps *)zh->zerg_payload);
+		break;
+	}
+	zh->zerg_payload = NULL;
+}
 
+bool sample_wanted(size_t ordinal)
+// Reservoir sampling (Li's Algorithm L): decides whether the ordinal-th
+// valid packet enters the reservoir. Skipped packets are never loaded,
+// so only --sample packets are held in memory at any time.
+{
+	if (ordinal <= options.sample) {
+		return (true);
 	}
-	free(payloads);
+	return (ordinal == reservoir.next);
 }
 
-int resize_array(struct zerg_header **payloads, int max_payloads)
+void sample_store(struct zerg_header *zh, size_t ordinal)
+// Stores a packet chosen by sample_wanted(), evicting a random member
+// once the reservoir is full, and draws the next packet to take.
 {
-	max_payloads *= 2;
-	struct zerg_header *tmp_payloads =
-	    realloc(*payloads, (sizeof(*tmp_payloads) * max_payloads));
-	if (!tmp_payloads) {
-		return (MEMORY_ERROR);
+	size_t slot = ordinal - 1;
+	if (ordinal > options.sample) {
+		slot = sample_random() * options.sample;
+		destroy_payload(&reservoir.samples[slot].zh);
 	}
-	*payloads = tmp_payloads;
-	printf("Resized to: %zu\n", (sizeof(*tmp_payloads) * max_payloads));
-	return (1);
+	reservoir.samples[slot].zh = *zh;
+	reservoir.samples[slot].ordinal = ordinal;
+	if (ordinal < options.sample) {
+		++reservoir.count;
+		return;
+	}
+	if (ordinal == options.sample) {
+		++reservoir.count;
+		reservoir.weight = exp(log(sample_random()) / options.sample);
+		reservoir.next = ordinal;
+	} else {
+		reservoir.weight *= exp(log(sample_random()) / options.sample);
+	}
+	reservoir.next += floor(log(sample_random()) /
+				log(1 - reservoir.weight)) + 1;
+}
+
+double sample_random(void)
+// Returns a uniformly distributed double in (0, 1) from a seeded
+// xorshift64* generator, so samples are reproducible.
+{
+	reservoir.state ^= reservoir.state >> 12;
+	reservoir.state ^= reservoir.state << 25;
+	reservoir.state ^= reservoir.state >> 27;
+	uint64_t bits = reservoir.state * 0x2545F4914F6CDD1DULL;
+	return (((bits >> 11) + 0.5) / 9007199254740992.0);
+}
+
+int compare_samples(const void *a, const void *b)
+{
+	size_t first = ((const struct sample *)a)->ordinal;
+	size_t second = ((const struct sample *)b)->ordinal;
+	return ((first > second) - (first < second));
+}
+
+void print_samples(void)
+// Prints the reservoir in capture order and releases it.
+{
+	qsort(reservoir.samples, reservoir.count, sizeof(*reservoir.samples),
+	      compare_samples);
+	for (size_t i = 0; i < reservoir.count; ++i) {
+		print_packet(reservoir.samples[i].zh);
+		destroy_payload(&reservoir.samples[i].zh);
+	}
+	free(reservoir.samples);
+	reservoir.samples = NULL;
+	reservoir.count = 0;
 }
 
-void print_headers(struct zerg_header *payloads, int num_payloads)
+void print_packet(struct zerg_header payload)
 {
-	if (!payloads) {
+	struct out_stream *out = select_output(&payload);
+	if (!out) {
 		return;
 	}
-	for (int i = 0; i < num_payloads; ++i) {
-		printf("Version: %u\n"
-		       "Sequence: %u\n"
-		       "From: %u\n"
-		       "To: %u\n",
-		       payloads[i].zerg_version,
-		       ntohl(payloads[i].zerg_sequence),
-		       ntohs(payloads[i].zerg_src),
-		       ntohs(payloads[i].zerg_dst));
-		switch (payloads[i].zerg_packet_type) {
-		case 0:
-			print_message(payloads[i]);
-			break;
-		case 1:
-			print_status(payloads[i]);
-			break;
-		case 2:
-			print_command(payloads[i]);
-			break;
-		case 3:
-			print_gps(payloads[i]);
-			break;
-		}
-		if (i + 1 != num_payloads) {
-			putchar('\n');
+	out_stream_separate(out);
+	out_stream_printf(out, "Version: %u\n"
+			  "Sequence: %u\n"
+			  "From: %u\n"
+			  "To: %u\n",
+			  payload.zerg_version,
+			  ntohl(payload.zerg_sequence),
+			  ntohs(payload.zerg_src), ntohs(payload.zerg_dst));
+	if (options.headers_only) {
+		out_stream_printf(out, "Payload: %s\n" "Length: %u\n",
+				  payload_schemas[payload.zerg_packet_type].title,
+				  shift_24_bit_int(payload.zerg_len));
+		return;
+	}
+	STATS_START(timer);
+	schema_print(&payload_schemas[payload.zerg_packet_type],
+		     payload.zerg_payload, write_output, out);
+	if (payload.zerg_packet_type == 2 && sequences) {
+		const struct zerg_command *zc = payload.zerg_payload;
+		if (ntohs(zc->command) == 7) {
+			// Case: REPEAT
+			print_repeat_target(out, payload, ntohl(zc->parameter_2u));
 		}
 	}
+	STATS_STOP(STAGE_PRINT_MESSAGE + payload.zerg_packet_type, timer);
 	return;
 }
 
-void print_message(struct zerg_header payload)
+void print_state(size_t valid_packets)
+// Prints a snapshot of the live state of every unit seen so far.
 {
-	printf("Message: %s\n",
-	       ((struct zerg_message *)payload.zerg_payload)->message);
-	return;
+	struct out_stream *out = state_output();
+	if (!out) {
+		return;
+	}
+	size_t count = unit_table_size(units);
+	const struct unit_state **states =
+	    malloc((count + 1) * sizeof(*states));
+	if (!states) {
+		fprintf(stderr, "Memory allocation error\n");
+		return;
+	}
+	count = unit_table_snapshot(units, states);
+
+	out_stream_separate(out);
+	out_stream_printf(out, "State after %zu zerg packets: %zu units\n",
+			  valid_packets, count);
+	out_stream_printf(out,
+			  "%5s %-9s %8s %8s %5s %9s %11s %11s %9s %7s %s\n",
+			  "Unit", "Type", "HP", "Max HP", "Armor", "Max Speed",
+			  "Latitude", "Longitude", "Altitude", "Speed", "Name");
+	for (size_t i = 0; i < count; ++i) {
+		const struct unit_state *unit = states[i];
+		out_stream_printf(out, "%5u ", unit->src);
+		if (unit->has_status) {
+			const char *type = keyword_name(&zerg_types, unit->type);
+			out_stream_printf(out, "%-9s %8d %8u %5u %9g ",
+					  type ? type : "?",
+					  unit->hp, unit->max_hp, unit->armor,
+					  unit->max_speed);
+		} else {
+			out_stream_printf(out, "%-9s %8s %8s %5s %9s ", "-",
+					  "-", "-", "-", "-");
+		}
+		if (unit->has_gps) {
+			out_stream_printf(out, "%11.6f %11.6f %9.2f %7.2f ",
+					  unit->latitude, unit->longitude,
+					  unit->altitude, unit->speed);
+		} else {
+			out_stream_printf(out, "%11s %11s %9s %7s ", "-", "-",
+					  "-", "-");
+		}
+		out_stream_puts(out, unit->has_status ? unit->name : "-");
+	}
+	free(states);
 }
 
-void print_status(struct zerg_header payload)
+int write_output(void *out, const void *data, size_t len)
+// schema_writer for an out_stream.
 {
-	unsigned int max_hp =
-	    shift_24_bit_int(((struct zerg_status *)payload.
-			      zerg_payload)->max_hp);
-	int hp = 0;
-	hp = shift_24_bit_int(((struct zerg_status *)payload.zerg_payload)->
-			      current_hp);
-	unsigned int armor =
-	    ((struct zerg_status *)payload.zerg_payload)->armor;
-	unsigned int type = ((struct zerg_status *)payload.zerg_payload)->type;
-	float speed =
-	    reverse_float(((struct zerg_status *)payload.
-			   zerg_payload)->max_speed);
-	printf("Max Hit Points: %u\n" "Current Hit Points: %d\n" "Armor: %u\n"
-	       "Type: ", max_hp, hp, armor);
-	switch (type) {
-	case 0:
-		puts("Overmind");
-		break;
-	case 1:
-		puts("Larva");
-		break;
-	case 2:
-		puts("Cerebrate");
-		break;
-	case 3:
-		puts("Overlord");
-		break;
-	case 4:
-		puts("Queen");
-		break;
-	case 5:
-		puts("Drone");
-		break;
-	case 6:
-		puts("Zergling");
-		break;
-	case 7:
-		puts("Lurker");
-		break;
-	case 8:
-		puts("Broodling");
-		break;
-	case 9:
-		puts("Hydralisk");
-		break;
-	case 10:
-		puts("Guardian");
-		break;
-	case 11:
-		puts("Scourge");
-		break;
-	case 12:
-		puts("Ultralisk");
-		break;
-	case 13:
-		puts("Mutalisk");
-		break;
-	case 14:
-		puts("Defiler");
-		break;
-	case 15:
-		puts("Devourer");
+	return (out_stream_write(out, data, len));
+}
+
+void print_repeat_target(struct out_stream *out, struct zerg_header payload,
+			 unsigned int sequence)
+// Resolves the packet a REPEAT command refers to. The sequence number
+// belongs to the unit being asked to repeat itself (the destination),
+// falling back to the sender's own packets.
+{
+	uint16_t src = ntohs(payload.zerg_dst);
+	const struct seq_record *record =
+	    seq_index_find(sequences, src, sequence);
+	if (!record) {
+		src = ntohs(payload.zerg_src);
+		record = seq_index_find(sequences, src, sequence);
 	}
-	printf("Max Speed: %g m/s\n", speed);
-	printf("Name: %s\n",
-	       ((struct zerg_status *)payload.zerg_payload)->name);
-	return;
+	if (!record) {
+		out_stream_puts(out, "Repeats: unknown packet");
+		return;
+	}
+	out_stream_printf(out, "Repeats: %s from %u (packet #%ld)\n",
+			  payload_schemas[record->type].title, src, record->packet);
 }
 
-void print_command(struct zerg_header payload)
+int open_outputs(void)
+// Sets up the output streams. Without --split everything goes to
+// stdout; otherwise shard files are created lazily by select_output().
 {
+	if (!options.split_prefix) {
+		outputs.standard =
+		    out_stream_fd(STDOUT_FILENO, OUT_STREAM_DEFAULT_BUF_SIZE);
+		return (outputs.standard ? 0 : -1);
+	}
+	outputs.buckets = 1;
+	if (options.split_src_width) {
+		outputs.buckets = (65536 + options.split_src_width - 1) /
+		    options.split_src_width;
+	}
+	size_t num_payload_types =
+	    sizeof(payload_names) / sizeof(payload_names[0]);
+	outputs.shards = calloc(num_payload_types * outputs.buckets,
+				sizeof(*outputs.shards));
+	outputs.last_used = calloc(num_payload_types * outputs.buckets,
+				   sizeof(*outputs.last_used));
+	return (outputs.shards && outputs.last_used ? 0 : -1);
+}
 
-	unsigned int command =
-	    ntohs(((struct zerg_command *)payload.zerg_payload)->command);
-	printf("Command: ");
-	switch (command) {
-	case 0:
-		puts("GET_STATUS");
-		break;
-	case 1:
-		{
-			float bearing =
-			    reverse_float((float)(((struct zerg_command *)
-						   payload.zerg_payload)->
-						  parameter_2f));
-			unsigned int distance = ntohs((((struct zerg_command *)
-							payload.
-							zerg_payload)->parameter_1));
-			puts("GOTO");
-			printf("Bearing: %g degrees\n" "Distance: %u m\n",
-			       bearing, distance);
+struct out_stream *select_output(const struct zerg_header *zh)
+// Returns the stream a packet should be written to, opening its shard
+// if need be. Returns NULL if the shard could not be opened.
+{
+	if (!options.split_prefix) {
+		return (outputs.standard);
+	}
+	size_t bucket = 0;
+	if (options.split_src_width) {
+		bucket = ntohs(zh->zerg_src) / options.split_src_width;
+	}
+	size_t index = zh->zerg_packet_type * outputs.buckets + bucket;
+	struct out_stream *out = outputs.shards[index];
+	if (!out) {
+		out = open_shard(index);
+	}
+	if (out) {
+		outputs.last_used[index] = ++outputs.clock;
+	}
+	return (out);
+}
+
+struct out_stream *open_shard(size_t index)
+// Opens a shard's file, creating it the first time and adding to it
+// after that. Each open shard has a writer thread and buffers, so past
+// SHARD_OPEN_MAX, or when file descriptors run out, the least recently
+// used is closed to make room. A shard that still cannot be opened is
+// reported once, and no more output is written.
+{
+	char path[4096];
+	size_t buf_size = outputs.buckets > 1 ? SHARD_BUF_SIZE :
+	    OUT_STREAM_DEFAULT_BUF_SIZE;
+	struct out_stream *out;
+
+	if (outputs.failed) {
+		return (NULL);
+	}
+	shard_path(index, path, sizeof(path));
+	if (outputs.open_count == SHARD_OPEN_MAX) {
+		close_shard(least_recent_shard());
+	}
+	for (;;) {
+		out = outputs.last_used[index] ?
+		    out_stream_append(path, buf_size) :
+		    out_stream_open(path, buf_size);
+		if (out || (errno != EMFILE && errno != ENFILE)
+		    || outputs.open_count == 0) {
 			break;
 		}
-	case 2:
-		puts("GET_GPS");
-		break;
-	case 4:
-		puts("RETURN");
-		break;
-	case 5:
-		{
-			unsigned int action =
-			    ((struct zerg_command *)payload.
-			     zerg_payload)->parameter_1;
-			int group = htonl(((struct zerg_command *)
-					   payload.zerg_payload)->parameter_2i);
-			puts("SET_GROUP");
-			switch (action) {
-			case 0:
-				puts("Action: Remove from");
-				break;
-			default:
-				puts("Action: Add to");
-				break;
-			}
-			printf("Group: %d\n", group);
-			break;
+		close_shard(least_recent_shard());
+	}
+	if (!out) {
+		fprintf(stderr, "%s could not be opened", path);
+		perror(" \b");
+		outputs.failed = true;
+		return (NULL);
+	}
+	outputs.shards[index] = out;
+	outputs.open[outputs.open_count++] = index;
+	return (out);
+}
+
+void close_shard(size_t slot)
+// Closes the shard at slot of outputs.open, flushing it so that it can
+// be reopened and added to.
+{
+	size_t index = outputs.open[slot];
+	outputs.open[slot] = outputs.open[--outputs.open_count];
+	if (out_stream_close(outputs.shards[index]) != 0 && !outputs.failed) {
+		char path[4096];
+		shard_path(index, path, sizeof(path));
+		fprintf(stderr, "%s could not be written", path);
+		perror(" \b");
+		outputs.failed = true;
+	}
+	outputs.shards[index] = NULL;
+}
+
+size_t least_recent_shard(void)
+// Returns the slot of outputs.open whose shard was selected longest ago.
+{
+	size_t oldest = 0;
+	for (size_t i = 1; i < outputs.open_count; ++i) {
+		if (outputs.last_used[outputs.open[i]] <
+		    outputs.last_used[outputs.open[oldest]]) {
+			oldest = i;
 		}
-	case 6:
-		puts("STOP");
-		break;
-	case 7:
-		{
-			unsigned int sequence = ntohl(((struct zerg_command *)
-						       payload.
-						       zerg_payload)->parameter_2u);
-			puts("REPEAT");
-			printf("Sequence: %u\n", sequence);
-			break;
+	}
+	return (oldest);
+}
+
+void shard_path(size_t index, char *path, size_t size)
+// Names a shard PREFIX.type, or PREFIX.type.low-high when split by
+// source.
+{
+	size_t type = index / outputs.buckets;
+	if (options.split_src_width) {
+		size_t low = index % outputs.buckets * options.split_src_width;
+		size_t high = low + options.split_src_width - 1;
+		if (high > 65535) {
+			high = 65535;
 		}
+		snprintf(path, size, "%s.%s.%zu-%zu", options.split_prefix,
+			 payload_names[type], low, high);
+	} else {
+		snprintf(path, size, "%s.%s", options.split_prefix,
+			 payload_names[type]);
 	}
-	return;
 }
 
-void print_gps(struct zerg_header payload)
+struct out_stream *state_output(void)
+// Returns the stream for state snapshots: stdout, or PREFIX.state when
+// output is split.
+{
+	if (!options.split_prefix || outputs.state) {
+		return (options.split_prefix ? outputs.state : outputs.standard);
+	}
+	char path[4096];
+	snprintf(path, sizeof(path), "%s.state", options.split_prefix);
+	outputs.state = out_stream_open(path, OUT_STREAM_DEFAULT_BUF_SIZE);
+	if (!outputs.state) {
+		fprintf(stderr, "%s could not be opened", path);
+		perror(" \b");
+		outputs.failed = true;
+	}
+	return (outputs.state);
+}
+
+int close_outputs(void)
+// Flushes and closes every output stream, joining their writer
+// threads. Returns nonzero if any stream failed to write.
+{
+	int ret = out_stream_close(outputs.standard);
+	if (out_stream_close(outputs.state) != 0) {
+		ret = -1;
+	}
+	if (outputs.shards) {
+		size_t num_shards = outputs.buckets *
+		    (sizeof(payload_names) / sizeof(payload_names[0]));
+		for (size_t i = 0; i < num_shards; ++i) {
+			if (out_stream_close(outputs.shards[i]) != 0) {
+				ret = -1;
+			}
+		}
+		free(outputs.shards);
+	}
+	free(outputs.last_used);
+	return (ret);
+}
+
+int parse_time(const char *arg, uint64_t first_time, uint64_t *time)
+// Parses epoch seconds, "YYYY-MM-DD HH:MM:SS" (a 'T' may separate the
+// date and time) or "HH:MM:SS" on the UTC day of first_time into
+// microseconds since the epoch. Seconds may carry a fraction. Returns 1
+// on success and 0 if arg is not a valid time.
 {
-	double degrees = 0;
-	double minutes = 0;
+	struct tm tm = { 0 };
 	double seconds = 0;
-	double longitude =
-	    reverse_double(((struct zerg_gps *)payload.
-			    zerg_payload)->longitude);
-	double latitude =
-	    reverse_double(((struct zerg_gps *)payload.zerg_payload)->latitude);
-	float altitude =
-	    reverse_float(((struct zerg_gps *)payload.zerg_payload)->altitude);
-	float bearing =
-	    reverse_float(((struct zerg_gps *)payload.zerg_payload)->bearing);
-	float speed =
-	    reverse_float(((struct zerg_gps *)payload.zerg_payload)->speed);
-	float accuracy =
-	    reverse_float(((struct zerg_gps *)payload.zerg_payload)->accuracy);
-
-	format_gps_output(latitude, &degrees, &minutes, &seconds);
-	printf("Latitude: %g° %g' %g\" ", degrees, minutes, seconds);
-	if (latitude >= 0) {
-		puts("N");
+	double total = 0;
+	int consumed = 0;
+	if (sscanf(arg, "%d-%d-%d%*1[ T]%d:%d:%lf%n", &tm.tm_year, &tm.tm_mon,
+		   &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &seconds,
+		   &consumed) == 6 && !arg[consumed]) {
+		// Case: Full UTC date and time
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		total = timegm(&tm) + seconds;
+	} else if (sscanf(arg, "%d:%d:%lf%n", &tm.tm_hour, &tm.tm_min,
+			  &seconds, &consumed) == 3 && !arg[consumed]) {
+		// Case: Time of day relative to the first packet
+		uint64_t day = first_time / 1000000 / 86400 * 86400;
+		total = day + tm.tm_hour * 3600.0 + tm.tm_min * 60.0 + seconds;
 	} else {
-		puts("S");
+		char *err = NULL;
+		total = strtod(arg, &err);
+		if (err == arg || *err) {
+			return (0);
+		}
 	}
-	format_gps_output(longitude, &degrees, &minutes, &seconds);
-	printf("Longitude: %g° %g' %g\" ", degrees, minutes, seconds);
-	if (longitude >= 0) {
-		puts("E");
-	} else {
-		puts("W");
+	if (!(total >= 0)) {
+		return (0);
 	}
+	*time = llround(total * 1000000);
+	return (1);
+}
 
-	printf("Altitude: %f fathoms\n" "Bearing: %f degrees\n"
-	       "Speed: %f m/s\n" "Accuracy: %g m\n",
-	       altitude, bearing, speed, accuracy);
-	return;
+int seek_time_range(struct capture *captures, size_t count)
+// Parses --from and --to and moves each capture to the first index
+// block that can hold a packet in range, stopping it after the last
+// such block. Returns SUCCESS or the exit code to use.
+{
+	uint64_t first_time = 0;
+	if (capture_next(&captures[0])) {
+		first_time = captures[0].time;
+		// Rewind so the first record is read again when decoding
+		captures[0].next = captures[0].record;
+	}
+	if (options.from
+	    && !parse_time(options.from, first_time, &time_range.from)) {
+		fprintf(stderr, "Invalid --from time: %s\n", options.from);
+		return (INVOCATION_ERROR);
+	}
+	if (options.to && !parse_time(options.to, first_time, &time_range.to)) {
+		fprintf(stderr, "Invalid --to time: %s\n", options.to);
+		return (INVOCATION_ERROR);
+	}
+	time_range.active = true;
+
+	for (size_t i = 0; i < count; ++i) {
+		struct capture *cap = &captures[i];
+		struct time_index *ti = time_index_load(cap);
+		if (!ti) {
+			// Case: No index; every packet is still filtered
+			continue;
+		}
+		size_t skipped = 0;
+		time_index_range(ti, time_range.from, time_range.to,
+				 &cap->next, &cap->stop, &skipped);
+		time_index_destroy(ti);
+		if (count == 1) {
+			// Packet numbers stay those of a full decode
+			total_packets = skipped;
+		}
+	}
+	return (SUCCESS);
 }
 
-void format_gps_output(const double num, double *degrees, double *minutes,
-		       double *seconds)
-// Accepts a double and three placeholder values that will hold the 
-// converted values after turning the decimal representation of the
-// longitude/latitude field into degrees/minutes/seconds format.
+void close_captures(struct capture *captures, size_t count)
 {
-	*degrees = floor(fabs(num));
-	*minutes = floor((fabs(num) - *degrees) * 60);
-	*seconds = ((fabs(num)) - *degrees - (*minutes / 60)) * 3600;
-	return;
+	for (size_t i = 0; i < count; ++i) {
+		readahead_close(captures[i].fo);
+	}
+	free(captures);
 }
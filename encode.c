@@ -1,46 +1,283 @@
+#include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include "lib/shared_fields.h"
+#include "lib/out_stream.h"
+#include "lib/stats.h"
+#include "lib/checksum.h"
+#include "lib/tokenizer.h"
+#include "lib/schema.h"
+#include "lib/generator.h"
 #include <arpa/inet.h>
 #include <unistd.h>
 
+enum long_only_options {
+	STATS_OPTION = 256
+};
+
+enum capture_format {
+	FORMAT_PCAP,
+	FORMAT_PCAPNG
+};
+
+enum header_offsets {
+	// Offsets into a pcap record header
+	RECORD_SECONDS = 0,
+	RECORD_MICROSECONDS = 4,
+	RECORD_CAPTURE_LEN = 8,
+	RECORD_UNTRUNCATED_LEN = 12,
+	// Offsets into a pcapng Enhanced Packet Block
+	BLOCK_TYPE = 0,
+	BLOCK_LENGTH = 4,
+	BLOCK_TIME_HIGH = 12,
+	BLOCK_TIME_LOW = 16,
+	BLOCK_CAPTURE_LEN = 20,
+	BLOCK_UNTRUNCATED_LEN = 24,
+	BLOCK_DATA = 28,
+	// Offsets into the frame that follows either
+	IP_HEADER = sizeof(struct ethernet_header),
+	IP_LENGTH = IP_HEADER + 2,
+	IP_HEADER_CHECKSUM = IP_HEADER + 10,
+	IP_ADDRESSES = IP_HEADER + 12,
+	UDP_HEADER = IP_HEADER + sizeof(struct ip_header),
+	UDP_LENGTH = UDP_HEADER + 4,
+	UDP_HEADER_CHECKSUM = UDP_HEADER + 6,
+	ZERG_HEADER = UDP_HEADER + sizeof(struct udp_header),
+	ZERG_HEADER_LEN = sizeof(struct zerg_header) - sizeof(void *),
+	FRAME_HEADERS_LEN = ZERG_HEADER + ZERG_HEADER_LEN,
+	HEADERS_MAX = BLOCK_DATA + FRAME_HEADERS_LEN
+};
+
+enum capture_constants {
+	MIN_FRAME = 60,		// Shorter Ethernet frames are padded
+	SNAPLEN = UINT16_MAX,	// No frame is longer
+	PCAPNG_HEADER_LEN = 48	// Section and Interface Description Blocks
+};
+
+struct packet_template {
+	unsigned char headers[HEADERS_MAX];
+	size_t frame;		// Length of the record's own header
+	size_t len;		// Where the payload starts
+	enum capture_format format;
+	uint64_t ip_sum;	// Checksum of the IP header less its length
+	uint64_t udp_sum;	// Pseudo-header and UDP ports, less lengths
+};
+
+struct output {
+	const char *path;	// OUTFILE, which segments are named after
+	struct out_stream *stream;
+	enum capture_format format;
+	bool little_endian;
+	bool rotating;		// Whether output is split into segments
+	size_t max_size;	// Bytes a segment may hold, or 0
+	uint64_t max_time;	// Microseconds a segment may span, or 0
+	unsigned int segment;	// Number of the open segment
+	char *name;		// Its name once finished
+	char *part;		// Its name while being written
+	size_t size;		// Bytes written to it
+	uint64_t start;		// Timestamp of its first packet
+	bool header_present;
+	bool failed;
+};
+
+enum parallel_limits {
+	CHUNK_SIZE = 1 << 22,	// Input bytes given to each job
+	GENERATE_CHUNK = 1 << 15,	// Generated packets given to each job
+	MAX_JOBS = 64
+};
+
+enum record_limits {
+	RECORD_FIELDS = 32	// Well above the fields of any packet
+};
+
+struct record {
+	struct span keys[RECORD_FIELDS];
+	struct span values[RECORD_FIELDS];
+	size_t count;
+	size_t next;		// Where to start looking for the next key
+};
+
+struct encoder {
+	struct tokenizer *tk;
+	bool by_name;		// Fields come in NDJSON or CSV records
+	struct record record;	// The record being read if so
+	const struct generator *gen;	// Packets come from here if set
+	size_t end;		// No packet starting here or later is read
+	size_t stop;		// Where parsing actually stopped
+	// end and stop count packets, not bytes, when generating
+	uint64_t time;		// Timestamp of the next packet, microseconds
+	bool little_endian;
+	bool failed;		// Packets could not be stored
+	const struct packet_template *template;
+	struct output *output;	// Output, or NULL to collect packets
+	unsigned char *packets;	// Collected packets when output is NULL
+	size_t packets_len;
+	size_t packets_size;
+	FILE *report;		// Where problems with the input go
+	char *report_text;	// report's contents when it is a memstream
+	size_t report_len;
+};
+
 static struct {
 	bool little_endian;
-} options = { true };
+	bool generate;		// INFILE is a generator spec
+	enum input_format input;
+	enum capture_format format;
+	size_t rotate_size;	// 0 for no limit
+	uint64_t rotate_time;	// Microseconds, or 0 for no limit
+	long jobs;		// 0 for one per online CPU
+} options = { true, false, INPUT_TEXT, FORMAT_PCAP, 0, 0, 0 };
 
 void generate_file_header(bool little_endian, struct pcap_header *ph);
-void parse_packet_contents(bool little_endian, FILE * input_fo,
-			   FILE * output_fo);
-int parse_message(struct zerg_header *zh, FILE * input_fo);
-int parse_status(struct zerg_header *zh, FILE * input_fo);
-int parse_command(struct zerg_header *zh, FILE * input_fo);
-int parse_gps(struct zerg_header *zh, FILE * input_fo);
-void set_static_headers(struct ethernet_header *eh, struct ip_header *ih,
-			struct udp_header *uh);
-void set_length_fields(bool little_endian, const uint16_t len,
-		       struct packet_header *ph, struct ip_header *ih,
-		       struct udp_header *uh, struct zerg_header *zh);
-void write_headers(bool *file_header_present, bool little_endian,
-		   struct packet_header *ph, struct ethernet_header *eh,
-		   struct ip_header *ih, struct udp_header *uh,
-		   struct zerg_header *zh, FILE * output_fo);
-int skip_to_next_packet(FILE * input_fo);
+int write_file_header(struct output *output);
+int open_output(struct output *output);
+int close_output(struct output *output);
+char *segment_name(const char *path, unsigned int segment);
+bool segment_full(const struct output *output, size_t len, uint64_t time);
+int begin_record(struct output *output, size_t len, uint64_t time);
+int write_records(struct output *output,
+		  const struct packet_template *template,
+		  const unsigned char *records, size_t len);
+size_t record_size(const struct packet_template *template,
+		   bool little_endian, const unsigned char *record,
+		   uint64_t *time);
+void parse_packet_contents(struct encoder *enc);
+void generate_packets(struct encoder *enc);
+int encode_parallel(struct encoder *enc, size_t jobs);
+int open_chunk(struct encoder *chunk, const struct encoder *enc);
+void start_chunk(struct encoder *chunk, size_t start, size_t end);
+void *encode_chunk(void *chunk);
+int finish_chunk(struct encoder *enc, struct encoder *chunk);
+void free_chunk(struct encoder *chunk);
+int parse_payload(struct encoder *enc, const struct schema *schema,
+		  void *payload, struct span *text);
+void build_template(struct packet_template *template,
+		    enum capture_format format, bool little_endian);
+unsigned char *reserve_output(struct encoder *enc, size_t len);
+void commit_output(struct encoder *enc, size_t len);
+int write_packet(struct encoder *enc, struct zerg_header *zh,
+		 const void *payload, size_t len, struct span text);
+unsigned char *write_headers(unsigned char *buf,
+			     const struct packet_template *template,
+			     bool little_endian, uint64_t time,
+			     struct zerg_header *zh, uint16_t len,
+			     uint64_t data_sum);
+size_t trailer_len(const struct packet_template *template,
+		   size_t frame_len);
+void write_trailer(unsigned char *buf, size_t trailer, bool little_endian,
+		   uint32_t record_len);
+void put_uint16(unsigned char *buf, uint16_t value, bool little_endian);
+void put_uint32(unsigned char *buf, uint32_t value, bool little_endian);
+uint32_t get_uint32(const unsigned char *buf, bool little_endian);
+int start_packet(struct encoder *enc, struct span *value);
+int read_record(struct encoder *enc);
+int find_payload(struct encoder *enc, int *type);
+int skip_to_next_packet(struct encoder *enc);
+int next_line(struct tokenizer *tk, struct span *key, struct span *value);
+int read_field(struct encoder *enc, const char *name, struct span *value);
+const char *record_key(const struct encoder *enc, const struct field *field);
+bool field_long(struct encoder *enc, struct span value, const char *name,
+		long *number);
+bool field_range(struct encoder *enc, const char *name, long number,
+		 long min, long max);
 
 int main(int argc, char *argv[])
 {
+	static const struct option long_options[] = {
+		{"big-endian", no_argument, NULL, 'b'},
+		{"format", required_argument, NULL, 'f'},
+		{"generate", no_argument, NULL, 'g'},
+		{"input-format", required_argument, NULL, 'i'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"rotate-size", required_argument, NULL, 'C'},
+		{"rotate-time", required_argument, NULL, 'G'},
+#ifdef CODEC_STATS
+		{"stats", optional_argument, NULL, STATS_OPTION},
+#endif
+		{NULL, 0, NULL, 0}
+	};
 	int opt;
+	char *err = NULL;
+	double seconds;
 	// Option-handling syntax borrowed from Liam Echlin in
 	// getopt-demo.c
-	while ((opt = getopt(argc, argv, "b")) != -1) {
+	while ((opt = getopt_long(argc, argv, "C:G:bf:gi:j:", long_options,
+				  NULL)) != -1) {
 
 		switch (opt) {
 			// a[scii sort]
+		case 'C':
+			if (!parse_size(optarg, &options.rotate_size)
+			    || options.rotate_size == 0) {
+				fprintf(stderr,
+					"Rotation size must be a positive size such as 512K or 4M\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'G':
+			seconds = strtod(optarg, &err);
+			if (*optarg == '\0' || *err != '\0' || !(seconds > 0)
+			    || seconds > UINT32_MAX) {
+				fprintf(stderr,
+					"Rotation time must be a positive number of seconds\n");
+				return (INVOCATION_ERROR);
+			}
+			options.rotate_time = seconds * 1000000;
+			if (options.rotate_time == 0) {
+				options.rotate_time = 1;
+			}
+			break;
 		case 'b':
 			options.little_endian = false;
 			break;
+		case 'f':
+			if (strcmp(optarg, "pcap") == 0) {
+				options.format = FORMAT_PCAP;
+			} else if (strcmp(optarg, "pcapng") == 0) {
+				options.format = FORMAT_PCAPNG;
+			} else {
+				fprintf(stderr,
+					"Format must be pcap or pcapng\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'g':
+			options.generate = true;
+			break;
+		case 'i':
+			if (strcmp(optarg, "text") == 0) {
+				options.input = INPUT_TEXT;
+			} else if (strcmp(optarg, "ndjson") == 0) {
+				options.input = INPUT_NDJSON;
+			} else if (strcmp(optarg, "csv") == 0) {
+				options.input = INPUT_CSV;
+			} else {
+				fprintf(stderr,
+					"Input format must be text, ndjson or csv\n");
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'j':
+			options.jobs = strtol(optarg, &err, 10);
+			if (*optarg == '\0' || *err != '\0' || options.jobs < 1
+			    || options.jobs > MAX_JOBS) {
+				fprintf(stderr,
+					"Jobs must be a number from 1 to %d\n",
+					MAX_JOBS);
+				return (INVOCATION_ERROR);
+			}
+			break;
+#ifdef CODEC_STATS
+		case STATS_OPTION:
+			if (stats_enable(optarg) != 0) {
+				return (INVOCATION_ERROR);
+			}
+			break;
+#endif
 		case '?':
 			return (INVOCATION_ERROR);
 		}
@@ -54,1351 +291,1065 @@ int main(int argc, char *argv[])
 		       invocation_name);
 		return (INVOCATION_ERROR);
 	}
+	if (options.generate && options.input != INPUT_TEXT) {
+		fprintf(stderr, "A generator spec is always text\n");
+		return (INVOCATION_ERROR);
+	}
+	bool rotating = options.rotate_size || options.rotate_time;
+	if (rotating && strcmp(argv[1], "-") == 0) {
+		fprintf(stderr, "Rotated output must be named, not \"-\"\n");
+		return (INVOCATION_ERROR);
+	}
 
-	FILE *input_fo = fopen(argv[0], "r");
-	if (!input_fo) {
+	// "-" reads stdin or writes stdout, so encode can end a pipeline
+	struct tokenizer *tk = strcmp(argv[0], "-") == 0 ?
+	    tokenizer_fd(STDIN_FILENO) : tokenizer_open(argv[0]);
+	if (!tk) {
 		fprintf(stderr, "%s could not be opened", argv[0]);
 		perror(" \b");
 		return (FILE_ERROR);
 	}
-	FILE *output_fo = fopen(argv[1], "wb");
-	if (!output_fo) {
-		fprintf(stderr, "%s could not be opened", argv[1]);
-		perror(" \b");
+	// NDJSON and CSV records hold the same fields as a packet of text
+	if (!tokenizer_format(tk, options.input)) {
+		fprintf(stderr, "Memory allocation error\n");
+		tokenizer_close(tk);
+		return (MEMORY_ERROR);
+	}
+	// With --generate, INFILE describes the packets to make up
+	struct generator gen;
+	if (options.generate && !generator_load(&gen, tk, stderr)) {
+		fprintf(stderr, "%s is not a valid generator spec\n", argv[0]);
+		tokenizer_close(tk);
+		return (INVOCATION_ERROR);
+	}
+	// With rotation, OUTFILE names a series of numbered segments
+	struct output output = {
+		.path = argv[1],
+		.format = options.format,
+		.little_endian = options.little_endian,
+		.rotating = rotating,
+		.max_size = options.rotate_size,
+		.max_time = options.rotate_time
+	};
+	if (open_output(&output) != 0) {
+		if (options.generate) {
+			generator_free(&gen);
+		}
+		tokenizer_close(tk);
 		return (FILE_ERROR);
 	}
 
-	parse_packet_contents(options.little_endian, input_fo, output_fo);
+	struct packet_template template;
+	build_template(&template, options.format, options.little_endian);
+	struct encoder enc = {
+		.tk = tk,
+		.by_name = options.input != INPUT_TEXT,
+		.gen = options.generate ? &gen : NULL,
+		.end = options.generate ? gen.packets : SIZE_MAX,
+		.little_endian = options.little_endian,
+		.template = &template,
+		.output = &output,
+		.report = stderr
+	};
+	size_t jobs = options.jobs;
+	if (jobs == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = online < 1 ? 1 : online > MAX_JOBS ? MAX_JOBS : online;
+	}
+
+	int return_code = SUCCESS;
+	// Small or streamed input is not worth splitting
+	if (jobs > 1 && (options.generate ? gen.packets > GENERATE_CHUNK :
+			 tokenizer_size(tk) > CHUNK_SIZE)) {
+		if (encode_parallel(&enc, jobs) != 0) {
+			fprintf(stderr, "Memory allocation error\n");
+			return_code = MEMORY_ERROR;
+		}
+	} else if (options.generate) {
+		generate_packets(&enc);
+	} else {
+		parse_packet_contents(&enc);
+	}
+	if (options.generate) {
+		generator_free(&gen);
+	}
 
-	fclose(input_fo);
-	fclose(output_fo);
-	return (SUCCESS);
+	if (tokenizer_failed(tk)) {
+		fprintf(stderr, "%s could not be read\n", argv[0]);
+		return_code = FILE_ERROR;
+	}
+	tokenizer_close(tk);
+	if (close_output(&output) != 0 || output.failed) {
+		return_code = FILE_ERROR;
+	}
+	STATS_REPORT(stderr);
+	return (return_code);
 }
 
-void parse_packet_contents(bool little_endian, FILE * input_fo,
-			   FILE * output_fo)
-// Iterates through each line of the given input file, compares lines
-// of human-readable text to expected inputs and, upon validation,
-// writes the encodable packets to the given output file.
+void parse_packet_contents(struct encoder *enc)
+// Iterates through each line of the given input, or each NDJSON or CSV
+// record, whose fields are found by key, compares them to expected
+// inputs and, upon validation, writes the encodable packets to the
+// given output. Stops at EOF or before a packet that starts at or
+// after enc->end, recording where.
 {
-	bool file_header_present = false;
-	char *line_buf = NULL;
-	size_t buf_size = 0;
-	int eof_flag = 0;
-
-	for (;;) {
-		struct packet_header ph = { 0, 0, 0, 0 };
-		struct ethernet_header eh = { 0, 0, 0 };
-		struct ip_header ih = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-		struct udp_header uh = { 0, 0, 0, 0 };
+	struct tokenizer *tk = enc->tk;
+
+	while (tokenizer_tell(tk) < enc->end) {
 		struct zerg_header zh = { 0, 0, 0, 0, 0, 0, 0 };
-		set_static_headers(&eh, &ih, &uh);
 
-		char *err = '\0';
+		struct span value;
+		long number;
 
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
+		int found = start_packet(enc, &value);
+		if (found == -1) {
 			break;
 		}
-		char *word = strtok(line_buf, ":");
-		if (strcmp(word, "Version") != 0) {
-			fprintf(stderr,
-				"Expected \"Version:\"; received \"%s\"\n",
-				word);
-			if ((skip_to_next_packet(input_fo))) {
+		if (!found
+		    || !field_long(enc, value, "version number", &number)) {
+			STATS_COUNT(COUNT_SKIP_INVALID);
+			if (skip_to_next_packet(enc)) {
 				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
-		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing version number\n");
-			if ((skip_to_next_packet(input_fo))) {
-				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
-		}
-		zh.zerg_version = strtol(word, &err, 10);
-		if (*err) {
-			fprintf(stderr,
-				"Expected version number; received \"%s\"\n",
-				word);
-			if ((skip_to_next_packet(input_fo))) {
-				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
 			}
+			break;
 		}
+		zh.zerg_version = number;
 
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			fprintf(stderr,
-				"Unexpected EOF; expected \"Sequence:\"\n");
+		found = read_field(enc, "Sequence", &value);
+		if (found == -1) {
+			STATS_COUNT(COUNT_SKIP_UNEXPECTED_EOF);
 			break;
 		}
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "Sequence") != 0) {
-			fprintf(stderr,
-				"Expected \"Sequence:\"; received \"%s\"\n",
-				word);
-			if ((skip_to_next_packet(input_fo))) {
-				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
-		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing sequence number\n");
-			if ((skip_to_next_packet(input_fo))) {
-				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
-		}
-		zh.zerg_sequence = htonl(strtol(word, &err, 10));
-		if (*err) {
-			fprintf(stderr,
-				"Expected sequence number; received %s\n",
-				word);
-			if ((skip_to_next_packet(input_fo))) {
+		if (!found
+		    || !field_long(enc, value, "sequence number", &number)) {
+			STATS_COUNT(COUNT_SKIP_INVALID);
+			if (skip_to_next_packet(enc)) {
 				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
 			}
+			break;
 		}
+		zh.zerg_sequence = htonl(number);
 
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			fprintf(stderr, "Unexpected EOF; expected \"From:\"\n");
+		found = read_field(enc, "From", &value);
+		if (found == -1) {
+			STATS_COUNT(COUNT_SKIP_UNEXPECTED_EOF);
 			break;
 		}
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "From") != 0) {
-			printf("Expected \"From:\"; received \"%s\"", word);
-			if ((skip_to_next_packet(input_fo))) {
+		if (!found || !field_long(enc, value, "Source ID", &number)
+		    || !field_range(enc, "Source ID", number, 0, UINT16_MAX)) {
+			STATS_COUNT(COUNT_SKIP_INVALID);
+			if (skip_to_next_packet(enc)) {
 				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
 			}
+			break;
 		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing Source ID\n");
-			if ((skip_to_next_packet(input_fo))) {
-				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
+		zh.zerg_src = htons(number);
+
+		found = read_field(enc, "To", &value);
+		if (found == -1) {
+			STATS_COUNT(COUNT_SKIP_UNEXPECTED_EOF);
+			break;
 		}
-		zh.zerg_src = htons(strtol(word, &err, 10));
-		if (*err) {
-			fprintf(stderr, "Expected source ID; received \"%s\"\n",
-				word);
-			if ((skip_to_next_packet(input_fo))) {
+		if (!found
+		    || !field_long(enc, value, "destination ID", &number)
+		    || !field_range(enc, "destination ID", number, 0,
+				    UINT16_MAX)) {
+			STATS_COUNT(COUNT_SKIP_INVALID);
+			if (skip_to_next_packet(enc)) {
 				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
 			}
+			break;
 		}
+		zh.zerg_dst = htons(number);
 
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			fprintf(stderr, "Unexpected EOF; expected \"To:\"\n");
+		int type;
+		found = find_payload(enc, &type);
+		if (found == -1) {
+			STATS_COUNT(COUNT_SKIP_UNEXPECTED_EOF);
 			break;
 		}
-		word = strtok(line_buf, ":");
-		if (!word) {
-			printf("Expected \"To:\"; received \"%s\"", word);
-			if ((skip_to_next_packet(input_fo))) {
-				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
+		if (!found) {
+			STATS_COUNT(COUNT_SKIP_UNKNOWN_PAYLOAD);
+			skip_to_next_packet(enc);
+			continue;
 		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing destination ID\n");
-			if ((skip_to_next_packet(input_fo))) {
-				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
+		zh.zerg_packet_type = type;
+
+		union {
+			struct zerg_message message;
+			struct zerg_status status;
+			struct zerg_command command;
+			struct zerg_gps gps;
+		} payload;
+		memset(&payload, 0, sizeof(payload));
+		struct span text = { NULL, 0 };
+		STATS_START(timer);
+		found = parse_payload(enc, &payload_schemas[type], &payload,
+				      &text);
+		STATS_STOP(STAGE_PARSE_MESSAGE + type, timer);
+		if (found == -1) {
+			// Case: Unexpected EOF
+			STATS_COUNT(COUNT_SKIP_UNEXPECTED_EOF);
+			break;
 		}
-		zh.zerg_dst = htons(strtol(word, &err, 10));
-		if (*err) {
-			fprintf(stderr,
-				"Expected destination ID; received \"%s\"\n",
-				word);
-			if ((skip_to_next_packet(input_fo))) {
+		if (!found) {
+			// Case: Invalid packet
+			STATS_COUNT(COUNT_SKIP_INVALID);
+			if (skip_to_next_packet(enc)) {
 				continue;
-			} else {
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
 			}
+			break;
 		}
 
-		unsigned int offset = ftell(input_fo);
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			fprintf(stderr, "Unexpected EOF; expected payload\n");
+		const struct schema *variant =
+		    schema_variant(&payload_schemas[type], &payload);
+		uint16_t len = variant ? variant->length :
+		    payload_schemas[type].length;
+		if (write_packet(enc, &zh, &payload, len, text) != 0) {
 			break;
 		}
-		fseek(input_fo, offset, SEEK_SET);
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "Message") == 0) {
-			// Case: Message payload
-			zh.zerg_packet_type = 0;
-			uint16_t len;
-			char *message;
-			if ((parse_message(&zh, input_fo)) == -2) {
-				// Case: Empty message
-				len = 0;
-			} else {
-				message =
-				    ((struct zerg_message *)zh.
-				     zerg_payload)->message;
-				if (message[0] == ' ') {
-					// Remove leading space if present
-					message = message + 1;
-				}
-				len = strlen(message);
-			}
-			set_length_fields(little_endian,
-					  sizeof(zh) - sizeof(zh.zerg_payload) +
-					  len, &ph, &ih, &uh, &zh);
-			write_headers(&file_header_present, little_endian, &ph,
-				      &eh, &ih, &uh, &zh, output_fo);
-			fwrite(message, len, 1, output_fo);
-			if (ntohs(ih.ip_packet_length) + 14 < 60) {
-				// Add buffer required by ethernet header
-				// if packet length too short
-				int padding_difference =
-				    60 - (ntohs(ih.ip_packet_length) + 14);
-				for (int i = 0; i < padding_difference; ++i) {
-					char null_buffer[] = "\0";
-					fwrite(null_buffer, 1, 1, output_fo);
-				}
-			}
-			free(((struct zerg_message *)zh.zerg_payload)->message);
-			free(zh.zerg_payload);
-		} else if (strcmp(word, "Max Hit Points") == 0) {
-			// Case: Status payload
-			zh.zerg_packet_type = 1;
-			uint16_t len;
-			uint16_t name_len;
-			char *name;
-			int return_value;
-			return_value = parse_status(&zh, input_fo);
-			if (return_value == 0) {
-				// Case: Invalid packet
-				if ((skip_to_next_packet(input_fo))) {
-					continue;
-				} else {
-					if (line_buf) {
-						free(line_buf);
-					}
-					return;
-				}
-			} else if (return_value == -1) {
-				// Case: Unexpected EOF
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			} else if (return_value == -2) {
-				// Case: Empty message
-				len =
-				    sizeof(struct zerg_status) -
-				    sizeof((struct zerg_status *)
-					   zh.zerg_payload)->name;;
-				name_len = 0;
-			} else {
-				name =
-				    ((struct zerg_status *)zh.
-				     zerg_payload)->name;
-				if (name[0] == ' ') {
-					name = name + 1;
-				}
-				len =
-				    strlen(name) + sizeof(struct zerg_status) -
-				    sizeof((struct zerg_status *)
-					   zh.zerg_payload)->name;
-				name_len = strlen(name);
-			}
-			set_length_fields(little_endian,
-					  sizeof(zh) - sizeof(zh.zerg_payload) +
-					  len, &ph, &ih, &uh, &zh);
-			write_headers(&file_header_present, little_endian, &ph,
-				      &eh, &ih, &uh, &zh, output_fo);
-			fwrite((struct zerg_status *)zh.zerg_payload,
-			       len - name_len, 1, output_fo);
-			fwrite(name, name_len, 1, output_fo);
-			if (ntohs(ih.ip_packet_length) + 14 < 60) {
-				// Add buffer required by ethernet header
-				// if packet length too short
-				int padding_difference =
-				    60 - (ntohs(ih.ip_packet_length) + 14);
-				for (int i = 0; i < padding_difference; ++i) {
-					char null_buffer[] = "\0";
-					fwrite(null_buffer, 1, 1, output_fo);
-				}
-			}
-			free(((struct zerg_status *)zh.zerg_payload)->name);
-			free(zh.zerg_payload);
-		} else if (strcmp(word, "Command") == 0) {
-			// Case: Command payload
-			zh.zerg_packet_type = 2;
-			int return_value = parse_command(&zh, input_fo);
-			if (return_value == 0) {
-				if ((skip_to_next_packet(input_fo))) {
-					// Case: Invalid packet
-					continue;
-				} else {
-					if (line_buf) {
-						free(line_buf);
-					}
-					return;
-				}
-			} else if (return_value == -1) {
-				// Case: Unexpected EOF
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
-			uint16_t len;
-			if (ntohs
-			    (((struct zerg_command *)zh.zerg_payload)->
-			     command) % 2 == 0) {
-				len = 2;	// Size of command payload for even commands
-			} else {
-				len = 8;	// Size of command payload for odd commands
-			}
-			set_length_fields(little_endian,
-					  sizeof(zh) - sizeof(zh.zerg_payload) +
-					  len, &ph, &ih, &uh, &zh);
-			write_headers(&file_header_present, little_endian, &ph,
-				      &eh, &ih, &uh, &zh, output_fo);
-			fwrite((struct zerg_command *)zh.zerg_payload, len, 1,
-			       output_fo);
-			if (ntohs(ih.ip_packet_length) + 14 < 60) {
-				int padding_difference =
-				    60 - (ntohs(ih.ip_packet_length) + 14);
-				for (int i = 0; i < padding_difference; ++i) {
-					char null_buffer[] = "\0";
-					fwrite(null_buffer, 1, 1, output_fo);
-				}
-			}
-			free(zh.zerg_payload);
-		} else if (strcmp(word, "Latitude") == 0) {
-			zh.zerg_packet_type = 3;
-			uint16_t len = 32;
-			int return_value;
-			return_value = parse_gps(&zh, input_fo);
-			if (return_value == 0) {
-				if ((skip_to_next_packet(input_fo))) {
-					// Case: Invalid packet
-					continue;
-				} else {
-					if (line_buf) {
-						free(line_buf);
-					}
-					return;
-				}
-			} else if (return_value == -1) {
-				// Case: Unexpected EOF
-				if (line_buf) {
-					free(line_buf);
-				}
-				return;
-			}
-			set_length_fields(little_endian,
-					  sizeof(zh) - sizeof(zh.zerg_payload) +
-					  len, &ph, &ih, &uh, &zh);
-			write_headers(&file_header_present, little_endian, &ph,
-				      &eh, &ih, &uh, &zh, output_fo);
-			fwrite((struct zerg_gps *)zh.zerg_payload, len, 1,
-			       output_fo);
-			if (ntohs(ih.ip_packet_length) + 14 < 60) {
-				int padding_difference =
-				    60 - (ntohs(ih.ip_packet_length) + 14);
-				for (int i = 0; i < padding_difference; ++i) {
-					char null_buffer[] = "\0";
-					fwrite(null_buffer, 1, 1, output_fo);
-				}
-			}
-			free(zh.zerg_payload);
-		} else {
-			skip_to_next_packet(input_fo);
-			if (line_buf) {
-				free(line_buf);
-			}
-			continue;
-		}
-		skip_to_next_packet(input_fo);
-	}
-
-	if (line_buf) {
-		free(line_buf);
+		skip_to_next_packet(enc);
 	}
-	return;
+	enc->stop = tokenizer_tell(tk);
 }
 
-void write_headers(bool *file_header_present, bool little_endian,
-		   struct packet_header *ph, struct ethernet_header *eh,
-		   struct ip_header *ih, struct udp_header *uh,
-		   struct zerg_header *zh, FILE * output_fo)
+void generate_packets(struct encoder *enc)
+// Encodes the generated packets numbered from enc->stop up to enc->end,
+// recording where it stopped.
 {
-	if (!*file_header_present) {
-		struct pcap_header fh;
-		generate_file_header(little_endian, &fh);
-		*file_header_present = true;
-		fwrite(&fh, sizeof(fh), 1, output_fo);
-	}
-	fwrite(ph, sizeof(*ph), 1, output_fo);
-	fwrite(eh, sizeof(*eh), 1, output_fo);
-	fwrite(ih, sizeof(*ih), 1, output_fo);
-	fwrite(uh, sizeof(*uh), 1, output_fo);
-	fwrite(zh, sizeof(*zh) - sizeof(zh->zerg_payload), 1, output_fo);
-}
-
-void set_static_headers(struct ethernet_header *eh, struct ip_header *ih,
-			struct udp_header *uh)
-{
-	uint16_t ethertype = 0x0800;	// IPv4 ethertype
-	eh->eth_ethernet_type = htons(ethertype);
-	uint16_t dst_port = 3751;	// Default zerg port
-	uh->udp_dst_port = htons(dst_port);
-	ih->ip_version = 4;	// IPv4
-	ih->ip_header_length = 5;	// Min IPv4 header length
-
-	return;
-}
-
-void set_length_fields(bool little_endian, const uint16_t len,
-		       struct packet_header *ph, struct ip_header *ih,
-		       struct udp_header *uh, struct zerg_header *zh)
-{
-	zh->zerg_len = htons(len) << 8;	// Bit shifting 16 bit int to fit
-	// leftmost part of the 24 bit field.
-	uh->udp_len = htons(len + sizeof(struct udp_header));
-	ih->ip_packet_length =
-	    htons(len + sizeof(struct udp_header) + sizeof(struct ip_header));
-	ih->ip_protocol = 17;	// UDP
-	if (!little_endian) {
-		ph->untruncated_len =
-		    htons(len + sizeof(struct udp_header) +
-			  sizeof(struct ip_header) +
-			  sizeof(struct ethernet_header));
-	} else {
-		ph->untruncated_len =
-		    len + sizeof(struct udp_header) + sizeof(struct ip_header) +
-		    sizeof(struct ethernet_header);
+	struct generated_packet packet;
 
+	for (size_t i = enc->stop; i < enc->end; ++i) {
+		generator_packet(enc->gen, i, &packet);
+		struct zerg_header zh = { 0, 0, 0, 0, 0, 0, 0 };
+		zh.zerg_version = 1;
+		zh.zerg_packet_type = packet.type;
+		zh.zerg_sequence = htonl(packet.sequence);
+		zh.zerg_src = htons(packet.src);
+		zh.zerg_dst = htons(packet.dst);
+		struct span text = { packet.text, packet.text_len };
+		enc->time = packet.time;
+		if (write_packet(enc, &zh, packet.payload, packet.len, text)
+		    != 0) {
+			break;
+		}
+		enc->stop = i + 1;
 	}
-	ph->data_capture_len = ph->untruncated_len;
-
-	return;
 }
 
-int parse_message(struct zerg_header *zh, FILE * input_fo)
+int write_file_header(struct output *output)
+// Writes the file header ahead of a segment's first packet, so that
+// input with no packets produces an empty file. For pcapng that is a
+// Section Header Block and the Interface Description Block of the one
+// Ethernet interface every packet is on. Returns 0 on success.
 {
-	char *line_buf = NULL;
-	size_t buf_size = 0;
-	char *word;
-
-	struct zerg_message *zm = malloc(sizeof(*zm));
-	if (!zm) {
-		fprintf(stderr, "Memory allocation error.\n");
-		exit(MEMORY_ERROR);
-	}
-
-	getline(&line_buf, &buf_size, input_fo);
-	word = strtok(line_buf, ":");
-	word = strtok(NULL, "\n");
-	if (!word) {
-		// Case: empty message
-		zh->zerg_payload = zm;
-		zm->message = NULL;
-		free(line_buf);
-		return (-2);
-	}
-	char *message = malloc(strlen(word) + 1);
-	if (!message) {
-		fprintf(stderr, "Memory allocation error.\n");
-		free(line_buf);
-		free(zm);
-		exit(MEMORY_ERROR);
-	}
-	strncpy(message, word, strlen(word));
-	message[strlen(word)] = '\0';
-
-	zm->message = message;
-	zh->zerg_payload = zm;
-	if (line_buf) {
-		free(line_buf);
+	output->header_present = true;
+	if (output->format == FORMAT_PCAP) {
+		struct pcap_header fh;
+		generate_file_header(output->little_endian, &fh);
+		output->size += sizeof(fh);
+		return (out_stream_write(output->stream, &fh, sizeof(fh)));
 	}
 
-	return (1);
+	unsigned char header[PCAPNG_HEADER_LEN];
+	bool le = output->little_endian;
+	memset(header, 0, sizeof(header));
+	put_uint32(header, 0x0A0D0D0A, le);	// Section Header Block
+	put_uint32(header + 4, 28, le);
+	put_uint32(header + 8, 0x1A2B3C4D, le);	// Byte-order magic
+	put_uint16(header + 12, 1, le);	// Version 1.0
+	memset(header + 16, 0xFF, 8);	// Section length unknown
+	put_uint32(header + 24, 28, le);
+	put_uint32(header + 28, 1, le);	// Interface Description Block
+	put_uint32(header + 32, 20, le);
+	put_uint16(header + 36, 1, le);	// Ethernet
+	put_uint32(header + 40, SNAPLEN, le);
+	put_uint32(header + 44, 20, le);
+	output->size += sizeof(header);
+	return (out_stream_write(output->stream, header, sizeof(header)));
 }
 
-int parse_status(struct zerg_header *zh, FILE * input_fo)
+int open_output(struct output *output)
+// Opens OUTFILE, or when rotating, the next segment under a ".part"
+// name that it keeps until close_output() has written all of it.
+// Reports failure and returns -1.
 {
-	int eof_flag = 0;
-	char *line_buf = NULL;
-	size_t buf_size = 0;
-	char *word;
-	char *err = '\0';
-
-	struct zerg_status *zs = malloc(sizeof(*zs));
-	if (!zs) {
-		fprintf(stderr, "Memory allocation error.\n");
-		exit(MEMORY_ERROR);
-	}
-
-	eof_flag = getline(&line_buf, &buf_size, input_fo);
-	word = strtok(line_buf, ":");
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Max Hit Points Value\n");
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-	zs->max_hp = htonl(strtol(word, &err, 10) << 8);
-	if (*err) {
-		fprintf(stderr,
-			"Expected Max Hit Points value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-
-	eof_flag = getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
+	const char *path = output->path;
+	output->size = 0;
+	output->header_present = false;
+	if (output->rotating) {
+		output->name = segment_name(output->path, output->segment);
+		output->part = output->name ?
+		    malloc(strlen(output->name) + sizeof(".part")) : NULL;
+		if (!output->part) {
+			fprintf(stderr, "Memory allocation error\n");
+			free(output->name);
+			output->name = NULL;
+			output->failed = true;
+			return (-1);
 		}
-		free(zs);
-		fprintf(stderr,
-			"Unexpected EOF; expected \"Current Hit Points:\"\n");
-		return (-1);
-	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Current Hit Points") != 0) {
-		fprintf(stderr,
-			"Expected \"Current Hit Points:\"; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zs);
-		return (0);
+		sprintf(output->part, "%s.part", output->name);
+		path = output->part;
 	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Current Hit Points Value\n");
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-	zs->current_hp = htonl(strtol(word, &err, 10) << 8);
-	if (*err) {
-		fprintf(stderr,
-			"Expected Current Hit Points value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-
-	eof_flag = getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
-		}
-		free(zs);
-		fprintf(stderr, "Unexpected EOF; expected \"Armor:\"\n");
+	output->stream = strcmp(path, "-") == 0 ?
+	    out_stream_fd(STDOUT_FILENO, 0) : out_stream_open(path, 0);
+	if (!output->stream) {
+		fprintf(stderr, "%s could not be opened", path);
+		perror(" \b");
+		output->failed = true;
 		return (-1);
 	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Armor") != 0) {
-		fprintf(stderr, "Expected \"Armor:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Armor Value\n");
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-	zs->armor = htonl(strtol(word, &err, 10) << 24);
-	if (*err) {
-		fprintf(stderr, "Expected Armor value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
+	return (0);
+}
 
-	eof_flag = getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
-		}
-		free(zs);
-		fprintf(stderr, "Unexpected EOF; expected \"Type:\"\n");
-		return (-1);
-	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Type") != 0) {
-		fprintf(stderr, "Expected \"Type:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Zerg Type\n");
-		free(line_buf);
-		free(zs);
-		return (0);
+int close_output(struct output *output)
+// Flushes and closes the open file, giving a finished segment its own
+// name so that whatever picks segments up never sees part of one.
+// Reports failure and returns -1.
+{
+	int result = 0;
+	const char *path = output->rotating ? output->part : output->path;
+	if (output->stream && out_stream_close(output->stream) != 0) {
+		fprintf(stderr, "%s could not be written", path);
+		perror(" \b");
+		result = -1;
 	}
-	if (strcmp(word, "Overmind") == 0) {
-		zs->type = 0;
-	} else if (strcmp(word, "Larva") == 0) {
-		zs->type = 1;
-	} else if (strcmp(word, "Cerebrate") == 0) {
-		zs->type = 2;
-	} else if (strcmp(word, "Overlord") == 0) {
-		zs->type = 3;
-	} else if (strcmp(word, "Queen") == 0) {
-		zs->type = 4;
-	} else if (strcmp(word, "Drone") == 0) {
-		zs->type = 5;
-	} else if (strcmp(word, "Zergling") == 0) {
-		zs->type = 6;
-	} else if (strcmp(word, "Lurker") == 0) {
-		zs->type = 7;
-	} else if (strcmp(word, "Broodling") == 0) {
-		zs->type = 8;
-	} else if (strcmp(word, "Hydralisk") == 0) {
-		zs->type = 9;
-	} else if (strcmp(word, "Guardian") == 0) {
-		zs->type = 10;
-	} else if (strcmp(word, "Scourge") == 0) {
-		zs->type = 11;
-	} else if (strcmp(word, "Ultralisk") == 0) {
-		zs->type = 12;
-	} else if (strcmp(word, "Mutalisk") == 0) {
-		zs->type = 13;
-	} else if (strcmp(word, "Defiler") == 0) {
-		zs->type = 14;
-	} else if (strcmp(word, "Devourer") == 0) {
-		zs->type = 15;
-	} else {
-		fprintf(stderr, "Expected Zerg Type; received \"%s\"\n", word);
-		free(line_buf);
-		free(zs);
-		return (0);
+	output->stream = NULL;
+	if (result == 0 && output->rotating && output->part
+	    && rename(output->part, output->name) != 0) {
+		fprintf(stderr, "%s could not be renamed", path);
+		perror(" \b");
+		result = -1;
 	}
+	free(output->name);
+	output->name = NULL;
+	free(output->part);
+	output->part = NULL;
+	return (result);
+}
 
-	eof_flag = getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
-		}
-		free(zs);
-		fprintf(stderr, "Unexpected EOF; expected \"Max Speed:\"\n");
-		return (-1);
-	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Max Speed") != 0) {
-		fprintf(stderr, "Expected \"Max Speed:\"; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Max Speed Value\n");
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
-	zs->max_speed = reverse_float(strtof(word, &err));
-	if (*err) {
-		fprintf(stderr, "Expected Max Speed value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zs);
-		return (0);
-	}
+char *segment_name(const char *path, unsigned int segment)
+// Returns path numbered for a segment: "out.pcap" becomes
+// "out-0003.pcap". The number goes before the file name's extension,
+// if it has one, so that tools which go by it still know each segment.
+// The caller frees the name.
+{
+	const char *base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+	const char *extension = strrchr(base, '.');
+	if (!extension || extension == base) {
+		extension = path + strlen(path);
+	}
+	size_t size = strlen(path) + sizeof("-4294967295");
+	char *name = malloc(size);
+	if (name) {
+		snprintf(name, size, "%.*s-%04u%s", (int)(extension - path),
+			 path, segment, extension);
+	}
+	return (name);
+}
 
-	getline(&line_buf, &buf_size, input_fo);
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Name") != 0) {
-		fprintf(stderr, "Expected \"Name:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zs);
-		return (0);
+bool segment_full(const struct output *output, size_t len, uint64_t time)
+// Returns whether a record of len bytes stamped time belongs in a new
+// segment. Every segment takes at least one record, however large.
+{
+	if (!output->rotating || !output->header_present) {
+		return (false);
 	}
-	word = strtok(NULL, "\n");
-	if (!word) {
-		// Case: empty message
-		zh->zerg_payload = zs;
-		zs->name = NULL;
-		free(line_buf);
-		return (-2);
-	}
-	char *name = malloc(strlen(word) + 1);
-	if (!name) {
-		fprintf(stderr, "Memory allocation error.\n");
-		free(line_buf);
-		free(zs);
-		exit(MEMORY_ERROR);
-	}
-	strncpy(name, word, strlen(word));
-	name[strlen(word)] = '\0';
-	zs->name = name;
-	zh->zerg_payload = zs;
-	if (line_buf) {
-		free(line_buf);
+	if (output->max_size && output->size + len > output->max_size) {
+		return (true);
 	}
-	return (1);
+	return (output->max_time && time >= output->start
+		&& time - output->start >= output->max_time);
 }
 
-int parse_command(struct zerg_header *zh, FILE * input_fo)
+int begin_record(struct output *output, size_t len, uint64_t time)
+// Makes ready for a record of len bytes stamped time, which the caller
+// then writes whole: finishes the segment first if the record belongs
+// in the next, and writes the file header ahead of a segment's first
+// record. Returns 0 on success.
 {
-	int eof_flag = 0;
-	char *line_buf = NULL;
-	size_t buf_size = 0;
-	char *word;
-	char *err = '\0';
-
-	struct zerg_command *zc = malloc(sizeof(*zc));
-	if (!zc) {
-		fprintf(stderr, "Memory allocation error.\n");
-		exit(MEMORY_ERROR);
-	}
-
-	getline(&line_buf, &buf_size, input_fo);
-	word = strtok(line_buf, ":");
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Command\n");
-		free(line_buf);
-		free(zc);
-		return (0);
-	}
-	uint16_t command;
-	if (strcmp(word, "GET_STATUS") == 0) {
-		command = 0;
-		zc->command = htons(command);
-	} else if (strcmp(word, "GOTO") == 0) {
-		command = 1;
-		zc->command = htons(command);
-	} else if (strcmp(word, "GET_GPS") == 0) {
-		command = 2;
-		zc->command = htons(command);
-	} else if (strcmp(word, "RETURN") == 0) {
-		command = 4;
-		zc->command = htons(command);
-	} else if (strcmp(word, "SET_GROUP") == 0) {
-		command = 5;
-		zc->command = htons(command);
-	} else if (strcmp(word, "STOP") == 0) {
-		command = 6;
-		zc->command = htons(command);
-	} else if (strcmp(word, "REPEAT") == 0) {
-		command = 7;
-		zc->command = htons(command);
-	} else {
-		fprintf(stderr, "Expected Command; received \"%s\"\n", word);
-		free(line_buf);
-		free(zc);
-		return (0);
+	if (output->failed) {
+		return (-1);
 	}
-	if (command % 2 == 0) {
-		zh->zerg_payload = zc;
-		if (line_buf) {
-			free(line_buf);
-		}
-		return (1);
-	} else if (command == 1) {
-		// Case: GOTO Payload
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			if (line_buf) {
-				free(line_buf);
-			}
-			free(zc);
-			fprintf(stderr,
-				"Unexpected EOF; expected \"Bearing:\"\n");
+	if (segment_full(output, len, time)) {
+		++output->segment;
+		if (close_output(output) != 0 || open_output(output) != 0) {
+			output->failed = true;
 			return (-1);
 		}
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "Bearing") != 0) {
-			fprintf(stderr,
-				"Expected \"Bearing:\"; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing Bearing Value\n");
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		float bearing = reverse_float(strtof(word, &err));
-		zc->parameter_2f = bearing;
-		if (*err) {
-			fprintf(stderr,
-				"Expected Bearing value; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
+	}
+	if (!output->header_present) {
+		output->start = time;
+		if (write_file_header(output) != 0) {
+			return (-1);
 		}
+	}
+	output->size += len;
+	return (0);
+}
 
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			if (line_buf) {
-				free(line_buf);
-			}
-			free(zc);
-			fprintf(stderr,
-				"Unexpected EOF; expected \"Distance:\"\n");
+int write_records(struct output *output,
+		  const struct packet_template *template,
+		  const unsigned char *records, size_t len)
+// Writes whole records collected in memory, finishing segments between
+// them as begin_record() would. Returns 0 on success.
+{
+	if (!output->rotating) {
+		if (begin_record(output, len, 0) != 0) {
 			return (-1);
 		}
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "Distance") != 0) {
-			fprintf(stderr,
-				"Expected \"Distance:\"; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing Distance Value\n");
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		zc->parameter_1 = htons(strtol(word, &err, 10));
-		if (*err) {
-			fprintf(stderr,
-				"Expected Distance value; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		zh->zerg_payload = zc;
-		if (line_buf) {
-			free(line_buf);
-		}
-		return (1);
-
-	} else if (command == 5) {
-		// Case: SET_GROUP Payload
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			if (line_buf) {
-				free(line_buf);
+		return (out_stream_write(output->stream, records, len));
+	}
+	size_t run = 0;		// Start of the records not yet written
+	size_t at = 0;
+	while (at < len) {
+		uint64_t time;
+		size_t size = record_size(template, output->little_endian,
+					  records + at, &time);
+		if (segment_full(output, size, time) && at > run) {
+			if (out_stream_write(output->stream, records + run,
+					     at - run) != 0) {
+				return (-1);
 			}
-			free(zc);
-			fprintf(stderr,
-				"Unexpected EOF; expected \"Action:\"\n");
-			return (-1);
-		}
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "Action") != 0) {
-			fprintf(stderr,
-				"Expected \"Action:\"; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		word = strtok(NULL, "\n");
-		if (word[0] == ' ') {
-			// Remove leading space if present
-			word = word + 1;
-		}
-		if (!word) {
-			fprintf(stderr, "Missing Action\n");
-			free(line_buf);
-			free(zc);
-			return (0);
+			run = at;
 		}
-		if (strcmp(word, "Add to") == 0) {
-			zc->parameter_1 = 1;
-		} else if (strcmp(word, "Remove from") == 0) {
-			zc->parameter_1 = 0;
-		} else {
-			fprintf(stderr,
-				"Expected Action to take; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
+		if (begin_record(output, size, time) != 0) {
+			return (-1);
 		}
+		at += size;
+	}
+	return (out_stream_write(output->stream, records + run, len - run));
+}
 
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			if (line_buf) {
-				free(line_buf);
+size_t record_size(const struct packet_template *template,
+		   bool little_endian, const unsigned char *record,
+		   uint64_t *time)
+// Reads back the length and timestamp of a record this program wrote.
+{
+	if (template->format == FORMAT_PCAPNG) {
+		*time = (uint64_t)get_uint32(record + BLOCK_TIME_HIGH,
+					     little_endian) << 32 |
+		    get_uint32(record + BLOCK_TIME_LOW, little_endian);
+		return (get_uint32(record + BLOCK_LENGTH, little_endian));
+	}
+	*time = get_uint32(record + RECORD_SECONDS, little_endian) *
+	    UINT64_C(1000000) + get_uint32(record + RECORD_MICROSECONDS,
+					   little_endian);
+	return (template->frame +
+		get_uint32(record + RECORD_CAPTURE_LEN, little_endian));
+}
+
+int encode_parallel(struct encoder *enc, size_t jobs)
+// Cuts mapped input into chunks of about CHUNK_SIZE bytes, each ending
+// just before a "Version:" line or record, and encodes up to jobs
+// chunks at once into buffers of their own. These are written out in
+// input order, so the output and any problems reported match a single
+// pass. Generated packets are cut into chunks of GENERATE_CHUNK packets
+// instead. Each job keeps its chunk's buffers from one round to the
+// next. Returns -1 if memory runs out.
+{
+	struct encoder chunks[MAX_JOBS];
+	size_t opened = 0;	// Chunks whose buffers have been set up
+	size_t starts[MAX_JOBS];
+	pthread_t threads[MAX_JOBS];
+	bool started[MAX_JOBS];
+	size_t size = enc->gen ? enc->gen->packets : tokenizer_size(enc->tk);
+	// Mapped input starts after any CSV header
+	size_t next = enc->gen ? 0 : tokenizer_tell(enc->tk);
+	size_t resume = next;	// Where the previous chunk really stopped
+	int result = 0;
+
+	schema_prepare();
+	while (next < size && result == 0) {
+		size_t count = 0;
+		while (count < jobs && next < size) {
+			size_t end = enc->gen ?
+			    next + (size - next < GENERATE_CHUNK ?
+				    size - next : GENERATE_CHUNK) :
+			    tokenizer_find(enc->tk, next + CHUNK_SIZE,
+					   enc->by_name ? NULL : "Version");
+			if (count == opened) {
+				if (open_chunk(&chunks[count], enc) != 0) {
+					result = -1;
+					break;
+				}
+				++opened;
 			}
-			free(zc);
-			fprintf(stderr,
-				"Unexpected EOF; expected \"Group:\"\n");
-			return (-1);
-		}
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "Group") != 0) {
-			fprintf(stderr,
-				"Expected \"Group:\"; received \"%s\"\n", word);
-			free(line_buf);
-			free(zc);
-			return (0);
+			start_chunk(&chunks[count], next, end);
+			starts[count++] = next;
+			next = end;
 		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing Group ID\n");
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		zc->parameter_2i = htonl(strtol(word, &err, 10));
-		if (*err) {
-			fprintf(stderr, "Expected Group ID; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		if (line_buf) {
-			free(line_buf);
-		}
-		zh->zerg_payload = zc;
-		return (1);
-	} else if (command == 7) {
-		zc->parameter_1 = 0;
-
-		eof_flag = getline(&line_buf, &buf_size, input_fo);
-		if (eof_flag == -1) {
-			if (line_buf) {
-				free(line_buf);
+		for (size_t i = 0; i < count; ++i) {
+			started[i] = pthread_create(&threads[i], NULL,
+						    encode_chunk,
+						    &chunks[i]) == 0;
+			if (!started[i]) {
+				encode_chunk(&chunks[i]);
 			}
-			free(zc);
-			fprintf(stderr,
-				"Unexpected EOF; expected \"Sequence:\"\n");
-			return (-1);
 		}
-		word = strtok(line_buf, ":");
-		if (strcmp(word, "Sequence") != 0) {
-			fprintf(stderr,
-				"Expected \"Sequence:\"; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		word = strtok(NULL, " \n");
-		if (!word) {
-			fprintf(stderr, "Missing Sequence ID\n");
-			free(line_buf);
-			free(zc);
-			return (0);
-		}
-		zc->parameter_2u = htonl(strtol(word, &err, 10));
-		if (*err) {
-			fprintf(stderr,
-				"Expected Sequence ID; received \"%s\"\n",
-				word);
-			free(line_buf);
-			free(zc);
-			return (0);
+		for (size_t i = 0; i < count; ++i) {
+			if (started[i]) {
+				pthread_join(threads[i], NULL);
+			}
 		}
-		if (line_buf) {
-			free(line_buf);
+		for (size_t i = 0; i < count; ++i) {
+			if (result == 0 && starts[i] != resume) {
+				// Case: The packet before this chunk was
+				// malformed and ran past the chunk's start
+				start_chunk(&chunks[i], resume, chunks[i].end);
+				encode_chunk(&chunks[i]);
+			}
+			if (result == 0 && finish_chunk(enc, &chunks[i]) != 0) {
+				result = -1;
+			}
+			resume = chunks[i].stop;
 		}
-		zh->zerg_payload = zc;
-		return (1);
 	}
-	if (line_buf) {
-		free(line_buf);
+	for (size_t i = 0; i < opened; ++i) {
+		free_chunk(&chunks[i]);
 	}
-	return (1);
+	return (result);
 }
 
-int parse_gps(struct zerg_header *zh, FILE * input_fo)
+int open_chunk(struct encoder *chunk, const struct encoder *enc)
+// Sets chunk up to encode parts of enc's input, collecting packets and
+// its report in memory of its own that is kept from one part to the
+// next. The file header is left to whoever writes the chunk out.
+// Returns 0 on success.
 {
-	int eof_flag = 0;
-	char *line_buf = NULL;
-	size_t buf_size = 0;
-	char *word;
-	char *err = '\0';
-	struct zerg_gps *zg = malloc(sizeof(*zg));
-	if (!zg) {
-		fprintf(stderr, "Memory allocation error.\n");
-		exit(MEMORY_ERROR);
-	}
-
-	getline(&line_buf, &buf_size, input_fo);
-	word = strtok(line_buf, ":");
-	word = strtok(NULL, " \n-");
-	if (!word) {
-		fprintf(stderr, "Missing Latitude degrees value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
-	}
-	double degrees = 0;
-	degrees = strtod(word, NULL);
-	word = strtok(NULL, " \n'-");
-	if (!word) {
-		fprintf(stderr, "Missing Latitude minutes value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	*chunk = *enc;
+	chunk->tk = enc->gen ? NULL : tokenizer_slice(enc->tk, 0);
+	chunk->output = NULL;
+	chunk->packets = NULL;
+	chunk->packets_len = 0;
+	chunk->packets_size = 0;
+	chunk->report_text = NULL;
+	chunk->report_len = 0;
+	chunk->report = open_memstream(&chunk->report_text,
+				       &chunk->report_len);
+	if ((!chunk->tk && !enc->gen) || !chunk->report) {
+		free_chunk(chunk);
+		return (-1);
 	}
-	double minutes = strtod(word, &err);
-	if (*err) {
-		fprintf(stderr,
-			"Expected Latitude minutes value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zg);
-		return (0);
+	return (0);
+}
+
+void start_chunk(struct encoder *chunk, size_t start, size_t end)
+// Points chunk at the packets that start from start up to end, emptying
+// what it collected from the last part.
+{
+	if (chunk->tk) {
+		tokenizer_seek(chunk->tk, start);
+	}
+	chunk->end = end;
+	chunk->stop = start;
+	chunk->failed = false;
+	chunk->packets_len = 0;
+	rewind(chunk->report);
+}
+
+void *encode_chunk(void *chunk)
+// Thread entry point for parse_packet_contents() and
+// generate_packets().
+{
+	if (((struct encoder *)chunk)->gen) {
+		generate_packets(chunk);
+	} else {
+		parse_packet_contents(chunk);
 	}
-	word = strtok(NULL, " \n\"-");
-	if (!word) {
-		fprintf(stderr, "Missing Latitude seconds value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	return (NULL);
+}
+
+int finish_chunk(struct encoder *enc, struct encoder *chunk)
+// Copies chunk's report to enc's and its packets to enc's output.
+// Returns 0 on success and -1 if the chunk ran out of memory.
+{
+	if (fflush(chunk->report) != 0 || chunk->failed) {
+		return (-1);
 	}
-	double seconds = strtod(word, &err);
-	if (*err) {
-		fprintf(stderr,
-			"Expected Latitude seconds value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zg);
+	fwrite(chunk->report_text, 1, chunk->report_len, enc->report);
+	if (chunk->packets_len == 0) {
 		return (0);
 	}
-	word = strtok(NULL, " \n\"-");
-	if (!word) {
-		fprintf(stderr, "Missing N or S\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	// Write failures are reported when the output is closed
+	write_records(enc->output, enc->template, chunk->packets,
+		      chunk->packets_len);
+	return (0);
+}
+
+void free_chunk(struct encoder *chunk)
+{
+	if (chunk->report) {
+		fclose(chunk->report);
+		chunk->report = NULL;
+	}
+	free(chunk->report_text);
+	chunk->report_text = NULL;
+	tokenizer_close(chunk->tk);
+	chunk->tk = NULL;
+	free(chunk->packets);
+	chunk->packets = NULL;
+}
+
+unsigned char *reserve_output(struct encoder *enc, size_t len)
+// Returns room for len bytes at the end of the output: the output
+// stream's buffer, or the chunk's own, which grows to fit. Returns NULL
+// if a packet is too large for the stream's buffer or memory runs out.
+{
+	if (enc->output) {
+		return (out_stream_reserve(enc->output->stream, len));
+	}
+	if (len > enc->packets_size - enc->packets_len) {
+		size_t size =
+		    enc->packets_size ? enc->packets_size : CHUNK_SIZE;
+		while (len > size - enc->packets_len) {
+			size *= 2;
+		}
+		unsigned char *tmp = realloc(enc->packets, size);
+		if (!tmp) {
+			return (NULL);
+		}
+		enc->packets = tmp;
+		enc->packets_size = size;
 	}
-	if (strcmp(word, "N") == 0) {
-		degrees = (degrees + (minutes / 60) + (seconds / 3600));
-	} else if (strcmp(word, "S") == 0) {
-		degrees =
-		    (((-1) * degrees) + ((-1) * minutes / 60) +
-		     ((-1) * seconds / 3600));
+	return (enc->packets + enc->packets_len);
+}
+
+void commit_output(struct encoder *enc, size_t len)
+// Adds the len bytes filled in after reserve_output() to the output.
+{
+	if (enc->output) {
+		out_stream_commit(enc->output->stream, len);
 	} else {
-		fprintf(stderr, "Expected N or S; received \"%s\"\n", word);
+		enc->packets_len += len;
 	}
-	zg->latitude = reverse_double(degrees);
+}
 
-	getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
-		}
-		free(zg);
-		fprintf(stderr, "Unexpected EOF; expected \"Longitude:\"\n");
+int write_packet(struct encoder *enc, struct zerg_header *zh,
+		 const void *payload, size_t len, struct span text)
+// Assembles the packet in place at the end of the output buffer, so
+// that it costs no more than a few copies; the buffer is written out
+// in one write() once full. Returns 0 on success.
+{
+	static const unsigned char zeroes[MIN_FRAME];
+	const struct packet_template *template = enc->template;
+	uint16_t zerg_len = ZERG_HEADER_LEN + len + text.len;
+	size_t frame_len = FRAME_HEADERS_LEN + len + text.len;
+	size_t padding = 0;
+	if (frame_len < MIN_FRAME) {
+		// Add buffer required by ethernet header
+		// if packet length too short
+		padding = MIN_FRAME - frame_len;
+	}
+	size_t trailer = trailer_len(template, frame_len + padding);
+	size_t total = template->frame + frame_len + padding + trailer;
+	// Payloads are all of even length, so text needs no realignment
+	uint64_t data_sum = checksum_add(0, payload, len);
+	data_sum = checksum_add(data_sum, text.start, text.len);
+
+	if (enc->output && begin_record(enc->output, total, enc->time) != 0) {
 		return (-1);
 	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Longitude") != 0) {
-		fprintf(stderr,
-			"Expected \"Longitude:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zg);
-		return (0);
-	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Longitude degrees value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
-	}
-	degrees = 0;
-	degrees = strtod(word, NULL);
-	word = strtok(NULL, " \n'");
-	if (!word) {
-		fprintf(stderr, "Missing Longitude minutes value\n");
-		free(line_buf);
-		free(zg);
+	unsigned char *buf = reserve_output(enc, total);
+	if (buf) {
+		unsigned char *end = write_headers(buf, template,
+						   enc->little_endian,
+						   enc->time, zh, zerg_len,
+						   data_sum);
+		memcpy(end, payload, len);
+		end += len;
+		if (text.len > 0) {
+			memcpy(end, text.start, text.len);
+			end += text.len;
+		}
+		memset(end, 0, padding);
+		write_trailer(end + padding, trailer, enc->little_endian,
+			      total);
+		commit_output(enc, total);
 		return (0);
 	}
-	minutes = strtod(word, &err);
-	if (*err) {
-		fprintf(stderr,
-			"Expected Longitude minutes value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zg);
-		return (0);
+	if (!enc->output) {
+		enc->failed = true;
+		return (-1);
 	}
-	word = strtok(NULL, " \n\"");
-	if (!word) {
-		fprintf(stderr, "Missing Longitude seconds value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+
+	// Case: Packet larger than the output buffer
+	struct out_stream *out = enc->output->stream;
+	unsigned char headers[HEADERS_MAX];
+	unsigned char end[sizeof(uint32_t) * 2];
+	write_headers(headers, template, enc->little_endian, enc->time, zh,
+		      zerg_len, data_sum);
+	write_trailer(end, trailer, enc->little_endian, total);
+	if (out_stream_write(out, headers, template->len) != 0
+	    || out_stream_write(out, payload, len) != 0
+	    || out_stream_write(out, text.start, text.len) != 0
+	    || out_stream_write(out, zeroes, padding) != 0
+	    || out_stream_write(out, end, trailer) != 0) {
+		return (-1);
 	}
-	seconds = strtod(word, &err);
-	if (*err) {
-		fprintf(stderr,
-			"Expected Longitude seconds value; received \"%s\"\n",
-			word);
-		free(line_buf);
-		free(zg);
-		return (0);
+	return (0);
+}
+
+unsigned char *write_headers(unsigned char *buf,
+			     const struct packet_template *template,
+			     bool little_endian, uint64_t time,
+			     struct zerg_header *zh, uint16_t len,
+			     uint64_t data_sum)
+// Copies the template into buf and patches in the fields that vary by
+// packet: the record's timestamp and lengths, the IP and UDP lengths,
+// the whole zerg header and the checksums. time is in microseconds
+// since the epoch, len is the length of the zerg packet and data_sum
+// the checksum_add() of the zerg payload. The checksums start from the
+// template's sums, so only the varying fields are summed here. Returns
+// the end of the headers.
+{
+	STATS_START(timer);
+	memcpy(buf, template->headers, template->len);
+
+	uint32_t frame_len = len + sizeof(struct udp_header) +
+	    sizeof(struct ip_header) + sizeof(struct ethernet_header);
+	if (frame_len < MIN_FRAME) {
+		// The padding write_packet() adds is part of the frame
+		frame_len = MIN_FRAME;
+	}
+	if (template->format == FORMAT_PCAPNG) {
+		uint32_t block_len = template->frame + frame_len +
+		    trailer_len(template, frame_len);
+		put_uint32(buf + BLOCK_LENGTH, block_len, little_endian);
+		put_uint32(buf + BLOCK_TIME_HIGH, time >> 32, little_endian);
+		put_uint32(buf + BLOCK_TIME_LOW, time, little_endian);
+		put_uint32(buf + BLOCK_CAPTURE_LEN, frame_len, little_endian);
+		put_uint32(buf + BLOCK_UNTRUNCATED_LEN, frame_len,
+			   little_endian);
+	} else {
+		put_uint32(buf + RECORD_SECONDS, time / 1000000,
+			   little_endian);
+		put_uint32(buf + RECORD_MICROSECONDS, time % 1000000,
+			   little_endian);
+		put_uint32(buf + RECORD_CAPTURE_LEN, frame_len, little_endian);
+		put_uint32(buf + RECORD_UNTRUNCATED_LEN, frame_len,
+			   little_endian);
 	}
-	word = strtok(NULL, " \n\"-");
-	if (!word) {
-		fprintf(stderr, "Missing E or W\n");
-		free(line_buf);
-		free(zg);
+
+	unsigned char *frame = buf + template->frame;
+	uint16_t ip_len = htons(len + sizeof(struct udp_header) +
+				sizeof(struct ip_header));
+	memcpy(frame + IP_LENGTH, &ip_len, sizeof(ip_len));
+	uint16_t udp_len = htons(len + sizeof(struct udp_header));
+	memcpy(frame + UDP_LENGTH, &udp_len, sizeof(udp_len));
+	zh->zerg_len = htons(len) << 8;	// Bit shifting 16 bit int to fit
+	// leftmost part of the 24 bit field.
+	memcpy(frame + ZERG_HEADER, zh, ZERG_HEADER_LEN);
+
+	uint16_t checksum = checksum_finish(template->ip_sum + ip_len);
+	memcpy(frame + IP_HEADER_CHECKSUM, &checksum, sizeof(checksum));
+	uint64_t sum = template->udp_sum + udp_len + udp_len + data_sum;
+	checksum = checksum_finish(checksum_add(sum, frame + ZERG_HEADER,
+						ZERG_HEADER_LEN));
+	if (checksum == 0) {
+		// Zero means no checksum in UDP, so send all ones instead
+		checksum = 0xFFFF;
+	}
+	memcpy(frame + UDP_HEADER_CHECKSUM, &checksum, sizeof(checksum));
+
+	STATS_STOP(STAGE_WRITE_HEADERS, timer);
+	STATS_COUNT(COUNT_ENCODED);
+	return (buf + template->len);
+}
+
+size_t trailer_len(const struct packet_template *template,
+		   size_t frame_len)
+// Returns how many bytes follow a frame of frame_len in its record:
+// none in pcap, but pcapng pads the frame to four bytes and repeats the
+// block's length.
+{
+	if (template->format != FORMAT_PCAPNG) {
 		return (0);
 	}
-	if (strcmp(word, "E") == 0) {
-		degrees = (degrees + (minutes / 60) + (seconds / 3600));
-	} else if (strcmp(word, "W") == 0) {
-		degrees =
-		    (((-1) * degrees) + ((-1) * minutes / 60) +
-		     ((-1) * seconds / 3600));
-	} else {
-		fprintf(stderr, "Expected E or W; received \"%s\"\n", word);
+	return ((4 - frame_len % 4) % 4 + sizeof(uint32_t));
+}
+
+void write_trailer(unsigned char *buf, size_t trailer, bool little_endian,
+		   uint32_t record_len)
+// Fills in the trailer_len() bytes that end a record of record_len.
+{
+	if (trailer == 0) {
+		return;
 	}
-	zg->longitude = reverse_double(degrees);
+	memset(buf, 0, trailer - sizeof(uint32_t));
+	put_uint32(buf + trailer - sizeof(uint32_t), record_len,
+		   little_endian);
+}
+
+void build_template(struct packet_template *template,
+		    enum capture_format format, bool little_endian)
+// Lays out the headers that are the same for every packet and sums them
+// for the checksums. Per-packet fields are left zero for
+// write_headers() to fill in.
+{
+	struct ethernet_header eh = { 0, 0, 0 };
+	struct ip_header ih = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	struct udp_header uh = { 0, 0, 0, 0 };
+
+	uint16_t ethertype = 0x0800;	// IPv4 ethertype
+	eh.eth_ethernet_type = htons(ethertype);
+	uint16_t dst_port = 3751;	// Default zerg port
+	uh.udp_dst_port = htons(dst_port);
+	ih.ip_version = 4;	// IPv4
+	ih.ip_header_length = 5;	// Min IPv4 header length
+	ih.ip_protocol = 17;	// UDP
+
+	unsigned char *headers = template->headers;
+	memset(headers, 0, HEADERS_MAX);
+	template->format = format;
+	template->frame = sizeof(struct packet_header);
+	if (format == FORMAT_PCAPNG) {
+		// An Enhanced Packet Block on interface 0
+		template->frame = BLOCK_DATA;
+		put_uint32(headers + BLOCK_TYPE, 6, little_endian);
+	}
+	template->len = template->frame + FRAME_HEADERS_LEN;
+
+	headers += template->frame;
+	memcpy(headers, &eh, sizeof(eh));
+	memcpy(headers + IP_HEADER, &ih, sizeof(ih));
+	memcpy(headers + UDP_HEADER, &uh, sizeof(uh));
+
+	template->ip_sum = checksum_add(0, headers + IP_HEADER, sizeof(ih));
+	// The UDP pseudo-header is the IP addresses, protocol and UDP length
+	uint16_t protocol = htons(ih.ip_protocol);
+	template->udp_sum = checksum_add(0, headers + IP_ADDRESSES, 8) +
+	    protocol + checksum_add(0, headers + UDP_HEADER, sizeof(uh));
+}
+
+int parse_payload(struct encoder *enc, const struct schema *schema,
+		  void *payload, struct span *text)
+// Reads a line for each field of schema, the first of which has only
+// been peeked, then the fields of whichever variant that selects. A
+// string field always comes last, so text can point straight into the
+// input. Returns 1, 0 for an invalid payload or -1 at EOF.
+{
+	struct span value;
 
-	getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
+	for (size_t i = 0; i < schema->count; ++i) {
+		const struct field *field = &schema->fields[i];
+		int found = read_field(enc, record_key(enc, field), &value);
+		if (found != 1) {
+			return (found);
+		}
+		if (field->kind == FIELD_STRING) {
+			if (value.len > 0 && value.start[0] == ' ') {
+				// Remove leading space if present
+				++value.start;
+				--value.len;
+			}
+			*text = value;
+		} else if (!field_parse(field, &value, payload, enc->report)) {
+			return (0);
 		}
-		free(zg);
-		fprintf(stderr, "Unexpected EOF; expected \"Altitude:\"\n");
-		return (-1);
-	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Altitude") != 0) {
-		fprintf(stderr,
-			"Expected \"Altitude:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zg);
-		return (0);
-	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Altitude degrees value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
 	}
-	degrees = 0;
-	degrees = strtof(word, NULL);
-	word = strtok(NULL, " \n'");
-	if (!word) {
-		fprintf(stderr, "Missing Altitude minutes value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	const struct schema *variant = schema_variant(schema, payload);
+	if (variant) {
+		return (parse_payload(enc, variant, payload, text));
 	}
-	zg->altitude = reverse_float(degrees);
+	return (1);
+}
+
+int start_packet(struct encoder *enc, struct span *value)
+// Reads the "Version" line that starts a packet of text, or the next
+// NDJSON or CSV record and its "Version" field. Returns 1 with value
+// set, 0 for anything else, which is reported, or -1 at EOF.
+{
+	struct span key;
 
-	getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
+	if (enc->by_name) {
+		int found = read_record(enc);
+		if (found != 1) {
+			return (found);
 		}
-		free(zg);
-		fprintf(stderr, "Unexpected EOF; expected \"Bearing:\"\n");
+		return (read_field(enc, "Version", value));
+	}
+	if (!next_line(enc->tk, &key, value)) {
 		return (-1);
 	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Bearing") != 0) {
-		fprintf(stderr,
-			"Expected \"Bearing:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zg);
+	if (!span_equals(key, "Version")) {
+		fprintf(enc->report,
+			"Expected \"Version:\"; received \"%.*s\"\n",
+			(int)key.len, key.start);
 		return (0);
 	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Bearing degrees value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	return (1);
+}
+
+int read_record(struct encoder *enc)
+// Reads the fields of the next nonempty NDJSON or CSV record into
+// enc->record, where they stay valid until the next one is read, so
+// that they can be taken in any order. Returns 1, 0 for a record with
+// too many fields, which is reported, or -1 at EOF.
+{
+	struct record *record = &enc->record;
+	struct span key;
+	struct span value;
+	size_t count = 0;
+
+	// Blank lines are empty records, which are passed over
+	while (count == 0) {
+		if (tokenizer_tell(enc->tk) >= enc->end
+		    || !tokenizer_peek(enc->tk, &key, &value)) {
+			return (-1);
+		}
+		while (next_line(enc->tk, &key, &value) && key.len > 0) {
+			if (count < RECORD_FIELDS) {
+				record->keys[count] = key;
+				record->values[count] = value;
+			}
+			++count;
+		}
 	}
-	degrees = 0;
-	degrees = strtof(word, NULL);
-	word = strtok(NULL, " \n'");
-	if (!word) {
-		fprintf(stderr, "Missing Bearing minutes value\n");
-		free(line_buf);
-		free(zg);
+	if (count > RECORD_FIELDS) {
+		fprintf(enc->report, "Record has more than %d fields\n",
+			RECORD_FIELDS);
+		record->count = 0;
 		return (0);
 	}
-	zg->bearing = reverse_float(degrees);
+	record->count = count;
+	record->next = 0;
+	return (1);
+}
 
-	getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
+int find_payload(struct encoder *enc, int *type)
+// Sets type to the payload type named by the key of the payload's first
+// field: the next line of text, or any field of a record. Returns 1, 0
+// if that key names no payload or -1 at EOF, which is reported.
+{
+	struct span key;
+	struct span value;
+
+	if (enc->by_name) {
+		const struct record *record = &enc->record;
+		for (size_t n = 0; n < record->count; ++n) {
+			size_t i = (record->next + n) % record->count;
+			*type = schema_find(&record->keys[i]);
+			if (*type >= 0) {
+				return (1);
+			}
 		}
-		free(zg);
-		fprintf(stderr, "Unexpected EOF; expected \"Speed:\"\n");
-		return (-1);
-	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Speed") != 0) {
-		fprintf(stderr, "Expected \"Speed:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zg);
 		return (0);
 	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Speed degrees value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	if (!tokenizer_peek(enc->tk, &key, &value)) {
+		fprintf(enc->report, "Unexpected EOF; expected payload\n");
+		return (-1);
 	}
-	degrees = 0;
-	degrees = strtof(word, NULL);
-	word = strtok(NULL, " \n'");
-	if (!word) {
-		fprintf(stderr, "Missing Speed minutes value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	*type = schema_find(&key);
+	return (*type >= 0);
+}
+
+int skip_to_next_packet(struct encoder *enc)
+// Advances to the next line starting with the word "Version", which is
+// the first word in any given packet's output from decode. A record is
+// read whole, so the next one is already there. Returns 0 if the input
+// ends first.
+{
+	struct tokenizer *tk = enc->tk;
+	struct span key;
+	struct span value;
+
+	if (enc->by_name) {
+		return (tokenizer_peek(tk, &key, &value));
 	}
-	zg->speed = reverse_float(degrees);
+	while (tokenizer_peek(tk, &key, &value)) {
+		if (span_equals(key, "Version")) {
+			return (1);
+		}
+		next_line(tk, &key, &value);
+	}
+	return (0);
+}
+
+int next_line(struct tokenizer *tk, struct span *key, struct span *value)
+// tokenizer_next() wrapper so that line reads can be timed.
+{
+	STATS_START(timer);
+	int found = tokenizer_next(tk, key, value);
+	STATS_STOP(STAGE_TOKENIZE, timer);
+	return (found);
+}
+
+int read_field(struct encoder *enc, const char *name, struct span *value)
+// Reads the next line, which must be the given field, or finds it in
+// the record by key. Returns 1 with value set, 0 if some other line was
+// found or the record lacks it or -1 at EOF, reporting any problem.
+{
+	struct span key;
 
-	getline(&line_buf, &buf_size, input_fo);
-	if (eof_flag == -1) {
-		if (line_buf) {
-			free(line_buf);
+	if (enc->by_name) {
+		// Keys are looked for from just after the last one found, so
+		// fields in the order decode prints them are found at once
+		struct record *record = &enc->record;
+		for (size_t n = 0; n < record->count; ++n) {
+			size_t i = (record->next + n) % record->count;
+			if (span_equals(record->keys[i], name)) {
+				*value = record->values[i];
+				record->next = i + 1;
+				return (1);
+			}
 		}
-		free(zg);
-		fprintf(stderr, "Unexpected EOF; expected \"Accuracy:\"\n");
+		fprintf(enc->report, "Record has no \"%s\" field\n", name);
+		return (0);
+	}
+	if (!next_line(enc->tk, &key, value)) {
+		fprintf(enc->report, "Unexpected EOF; expected \"%s:\"\n",
+			name);
 		return (-1);
 	}
-	word = strtok(line_buf, ":");
-	if (strcmp(word, "Accuracy") != 0) {
-		fprintf(stderr,
-			"Expected \"Accuracy:\"; received \"%s\"\n", word);
-		free(line_buf);
-		free(zg);
+	if (!span_equals(key, name)) {
+		fprintf(enc->report, "Expected \"%s:\"; received \"%.*s\"\n",
+			name, (int)key.len, key.start);
 		return (0);
 	}
-	word = strtok(NULL, " \n");
-	if (!word) {
-		fprintf(stderr, "Missing Accuracy degrees value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	return (1);
+}
+
+const char *record_key(const struct encoder *enc, const struct field *field)
+// Returns the key of a payload field. Keys in a record must be unique,
+// so REPEAT's "Sequence", which text gives after the header's, is
+// "Repeat Sequence" there.
+{
+	if (enc->by_name && strcmp(field->key, "Sequence") == 0) {
+		return ("Repeat Sequence");
 	}
-	degrees = 0;
-	degrees = strtof(word, NULL);
-	word = strtok(NULL, " \n'");
-	if (!word) {
-		fprintf(stderr, "Missing Accuracy minutes value\n");
-		free(line_buf);
-		free(zg);
-		return (0);
+	return (field->key);
+}
+
+bool field_long(struct encoder *enc, struct span value, const char *name,
+		long *number)
+// Parses the first word of value as a decimal integer.
+{
+	struct span word;
+
+	if (!span_token(&value, " \n", &word)) {
+		fprintf(enc->report, "Missing %s\n", name);
+		return (false);
 	}
-	zg->accuracy = reverse_float(degrees);
-	zh->zerg_payload = zg;
-	if (line_buf) {
-		free(line_buf);
+	if (!span_long(word, number)) {
+		fprintf(enc->report, "Expected %s; received \"%.*s\"\n", name,
+			(int)word.len, word.start);
+		return (false);
 	}
-	return (1);
+	return (true);
 }
 
-int skip_to_next_packet(FILE * input_fo)
-// Sets the file pointer to the next instance of the word "Version", 
-// which is the first word in any given packet's output from decode
+bool field_range(struct encoder *enc, const char *name, long number,
+		 long min, long max)
+// Reports a number that a narrow header field could not hold.
 {
-	char *line_buf = NULL;
-	size_t buf_size = 0;
-
-	for (;;) {
-		unsigned int offset = ftell(input_fo);
-		if ((getline(&line_buf, &buf_size, input_fo) != -1)) {
-			if (!strcmp(strtok(line_buf, ":"), "Version")) {
-				fseek(input_fo, offset, SEEK_SET);
-				if (line_buf) {
-					free(line_buf);
-				}
-				return (1);
-			}
-			continue;
-		}
-		if (line_buf) {
-			free(line_buf);
-			break;
-		}
+	if (number < min || number > max) {
+		fprintf(enc->report, "%s %ld is outside %ld to %ld\n", name,
+			number, min, max);
+		return (false);
 	}
-	return (0);
+	return (true);
 }
 
 void generate_file_header(bool little_endian, struct pcap_header *fh)
@@ -1407,21 +1358,49 @@ void generate_file_header(bool little_endian, struct pcap_header *fh)
 	uint16_t major_version = 2;
 	uint16_t minor_version = 4;
 	uint32_t link_type = 1;	// Ethernet
+	uint32_t snaplen = SNAPLEN;
 
 	if (little_endian) {
 		fh->magic_number = magic_number;
 		fh->major_version = major_version;
 		fh->minor_version = minor_version;
+		fh->max_capture_len = snaplen;
 		fh->link_layer_type = link_type;
 	} else {
 		fh->magic_number = htonl(magic_number);
 		fh->major_version = htons(major_version);
 		fh->minor_version = htons(minor_version);
+		fh->max_capture_len = htonl(snaplen);
 		fh->link_layer_type = htonl(link_type);
 	}
 	fh->gmt_offset = 0;
 	fh->accuracy_delta = 0;
-	fh->max_capture_len = 0;
 
 	return;
 }
+
+void put_uint16(unsigned char *buf, uint16_t value, bool little_endian)
+// Stores value in the output's byte order.
+{
+	if (!little_endian) {
+		value = htons(value);
+	}
+	memcpy(buf, &value, sizeof(value));
+}
+
+void put_uint32(unsigned char *buf, uint32_t value, bool little_endian)
+// Stores value in the output's byte order.
+{
+	if (!little_endian) {
+		value = htonl(value);
+	}
+	memcpy(buf, &value, sizeof(value));
+}
+
+uint32_t get_uint32(const unsigned char *buf, bool little_endian)
+// Loads a value stored by put_uint32().
+{
+	uint32_t value;
+	memcpy(&value, buf, sizeof(value));
+	return (little_endian ? value : ntohl(value));
+}
@@ -0,0 +1,115 @@
+#include "shared_fields.h"
+#include "readahead.h"
+#include "capture.h"
+#include "stats.h"
+#include <arpa/inet.h>
+
+enum capture_limits {
+	MIN_FRAME = 60		// Shorter Ethernet frames are padded
+};
+
+int capture_init(struct capture *cap, const char *name,
+		 struct readahead *fo)
+// Reads and validates the pcap file header from fo. On success cap is
+// set up so that capture_next() yields the first record. Returns 0 on
+// success and -1 if fo is not a version 2.4 pcap capture.
+{
+	struct pcap_header fh;	// [f]ile [h]eader
+	if (readahead_read(fo, &fh, sizeof(fh)) != sizeof(fh)) {
+		return (-1);
+	}
+	if (fh.magic_number == 0xA1B2C3D4) {
+		// Case: Packet has same byte order as host (Little Endian)
+		if (fh.major_version != 2 || fh.minor_version != 4) {
+			return (-1);
+		}
+		cap->little_endian = true;
+	} else if (fh.magic_number == 0xD4C3B2A1) {
+		// Case: Packet has reverse byte order from host (Big Endian)
+		if (ntohs(fh.major_version) != 2
+		    || ntohs(fh.minor_version) != 4) {
+			return (-1);
+		}
+		cap->little_endian = false;
+	} else {
+		// Case: Malformed magic number
+		return (-1);
+	}
+	// Only encode has written a snaplen of 0
+	cap->legacy_lengths = fh.max_capture_len == 0;
+	cap->name = name;
+	cap->fo = fo;
+	cap->record = sizeof(fh);
+	cap->next = sizeof(fh);
+	cap->stop = -1;
+	cap->time = 0;
+	cap->capture_len = 0;
+	return (0);
+}
+
+int capture_next(struct capture *cap)
+// Moves to the following record and reads its record header, leaving
+// fo at the start of the packet data. Returns 1 on success and 0 at EOF
+// or once the stop offset is reached.
+{
+	STATS_START(timer);
+	int found = capture_skim(cap);
+	STATS_STOP(STAGE_READ, timer);
+	if (found) {
+		STATS_COUNT(COUNT_RECORDS);
+	}
+	return (found);
+}
+
+int capture_skim(struct capture *cap)
+// capture_next() without the statistics, for walks over the records
+// that are not part of decoding them.
+{
+	if (cap->stop >= 0 && cap->next >= cap->stop) {
+		return (0);
+	}
+	struct packet_header ph;
+	size_t read_len = 0;
+	if (readahead_seek(cap->fo, cap->next) == 0) {
+		read_len = readahead_read(cap->fo, &ph, sizeof(ph));
+	}
+	if (read_len != sizeof(ph)) {
+		// Case: EOF reached
+		return (0);
+	}
+	uint32_t seconds = ph.unix_epoch;
+	uint32_t micros = ph.us_from_epoch;
+	uint32_t capture_len = ph.data_capture_len;
+	if (!cap->little_endian) {
+		seconds = ntohl(seconds);
+		micros = ntohl(micros);
+		capture_len = ntohl(capture_len);
+	}
+	if (cap->legacy_lengths) {
+		// Case: encode once stored big-endian lengths with htons(),
+		// which leaves the length in the high half, and left out
+		// the padding it wrote after short frames
+		if (capture_len > UINT16_MAX && (capture_len & 0xFFFF) == 0) {
+			capture_len >>= 16;
+		}
+		if (capture_len < MIN_FRAME) {
+			capture_len = MIN_FRAME;
+		}
+	}
+	cap->record = cap->next;
+	cap->next = cap->record + sizeof(ph) + capture_len;
+	cap->time = seconds * 1000000ULL + micros;
+	cap->capture_len = capture_len;
+	return (1);
+}
+
+bool capture_before(const struct capture *first,
+		    const struct capture *second)
+// Orders the current records of two captures by timestamp. Ties go to
+// the capture listed first so merges are stable.
+{
+	if (first->time != second->time) {
+		return (first->time < second->time);
+	}
+	return (first < second);
+}
@@ -0,0 +1,26 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+struct readahead;
+
+struct capture {
+	const char *name;
+	struct readahead *fo;
+	bool little_endian;	// Byte order of the pcap headers
+	bool legacy_lengths;	// Record lengths may be from an older encode
+	long record;		// Offset of the current record
+	long next;		// Offset of the record after it
+	long stop;		// Offset at which reading ends, or -1 for EOF
+	uint64_t time;		// Timestamp of the current record (us)
+	uint32_t capture_len;	// Bytes of packet data in the current record
+};
+
+int capture_init(struct capture *cap, const char *name,
+		 struct readahead *fo);
+
+int capture_next(struct capture *cap);
+
+int capture_skim(struct capture *cap);
+
+bool capture_before(const struct capture *first,
+		    const struct capture *second);
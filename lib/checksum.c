@@ -0,0 +1,62 @@
+#include <string.h>
+#include "checksum.h"
+
+uint64_t checksum_add(uint64_t sum, const void *data, size_t len)
+// Adds data to an Internet checksum (RFC 1071) being built in sum. Words
+// are summed in memory order, which gives the right bytes to store
+// whatever the host's byte order. They are taken 32 bits at a time into
+// a 64-bit total that cannot overflow in practice, so the main loop has
+// no carries to fold and can be vectorized. Only the last piece added
+// to a sum may have an odd length.
+{
+	const unsigned char *bytes = data;
+	uint32_t words[4];
+	uint16_t half;
+
+	while (len >= sizeof(words)) {
+		memcpy(words, bytes, sizeof(words));
+		sum += (uint64_t)words[0] + words[1] + words[2] + words[3];
+		bytes += sizeof(words);
+		len -= sizeof(words);
+	}
+	while (len >= sizeof(words[0])) {
+		memcpy(words, bytes, sizeof(words[0]));
+		sum += words[0];
+		bytes += sizeof(words[0]);
+		len -= sizeof(words[0]);
+	}
+	if (len >= sizeof(half)) {
+		memcpy(&half, bytes, sizeof(half));
+		sum += half;
+		bytes += sizeof(half);
+		len -= sizeof(half);
+	}
+	if (len > 0) {
+		// Case: Odd length; pad with a zero byte
+		half = 0;
+		memcpy(&half, bytes, 1);
+		sum += half;
+	}
+	return (sum);
+}
+
+uint16_t checksum_finish(uint64_t sum)
+// Folds sum to 16 bits and complements it, giving the checksum to store
+// in memory order.
+{
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+	return (~sum & 0xFFFF);
+}
+
+uint16_t checksum_update(uint16_t checksum, const void *old, const void *new,
+			 size_t len)
+// Adjusts a stored checksum for len bytes changing from old to new
+// (RFC 1624, eqn. 3), without summing the rest of what it covers. len
+// must be even and the bytes at an even offset from the start.
+{
+	uint64_t sum = (uint16_t)~checksum;
+	sum += checksum_finish(checksum_add(0, old, len));
+	return (checksum_finish(checksum_add(sum, new, len)));
+}
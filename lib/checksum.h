@@ -0,0 +1,9 @@
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t checksum_add(uint64_t sum, const void *data, size_t len);
+
+uint16_t checksum_finish(uint64_t sum);
+
+uint16_t checksum_update(uint16_t checksum, const void *old, const void *new,
+			 size_t len);
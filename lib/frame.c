@@ -0,0 +1,43 @@
+#include <stdint.h>
+#include <string.h>
+#include "shared_fields.h"
+#include "frame.h"
+#include <arpa/inet.h>
+
+bool frame_locate(const unsigned char *frame, size_t len,
+		  struct frame_layout *layout)
+// Finds the headers of an Ethernet frame taken from a capture record,
+// applying the same checks as decode: IPv4, UDP and bound for the zerg
+// port. Returns false for any other frame. A payload cut short by the
+// capture's snap length is reported as far as it goes.
+{
+	struct ethernet_header eh;
+	struct ip_header ih;
+	struct udp_header uh;
+
+	if (len < sizeof(eh) + sizeof(ih) + sizeof(uh)) {
+		return (false);
+	}
+	memcpy(&eh, frame, sizeof(eh));
+	memcpy(&ih, frame + sizeof(eh), sizeof(ih));
+	if (ntohs(eh.eth_ethernet_type) != 0x0800 || ih.ip_version != 4
+	    || ih.ip_protocol != 17 || ih.ip_header_length < 5) {
+		return (false);
+	}
+	layout->ip = sizeof(eh);
+	layout->udp = layout->ip + ih.ip_header_length * 4;
+	if (len < layout->udp + sizeof(uh)) {
+		return (false);
+	}
+	memcpy(&uh, frame + layout->udp, sizeof(uh));
+	size_t udp_len = ntohs(uh.udp_len);
+	if (ntohs(uh.udp_dst_port) != ZERG_PORT || udp_len < sizeof(uh)) {
+		return (false);
+	}
+	layout->zerg = layout->udp + sizeof(uh);
+	layout->zerg_len = udp_len - sizeof(uh);
+	if (layout->zerg_len > len - layout->zerg) {
+		layout->zerg_len = len - layout->zerg;
+	}
+	return (true);
+}
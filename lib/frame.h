@@ -0,0 +1,16 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+enum frame_constants {
+	ZERG_PORT = 3751
+};
+
+struct frame_layout {
+	size_t ip;		// Offset of the IPv4 header
+	size_t udp;		// Offset of the UDP header
+	size_t zerg;		// Offset of the UDP payload
+	size_t zerg_len;	// Bytes of UDP payload present in the frame
+};
+
+bool frame_locate(const unsigned char *frame, size_t len,
+		  struct frame_layout *layout);
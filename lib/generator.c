@@ -0,0 +1,614 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "tokenizer.h"
+#include "schema.h"
+#include "generator.h"
+
+enum generator_payloads {
+	// Indices into payload_schemas
+	MESSAGE_PAYLOAD,
+	STATUS_PAYLOAD,
+	COMMAND_PAYLOAD,
+	GPS_PAYLOAD
+};
+
+enum generated_field {
+	MAX_HIT_POINTS,
+	CURRENT_HIT_POINTS,
+	ARMOR,
+	UNIT_TYPE,
+	MAX_SPEED,
+	COMMAND,
+	GOTO_BEARING,
+	GOTO_DISTANCE,
+	GROUP_ACTION,
+	GROUP_ID,
+	REPEAT_SEQUENCE,
+	LATITUDE,
+	LONGITUDE,
+	ALTITUDE,
+	BEARING,
+	SPEED,
+	ACCURACY,
+	GENERATED_FIELDS
+};
+
+enum setting_kind {
+	SETTING_SIZE,
+	SETTING_UINT64,
+	SETTING_UINT32,
+	SETTING_UINT16,
+	SETTING_DOUBLE
+};
+
+struct setting {
+	const char *key;
+	enum setting_kind kind;
+	size_t offset;		// Into struct generator
+	double min;
+	double max;
+};
+
+struct unit_traits {
+	uint8_t type;
+	uint32_t max_hp;
+	uint8_t armor;
+	double hp_phase;	// Hit points already lost at time zero
+	double speed;
+	double north;		// Centre of the unit's patrol, metres from
+	double east;		// the generator's centre
+	double loop;		// Radius of the patrol, metres
+	double angle;		// Where on its patrol the unit starts, radians
+	double altitude;
+};
+
+static const struct setting settings[] = {
+	{"Packets", SETTING_SIZE, offsetof(struct generator, packets), 1,
+	 1e15},
+	{"Seed", SETTING_UINT64, offsetof(struct generator, seed), 0, 1e18},
+	{"Units", SETTING_UINT32, offsetof(struct generator, units), 1,
+	 UINT16_MAX + 1},
+	{"First Unit", SETTING_UINT16, offsetof(struct generator, first_unit),
+	 0, UINT16_MAX},
+	{"Destination", SETTING_UINT16,
+	 offsetof(struct generator, destination), 0, UINT16_MAX},
+	{"Rate", SETTING_DOUBLE, offsetof(struct generator, rate), 1e-3, 1e9},
+	{"Start", SETTING_UINT32, offsetof(struct generator, start), 0,
+	 UINT32_MAX},
+	// Current Hit Points is a signed 24-bit field
+	{"Hit Points", SETTING_UINT32, offsetof(struct generator, hit_points),
+	 1, (1 << 23) - 1},
+	{"Damage", SETTING_DOUBLE, offsetof(struct generator, damage), 0, 1e6},
+	{"Latitude", SETTING_DOUBLE, offsetof(struct generator, latitude), -80,
+	 80},
+	{"Longitude", SETTING_DOUBLE, offsetof(struct generator, longitude),
+	 -180, 180},
+	{"Radius", SETTING_DOUBLE, offsetof(struct generator, radius), 1, 1e6},
+	{"Speed", SETTING_DOUBLE, offsetof(struct generator, speed), 0, 1e4}
+};
+
+static const struct {
+	int type;
+	int variant;		// Command variant, or -1
+	const char *key;
+} field_keys[GENERATED_FIELDS] = {
+	{STATUS_PAYLOAD, -1, "Max Hit Points"},
+	{STATUS_PAYLOAD, -1, "Current Hit Points"},
+	{STATUS_PAYLOAD, -1, "Armor"},
+	{STATUS_PAYLOAD, -1, "Type"},
+	{STATUS_PAYLOAD, -1, "Max Speed"},
+	{COMMAND_PAYLOAD, -1, "Command"},
+	{COMMAND_PAYLOAD, 1, "Bearing"},
+	{COMMAND_PAYLOAD, 1, "Distance"},
+	{COMMAND_PAYLOAD, 5, "Action"},
+	{COMMAND_PAYLOAD, 5, "Group"},
+	{COMMAND_PAYLOAD, 7, "Sequence"},
+	{GPS_PAYLOAD, -1, "Latitude"},
+	{GPS_PAYLOAD, -1, "Longitude"},
+	{GPS_PAYLOAD, -1, "Altitude"},
+	{GPS_PAYLOAD, -1, "Bearing"},
+	{GPS_PAYLOAD, -1, "Speed"},
+	{GPS_PAYLOAD, -1, "Accuracy"}
+};
+
+// Resolved by generator_load(), so packets need no lookups
+static const struct field *fields[GENERATED_FIELDS];
+
+static const char default_template[] = "Unit {unit} reporting";
+static const double metres_per_degree = 111320;
+static const double pi = 3.14159265358979323846;
+
+static void generator_defaults(struct generator *gen);
+static bool load_setting(struct generator *gen, struct span key,
+			 struct span value, FILE * report);
+static bool load_mix(struct generator *gen, struct span value,
+		     FILE * report);
+static bool load_template(struct generator *gen, struct span value,
+			  FILE * report);
+static uint64_t mix64(uint64_t x);
+static uint64_t next_random(uint64_t *state);
+static uint32_t pick(uint64_t *state, uint32_t bound);
+static double uniform(uint64_t *state);
+static void unit_traits(const struct generator *gen, uint32_t unit,
+			struct unit_traits *traits);
+static void generate_status(const struct generator *gen,
+			    const struct unit_traits *traits, double time,
+			    struct generated_packet *packet);
+static void generate_command(uint64_t *state, const struct generator *gen,
+			     struct generated_packet *packet);
+static void generate_gps(uint64_t *state, const struct generator *gen,
+			 const struct unit_traits *traits, double time,
+			 struct generated_packet *packet);
+static void expand_template(const char *template,
+			    const struct unit_traits *traits,
+			    struct generated_packet *packet);
+static size_t unit_name(uint16_t src, const struct unit_traits *traits,
+			char *buf, size_t size);
+
+bool generator_load(struct generator *gen, struct tokenizer *tk,
+		    FILE * report)
+// Reads a generator spec: "Key: value" lines, as in decode's output,
+// such as
+//
+//	Packets: 100000000
+//	Units: 500
+//	Mix: GPS 6, Status 3, Command 2, Message 1
+//	Rate: 20000 packets/s
+//	Message: {name} holding at sequence {sequence}
+//
+// Numbers are read from the first word, so units may follow them.
+// Blank lines and lines starting with '#' are skipped. Only Packets is
+// required; see generator_defaults() for the rest. Message may be given
+// up to GENERATOR_TEMPLATES times, and {unit}, {name}, {type} and
+// {sequence} in it are filled in per packet. Returns false after
+// reporting the first problem.
+{
+	struct span key;
+	struct span value;
+
+	generator_defaults(gen);
+	while (tokenizer_next(tk, &key, &value)) {
+		if (key.len == 0 || key.start[0] == '#') {
+			continue;
+		}
+		if (!load_setting(gen, key, value, report)) {
+			generator_free(gen);
+			return (false);
+		}
+	}
+	if (gen->packets == 0) {
+		fprintf(report, "Missing \"Packets:\"\n");
+		generator_free(gen);
+		return (false);
+	}
+	if (gen->first_unit + gen->units - 1 > UINT16_MAX) {
+		fprintf(report, "First Unit %u and %u Units pass ID %u\n",
+			gen->first_unit, gen->units, UINT16_MAX);
+		generator_free(gen);
+		return (false);
+	}
+
+	gen->traits = calloc(gen->units, sizeof(*gen->traits));
+	if (!gen->traits) {
+		fprintf(report, "Memory allocation error\n");
+		generator_free(gen);
+		return (false);
+	}
+	for (uint32_t i = 0; i < gen->units; ++i) {
+		unit_traits(gen, i, &gen->traits[i]);
+	}
+	for (size_t i = 0; i < GENERATED_FIELDS; ++i) {
+		const struct schema *schema =
+		    &payload_schemas[field_keys[i].type];
+		if (field_keys[i].variant >= 0) {
+			schema = &schema->variants[field_keys[i].variant];
+		}
+		fields[i] = schema_field(schema, field_keys[i].key);
+	}
+	return (true);
+}
+
+void generator_packet(const struct generator *gen, size_t index,
+		      struct generated_packet *packet)
+// Fills packet with the index'th packet of gen's traffic. Units report
+// in turn, so each unit's sequence numbers count up from zero. Every
+// packet depends only on gen and index, so ranges of packets can be
+// generated apart, in any order, and still match.
+{
+	uint64_t state = mix64(mix64(gen->seed) ^ index);
+	uint32_t unit = index % gen->units;
+	double time = index / gen->rate;
+	const struct unit_traits *traits = &gen->traits[unit];
+
+	packet->src = gen->first_unit + unit;
+	packet->dst = gen->destination;
+	packet->sequence = index / gen->units;
+	packet->time =
+	    gen->start * UINT64_C(1000000) + (uint64_t)(time * 1e6);
+	memset(packet->payload, 0, sizeof(packet->payload));
+	packet->text_len = 0;
+
+	uint32_t roll = pick(&state, gen->mix_total);
+	uint8_t type = 0;
+	while (roll >= gen->mix[type]) {
+		roll -= gen->mix[type++];
+	}
+	packet->type = type;
+
+	switch (type) {
+	case MESSAGE_PAYLOAD:
+		expand_template(gen->template_count ?
+				gen->templates[pick(&state,
+						    gen->template_count)] :
+				default_template, traits, packet);
+		break;
+	case STATUS_PAYLOAD:
+		generate_status(gen, traits, time, packet);
+		break;
+	case COMMAND_PAYLOAD:
+		generate_command(&state, gen, packet);
+		break;
+	case GPS_PAYLOAD:
+		generate_gps(&state, gen, traits, time, packet);
+		break;
+	}
+
+	const struct schema *schema = &payload_schemas[type];
+	const struct schema *variant = schema_variant(schema, packet->payload);
+	packet->len = variant ? variant->length : schema->length;
+}
+
+void generator_free(struct generator *gen)
+{
+	for (size_t i = 0; i < gen->template_count; ++i) {
+		free(gen->templates[i]);
+	}
+	gen->template_count = 0;
+	free(gen->traits);
+	gen->traits = NULL;
+}
+
+static void generator_defaults(struct generator *gen)
+// Sixteen units reporting 1000 packets a second between them, mostly
+// GPS and status, around 0° N 0° E.
+{
+	memset(gen, 0, sizeof(*gen));
+	gen->seed = 1;
+	gen->units = 16;
+	gen->first_unit = 1;
+	gen->mix[MESSAGE_PAYLOAD] = 1;
+	gen->mix[STATUS_PAYLOAD] = 2;
+	gen->mix[COMMAND_PAYLOAD] = 2;
+	gen->mix[GPS_PAYLOAD] = 3;
+	gen->mix_total = 8;
+	gen->rate = 1000;
+	gen->start = 1700000000;
+	gen->hit_points = 1000;
+	gen->damage = 1;
+	gen->radius = 1000;
+	gen->speed = 10;
+}
+
+static bool load_setting(struct generator *gen, struct span key,
+			 struct span value, FILE * report)
+// Stores one line of the spec into gen.
+{
+	if (span_equals(key, "Mix")) {
+		return (load_mix(gen, value, report));
+	}
+	if (span_equals(key, "Message")) {
+		return (load_template(gen, value, report));
+	}
+
+	const struct setting *setting = NULL;
+	for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); ++i) {
+		if (span_equals(key, settings[i].key)) {
+			setting = &settings[i];
+		}
+	}
+	if (!setting) {
+		fprintf(report, "Unknown generator setting \"%.*s\"\n",
+			(int)key.len, key.start);
+		return (false);
+	}
+
+	struct span word;
+	long integer = 0;
+	double number = 0;
+	if (!span_token(&value, " \n", &word)) {
+		fprintf(report, "Missing %s value\n", setting->key);
+		return (false);
+	}
+	bool valid;
+	if (setting->kind == SETTING_DOUBLE) {
+		valid = span_double(word, &number);
+	} else {
+		valid = span_long(word, &integer);
+		number = integer;
+	}
+	if (!valid || !(number >= setting->min && number <= setting->max)) {
+		fprintf(report,
+			"Expected %s from %g to %g; received \"%.*s\"\n",
+			setting->key, setting->min, setting->max,
+			(int)word.len, word.start);
+		return (false);
+	}
+
+	unsigned char *field = (unsigned char *)gen + setting->offset;
+	switch (setting->kind) {
+	case SETTING_SIZE:
+		*(size_t *)field = integer;
+		break;
+	case SETTING_UINT64:
+		*(uint64_t *)field = integer;
+		break;
+	case SETTING_UINT32:
+		*(uint32_t *)field = integer;
+		break;
+	case SETTING_UINT16:
+		*(uint16_t *)field = integer;
+		break;
+	case SETTING_DOUBLE:
+		*(double *)field = number;
+		break;
+	}
+	return (true);
+}
+
+static bool load_mix(struct generator *gen, struct span value,
+		     FILE * report)
+// Parses "Title weight" pairs, such as "GPS 3, Status 1". Payload types
+// left out are not generated.
+{
+	uint32_t mix[GENERATOR_TYPES] = { 0 };
+	uint32_t total = 0;
+	struct span name;
+	struct span weight;
+	long number;
+
+	while (span_token(&value, " ,\n", &name)) {
+		int type = -1;
+		for (int i = 0; i < GENERATOR_TYPES; ++i) {
+			const char *title = payload_schemas[i].title;
+			if (strlen(title) == name.len
+			    && strncasecmp(title, name.start, name.len) == 0) {
+				type = i;
+			}
+		}
+		if (type < 0) {
+			fprintf(report,
+				"Expected payload type in Mix; received \"%.*s\"\n",
+				(int)name.len, name.start);
+			return (false);
+		}
+		if (!span_token(&value, " ,\n", &weight)
+		    || !span_long(weight, &number) || number < 0
+		    || number > UINT16_MAX) {
+			fprintf(report,
+				"Expected %s weight from 0 to %d in Mix\n",
+				payload_schemas[type].title, UINT16_MAX);
+			return (false);
+		}
+		total += number - mix[type];
+		mix[type] = number;
+	}
+	if (total == 0) {
+		fprintf(report, "Mix gives no payload type a weight\n");
+		return (false);
+	}
+	memcpy(gen->mix, mix, sizeof(mix));
+	gen->mix_total = total;
+	return (true);
+}
+
+static bool load_template(struct generator *gen, struct span value,
+			  FILE * report)
+// Keeps a copy of a Message template.
+{
+	if (value.len > 0 && value.start[0] == ' ') {
+		// Remove leading space if present
+		++value.start;
+		--value.len;
+	}
+	if (gen->template_count == GENERATOR_TEMPLATES) {
+		fprintf(report, "More than %d Message templates\n",
+			GENERATOR_TEMPLATES);
+		return (false);
+	}
+	if (value.len >= GENERATOR_TEXT_MAX) {
+		fprintf(report, "Message template longer than %d bytes\n",
+			GENERATOR_TEXT_MAX - 1);
+		return (false);
+	}
+	char *template = strndup(value.start, value.len);
+	if (!template) {
+		fprintf(report, "Memory allocation error\n");
+		return (false);
+	}
+	gen->templates[gen->template_count++] = template;
+	return (true);
+}
+
+static uint64_t mix64(uint64_t x)
+// splitmix64's finalizer; spreads any change in x over every bit.
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	return (x ^ (x >> 31));
+}
+
+static uint64_t next_random(uint64_t *state)
+// splitmix64.
+{
+	*state += 0x9E3779B97F4A7C15ULL;
+	return (mix64(*state));
+}
+
+static uint32_t pick(uint64_t *state, uint32_t bound)
+// Returns a value in [0, bound).
+{
+	return ((next_random(state) >> 32) * bound >> 32);
+}
+
+static double uniform(uint64_t *state)
+// Returns a value in [0, 1).
+{
+	return ((next_random(state) >> 11) * 0x1p-53);
+}
+
+static void unit_traits(const struct generator *gen, uint32_t unit,
+			struct unit_traits *traits)
+// Derives what stays fixed about a unit from the seed alone, so that
+// every packet about it agrees without any state being carried along.
+{
+	uint64_t state = mix64(mix64(gen->seed) + ~(uint64_t)unit);
+
+	traits->type = pick(&state, 16);
+	traits->max_hp = 1 + pick(&state, gen->hit_points);
+	traits->armor = pick(&state, 20);
+	traits->hp_phase = uniform(&state) * traits->max_hp;
+	traits->speed = gen->speed * (0.25 + 0.75 * uniform(&state));
+	// Patrols are circles that stay within radius of the centre
+	traits->loop = gen->radius * (0.05 + 0.2 * uniform(&state));
+	double reach = (gen->radius - traits->loop) * sqrt(uniform(&state));
+	double heading = 2 * pi * uniform(&state);
+	traits->north = reach * cos(heading);
+	traits->east = reach * sin(heading);
+	traits->angle = 2 * pi * uniform(&state);
+	traits->altitude = 50 * uniform(&state);
+}
+
+static void generate_status(const struct generator *gen,
+			    const struct unit_traits *traits, double time,
+			    struct generated_packet *packet)
+// Units lose gen->damage hit points a second and are restored to full
+// each time they would reach zero.
+{
+	double lost = fmod(traits->hp_phase + gen->damage * time,
+			   traits->max_hp);
+	field_store(fields[MAX_HIT_POINTS], traits->max_hp, packet->payload);
+	field_store(fields[CURRENT_HIT_POINTS], traits->max_hp - (long)lost,
+		    packet->payload);
+	field_store(fields[ARMOR], traits->armor, packet->payload);
+	field_store(fields[UNIT_TYPE], traits->type, packet->payload);
+	field_store(fields[MAX_SPEED], traits->speed, packet->payload);
+	packet->text_len = unit_name(packet->src, traits, packet->text,
+				     sizeof(packet->text));
+}
+
+static void generate_command(uint64_t *state, const struct generator *gen,
+			     struct generated_packet *packet)
+// Picks any named command, with parameters where it takes them.
+{
+	static const uint8_t commands[] = { 0, 1, 2, 4, 5, 6, 7 };
+	uint8_t command = commands[pick(state, sizeof(commands))];
+
+	field_store(fields[COMMAND], command, packet->payload);
+	switch (command) {
+	case 1:
+		field_store(fields[GOTO_BEARING], 0.5 * pick(state, 720),
+			    packet->payload);
+		field_store(fields[GOTO_DISTANCE],
+			    pick(state, gen->radius < UINT16_MAX ?
+				 gen->radius + 1 : UINT16_MAX),
+			    packet->payload);
+		break;
+	case 5:
+		field_store(fields[GROUP_ACTION], pick(state, 2),
+			    packet->payload);
+		field_store(fields[GROUP_ID], pick(state, 50), packet->payload);
+		break;
+	case 7:
+		field_store(fields[REPEAT_SEQUENCE],
+			    pick(state, packet->sequence + 1),
+			    packet->payload);
+		break;
+	}
+}
+
+static void generate_gps(uint64_t *state, const struct generator *gen,
+			 const struct unit_traits *traits, double time,
+			 struct generated_packet *packet)
+// Places the unit on its patrol, which it circles clockwise at its own
+// speed, on a flat approximation of the Earth around the centre.
+{
+	double angle = traits->angle + traits->speed * time / traits->loop;
+	angle = fmod(angle, 2 * pi);
+	double north = traits->north + traits->loop * cos(angle);
+	double east = traits->east + traits->loop * sin(angle);
+	double latitude = gen->latitude + north / metres_per_degree;
+	double longitude = gen->longitude + east /
+	    (metres_per_degree * cos(gen->latitude * pi / 180));
+	if (longitude > 180) {
+		longitude -= 360;
+	} else if (longitude < -180) {
+		longitude += 360;
+	}
+	double bearing = fmod(angle * 180 / pi + 90, 360);
+
+	field_store(fields[LATITUDE], latitude, packet->payload);
+	field_store(fields[LONGITUDE], longitude, packet->payload);
+	field_store(fields[ALTITUDE], traits->altitude + 2 * sin(angle),
+		    packet->payload);
+	field_store(fields[BEARING], bearing, packet->payload);
+	field_store(fields[SPEED], traits->speed, packet->payload);
+	field_store(fields[ACCURACY], 1 + 9 * uniform(state), packet->payload);
+}
+
+static void expand_template(const char *template,
+			    const struct unit_traits *traits,
+			    struct generated_packet *packet)
+// Copies template into packet's text, filling in {unit}, {name}, {type}
+// and {sequence}. Other braces are copied as they are, and text that
+// would not fit is dropped.
+{
+	char *text = packet->text;
+	size_t size = sizeof(packet->text);
+	size_t len = 0;
+
+	while (*template && len < size - 1) {
+		int added = -1;
+		if (strncmp(template, "{unit}", 6) == 0) {
+			added = snprintf(text + len, size - len, "%u",
+					 packet->src);
+			template += 6;
+		} else if (strncmp(template, "{name}", 6) == 0) {
+			added = unit_name(packet->src, traits, text + len,
+					  size - len);
+			template += 6;
+		} else if (strncmp(template, "{type}", 6) == 0) {
+			added = snprintf(text + len, size - len, "%s",
+					 keyword_name(&zerg_types,
+						      traits->type));
+			template += 6;
+		} else if (strncmp(template, "{sequence}", 10) == 0) {
+			added = snprintf(text + len, size - len, "%u",
+					 packet->sequence);
+			template += 10;
+		}
+		if (added < 0) {
+			text[len++] = *template++;
+		} else {
+			len += (size_t)added < size - len ?
+			    (size_t)added : size - len - 1;
+		}
+	}
+	packet->text_len = len;
+}
+
+static size_t unit_name(uint16_t src, const struct unit_traits *traits,
+			char *buf, size_t size)
+// Writes the unit's name, its type and ID, into buf. Returns its length,
+// less anything that did not fit.
+{
+	int len = snprintf(buf, size, "%s %u",
+			   keyword_name(&zerg_types, traits->type), src);
+	if (len < 0) {
+		return (0);
+	}
+	return ((size_t)len < size ? (size_t)len : size - 1);
+}
@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum generator_limits {
+	GENERATOR_TEMPLATES = 16,
+	GENERATOR_TYPES = 4,	// Payload types, as in PAYLOAD_TYPES
+	GENERATOR_PAYLOAD_MAX = 32,	// Longest fixed part of any payload
+	GENERATOR_TEXT_MAX = 256	// Longest expanded message or name
+};
+
+struct unit_traits;
+
+struct generator {
+	size_t packets;
+	uint64_t seed;
+	uint32_t units;
+	uint16_t first_unit;	// Source ID of the first unit
+	uint16_t destination;
+	uint32_t mix[GENERATOR_TYPES];	// Relative weights by payload type
+	uint32_t mix_total;
+	double rate;		// Packets per second, all units together
+	uint32_t start;		// Epoch seconds of the first packet
+	uint32_t hit_points;	// Most Max Hit Points a unit is given
+	double damage;		// Hit points a unit loses per second
+	double latitude;	// Centre of the area units patrol
+	double longitude;
+	double radius;		// Metres from the centre units stay within
+	double speed;		// Fastest a unit moves, m/s
+	char *templates[GENERATOR_TEMPLATES];
+	size_t template_count;
+	struct unit_traits *traits;	// One per unit, derived from seed
+};
+
+struct generated_packet {
+	uint8_t type;
+	uint16_t src;
+	uint16_t dst;
+	uint32_t sequence;
+	uint64_t time;		// Microseconds since the epoch
+	unsigned char payload[GENERATOR_PAYLOAD_MAX];
+	size_t len;
+	char text[GENERATOR_TEXT_MAX];
+	size_t text_len;
+};
+
+struct tokenizer;
+
+bool generator_load(struct generator *gen, struct tokenizer *tk,
+		    FILE * report);
+
+void generator_packet(const struct generator *gen, size_t index,
+		      struct generated_packet *packet);
+
+void generator_free(struct generator *gen);
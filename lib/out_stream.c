@@ -0,0 +1,301 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "out_stream.h"
+
+struct out_stream {
+	int fd;
+	bool owns_fd;
+	bool separate;		// Set once a record has been written
+	int error;
+	size_t buf_size;
+	char *active;		// Buffer being filled by the caller
+	size_t active_len;
+	char *pending;		// Buffer handed to the writer thread
+	size_t pending_len;
+	char *spare;		// Buffer available for the next swap
+	bool stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void *writer_thread(void *arg);
+static int hand_off(struct out_stream *os);
+
+struct out_stream *out_stream_open(const char *path, size_t buf_size)
+// Creates (or truncates) path and returns a stream writing to it.
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return (NULL);
+	}
+	struct out_stream *os = out_stream_fd(fd, buf_size);
+	if (!os) {
+		close(fd);
+		return (NULL);
+	}
+	os->owns_fd = true;
+	return (os);
+}
+
+struct out_stream *out_stream_append(const char *path, size_t buf_size)
+// Returns a stream adding to path, creating it if need be. A record
+// written to a file that is not empty is separated from what is there.
+{
+	int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) {
+		return (NULL);
+	}
+	off_t size = lseek(fd, 0, SEEK_END);
+	struct out_stream *os = out_stream_fd(fd, buf_size);
+	if (!os) {
+		close(fd);
+		return (NULL);
+	}
+	os->owns_fd = true;
+	os->separate = size > 0;
+	return (os);
+}
+
+struct out_stream *out_stream_fd(int fd, size_t buf_size)
+// Returns a stream that double-buffers output to fd. A dedicated
+// writer thread drains one buffer while the caller fills the other.
+{
+	struct out_stream *os = calloc(1, sizeof(*os));
+	if (!os) {
+		return (NULL);
+	}
+	if (buf_size == 0) {
+		buf_size = OUT_STREAM_DEFAULT_BUF_SIZE;
+	}
+	os->fd = fd;
+	os->buf_size = buf_size;
+	os->active = malloc(buf_size);
+	os->spare = malloc(buf_size);
+	if (!os->active || !os->spare) {
+		free(os->active);
+		free(os->spare);
+		free(os);
+		return (NULL);
+	}
+	pthread_mutex_init(&os->lock, NULL);
+	pthread_cond_init(&os->cond, NULL);
+	if (pthread_create(&os->thread, NULL, writer_thread, os) != 0) {
+		pthread_mutex_destroy(&os->lock);
+		pthread_cond_destroy(&os->cond);
+		free(os->active);
+		free(os->spare);
+		free(os);
+		return (NULL);
+	}
+	return (os);
+}
+
+int out_stream_write(struct out_stream *os, const void *data, size_t len)
+// Appends len bytes of data to the stream. Returns 0 on success.
+{
+	const char *in = data;
+
+	while (len > 0) {
+		size_t room = os->buf_size - os->active_len;
+		if (room == 0) {
+			if (hand_off(os) != 0) {
+				return (-1);
+			}
+			continue;
+		}
+		size_t chunk = len < room ? len : room;
+		memcpy(os->active + os->active_len, in, chunk);
+		os->active_len += chunk;
+		in += chunk;
+		len -= chunk;
+	}
+	return (0);
+}
+
+void *out_stream_reserve(struct out_stream *os, size_t len)
+// Returns room for len contiguous bytes at the end of the buffer, for
+// the caller to fill in place and then pass to out_stream_commit(). The
+// buffer is handed off first if len would not fit. Returns NULL if len
+// is larger than the whole buffer or a write has failed.
+{
+	if (len > os->buf_size) {
+		return (NULL);
+	}
+	if (os->buf_size - os->active_len < len && hand_off(os) != 0) {
+		return (NULL);
+	}
+	return (os->active + os->active_len);
+}
+
+void out_stream_commit(struct out_stream *os, size_t len)
+// Appends the first len bytes of the space from out_stream_reserve().
+{
+	os->active_len += len;
+}
+
+int out_stream_printf(struct out_stream *os, const char *format, ...)
+// Formats directly into the stream's buffer, handing the buffer off
+// first if the output would not fit. Returns the number of bytes
+// written or -1 on error.
+{
+	va_list args;
+
+	for (;;) {
+		size_t room = os->buf_size - os->active_len;
+		va_start(args, format);
+		int len = vsnprintf(os->active + os->active_len, room, format,
+				    args);
+		va_end(args);
+		if (len < 0) {
+			return (-1);
+		}
+		if ((size_t)len < room) {
+			os->active_len += len;
+			return (len);
+		}
+		if (os->active_len == 0) {
+			// Case: A single line larger than the whole buffer
+			char *tmp = malloc(len + 1);
+			if (!tmp) {
+				return (-1);
+			}
+			va_start(args, format);
+			vsnprintf(tmp, len + 1, format, args);
+			va_end(args);
+			int ret = out_stream_write(os, tmp, len);
+			free(tmp);
+			return (ret == 0 ? len : -1);
+		}
+		if (hand_off(os) != 0) {
+			return (-1);
+		}
+	}
+}
+
+int out_stream_puts(struct out_stream *os, const char *str)
+// Writes str followed by a newline, like puts().
+{
+	if (out_stream_write(os, str, strlen(str)) != 0) {
+		return (-1);
+	}
+	return (out_stream_write(os, "\n", 1));
+}
+
+void out_stream_separate(struct out_stream *os)
+// Writes the blank line that separates records, except before the
+// first record written to this stream.
+{
+	if (os->separate) {
+		out_stream_write(os, "\n", 1);
+	}
+	os->separate = true;
+}
+
+int out_stream_flush(struct out_stream *os)
+// Hands off any buffered output and waits until it has been written.
+{
+	if (os->active_len > 0 && hand_off(os) != 0) {
+		return (-1);
+	}
+	pthread_mutex_lock(&os->lock);
+	while (os->pending) {
+		pthread_cond_wait(&os->cond, &os->lock);
+	}
+	int error = os->error;
+	pthread_mutex_unlock(&os->lock);
+	return (error ? -1 : 0);
+}
+
+int out_stream_close(struct out_stream *os)
+// Flushes and releases the stream. Returns nonzero if any write failed.
+{
+	if (!os) {
+		return (0);
+	}
+	int ret = out_stream_flush(os);
+	pthread_mutex_lock(&os->lock);
+	os->stop = true;
+	pthread_cond_broadcast(&os->cond);
+	pthread_mutex_unlock(&os->lock);
+	pthread_join(os->thread, NULL);
+	if (os->owns_fd && close(os->fd) != 0) {
+		ret = -1;
+	}
+	pthread_mutex_destroy(&os->lock);
+	pthread_cond_destroy(&os->cond);
+	free(os->active);
+	free(os->spare);
+	free(os);
+	return (ret);
+}
+
+static int hand_off(struct out_stream *os)
+// Passes the filled buffer to the writer thread and takes the spare,
+// waiting only if the writer has not finished the previous buffer.
+{
+	pthread_mutex_lock(&os->lock);
+	while (os->pending) {
+		pthread_cond_wait(&os->cond, &os->lock);
+	}
+	if (os->error) {
+		pthread_mutex_unlock(&os->lock);
+		return (-1);
+	}
+	os->pending = os->active;
+	os->pending_len = os->active_len;
+	os->active = os->spare;
+	os->active_len = 0;
+	os->spare = NULL;
+	pthread_cond_broadcast(&os->cond);
+	pthread_mutex_unlock(&os->lock);
+	return (0);
+}
+
+static void *writer_thread(void *arg)
+{
+	struct out_stream *os = arg;
+
+	pthread_mutex_lock(&os->lock);
+	for (;;) {
+		while (!os->pending && !os->stop) {
+			pthread_cond_wait(&os->cond, &os->lock);
+		}
+		if (!os->pending) {
+			break;
+		}
+		char *buf = os->pending;
+		size_t len = os->pending_len;
+		pthread_mutex_unlock(&os->lock);
+
+		size_t written = 0;
+		int error = 0;
+		while (written < len) {
+			ssize_t ret = write(os->fd, buf + written, len - written);
+			if (ret < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				error = errno;
+				break;
+			}
+			written += ret;
+		}
+
+		pthread_mutex_lock(&os->lock);
+		if (error) {
+			os->error = error;
+		}
+		os->spare = buf;
+		os->pending = NULL;
+		pthread_cond_broadcast(&os->cond);
+	}
+	pthread_mutex_unlock(&os->lock);
+	return (NULL);
+}
@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+enum out_stream_defaults {
+	OUT_STREAM_DEFAULT_BUF_SIZE = 1 << 20
+};
+
+struct out_stream;
+
+struct out_stream *out_stream_open(const char *path, size_t buf_size);
+
+struct out_stream *out_stream_append(const char *path, size_t buf_size);
+
+struct out_stream *out_stream_fd(int fd, size_t buf_size);
+
+int out_stream_write(struct out_stream *os, const void *data, size_t len);
+
+void *out_stream_reserve(struct out_stream *os, size_t len);
+
+void out_stream_commit(struct out_stream *os, size_t len);
+
+int out_stream_printf(struct out_stream *os, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+int out_stream_puts(struct out_stream *os, const char *str);
+
+void out_stream_separate(struct out_stream *os);
+
+int out_stream_flush(struct out_stream *os);
+
+int out_stream_close(struct out_stream *os);
@@ -0,0 +1,720 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "readahead.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+enum slot_states {
+	SLOT_FREE = 0,
+	SLOT_PENDING = 1,
+	SLOT_READY = 2
+};
+
+struct ra_slot {
+	char *data;
+	size_t len;		// Bytes of data that are valid
+	size_t want;		// Bytes requested from the file
+	long offset;		// File offset of data[0]
+	int state;
+	struct iovec iov;
+};
+
+#ifdef HAVE_IO_URING
+struct ra_uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	unsigned int in_flight;
+};
+#endif
+
+struct readahead {
+	int fd;
+	enum readahead_backend backend;
+	size_t depth;
+	size_t buf_size;
+	long file_size;
+	const char *map;	// Whole file when using READAHEAD_MMAP
+	struct ra_slot *slots;
+	size_t head;		// Slot the parser is currently reading from
+	long head_offset;	// File offset of the head slot's first byte
+	size_t pos;		// Read position within the head slot
+	size_t tail;		// Next slot to be queued for reading
+	long next_offset;	// File offset the next queued slot will read
+	bool queue_eof;		// Set once a queued read reached EOF
+
+	// Reader thread fallback
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool thread_started;
+	bool stop;
+	bool restarting;
+
+#ifdef HAVE_IO_URING
+	struct ra_uring ring;
+#endif
+};
+
+static void *reader_thread(void *arg);
+static int thread_start(struct readahead *ra);
+static void thread_restart(struct readahead *ra, long base);
+static int wait_head(struct readahead *ra);
+static void release_head(struct readahead *ra);
+static int restart_at(struct readahead *ra, long base);
+
+#ifdef HAVE_IO_URING
+static int uring_setup(struct readahead *ra);
+static void uring_teardown(struct readahead *ra);
+static void uring_queue(struct readahead *ra, size_t index);
+static int uring_submit(struct readahead *ra);
+static int uring_reap(struct readahead *ra, bool wait);
+#endif
+
+struct readahead *readahead_open(const char *path, size_t depth,
+				 size_t buf_size,
+				 enum readahead_backend backend)
+// Opens path for sequential reading with depth buffers of buf_size
+// bytes each kept in flight ahead of the parser. Returns NULL and
+// leaves errno set if the file or the buffers could not be set up.
+{
+	if (depth < 2) {
+		depth = 2;
+	}
+	if (buf_size < READAHEAD_ALIGNMENT) {
+		buf_size = READAHEAD_ALIGNMENT;
+	}
+	// Round up so every queued read starts on an aligned offset
+	buf_size = (buf_size + READAHEAD_ALIGNMENT - 1) &
+	    ~((size_t)READAHEAD_ALIGNMENT - 1);
+
+	struct readahead *ra = calloc(1, sizeof(*ra));
+	if (!ra) {
+		return (NULL);
+	}
+	ra->fd = open(path, O_RDONLY);
+	if (ra->fd < 0) {
+		free(ra);
+		return (NULL);
+	}
+	struct stat st;
+	if (fstat(ra->fd, &st) != 0) {
+		close(ra->fd);
+		free(ra);
+		return (NULL);
+	}
+	ra->file_size = st.st_size;
+	if (backend == READAHEAD_MMAP) {
+		// Case: Map the capture and let page faults do the reading;
+		// bytes that are skipped over are never touched
+		ra->backend = READAHEAD_MMAP;
+		if (ra->file_size > 0) {
+			void *map = mmap(NULL, ra->file_size, PROT_READ,
+					 MAP_PRIVATE, ra->fd, 0);
+			if (map == MAP_FAILED) {
+				close(ra->fd);
+				free(ra);
+				return (NULL);
+			}
+			ra->map = map;
+		}
+		pthread_mutex_init(&ra->lock, NULL);
+		pthread_cond_init(&ra->cond, NULL);
+		return (ra);
+	}
+	posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	ra->depth = depth;
+	ra->buf_size = buf_size;
+	ra->slots = calloc(depth, sizeof(*ra->slots));
+	if (!ra->slots) {
+		close(ra->fd);
+		free(ra);
+		return (NULL);
+	}
+	for (size_t i = 0; i < depth; ++i) {
+		void *data = NULL;
+		if (posix_memalign(&data, READAHEAD_ALIGNMENT, buf_size) != 0) {
+			readahead_close(ra);
+			errno = ENOMEM;
+			return (NULL);
+		}
+		ra->slots[i].data = data;
+	}
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+
+#ifdef HAVE_IO_URING
+	if (backend != READAHEAD_THREAD && uring_setup(ra) == 0) {
+		ra->backend = READAHEAD_URING;
+	}
+#endif
+	if (ra->backend != READAHEAD_URING) {
+		if (backend == READAHEAD_URING) {
+			// Case: io_uring explicitly requested but unavailable
+			readahead_close(ra);
+			errno = ENOSYS;
+			return (NULL);
+		}
+		ra->backend = READAHEAD_THREAD;
+	}
+	if (restart_at(ra, 0) != 0) {
+		readahead_close(ra);
+		return (NULL);
+	}
+	return (ra);
+}
+
+size_t readahead_read(struct readahead *ra, void *dst, size_t len)
+// Copies up to len bytes from the read-ahead buffers into dst.
+// Returns the number of bytes copied, which is only short at EOF or
+// on a read error.
+{
+	size_t copied = 0;
+	char *out = dst;
+
+	if (ra->backend == READAHEAD_MMAP) {
+		long avail = ra->file_size - ra->head_offset;
+		if (avail <= 0) {
+			return (0);
+		}
+		if (len > (size_t)avail) {
+			len = avail;
+		}
+		memcpy(dst, ra->map + ra->head_offset, len);
+		ra->head_offset += len;
+		return (len);
+	}
+	while (copied < len) {
+		if (wait_head(ra) != 0) {
+			break;
+		}
+		struct ra_slot *slot = &ra->slots[ra->head];
+		size_t avail = slot->len - ra->pos;
+		if (avail == 0) {
+			if (slot->len < ra->buf_size) {
+				// Case: EOF reached inside this buffer
+				break;
+			}
+			release_head(ra);
+			continue;
+		}
+		size_t chunk = len - copied;
+		if (chunk > avail) {
+			chunk = avail;
+		}
+		memcpy(out + copied, slot->data + ra->pos, chunk);
+		ra->pos += chunk;
+		copied += chunk;
+	}
+	return (copied);
+}
+
+long readahead_tell(const struct readahead *ra)
+// Returns the file offset of the next byte readahead_read will return.
+{
+	return (ra->head_offset + (long)ra->pos);
+}
+
+int readahead_seek(struct readahead *ra, long offset)
+// Moves the read position to offset. Forward seeks that land in a
+// buffer already queued are satisfied by recycling buffers; anything
+// else restarts the pipeline at the new position. Returns 0 on success.
+{
+	if (offset < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (ra->backend == READAHEAD_MMAP) {
+		ra->head_offset = offset;
+		return (0);
+	}
+	long queued_end = ra->head_offset + (long)(ra->depth * ra->buf_size);
+	if (offset >= ra->head_offset && offset < queued_end) {
+		while (offset >= ra->head_offset + (long)ra->buf_size) {
+			if (wait_head(ra) != 0) {
+				return (-1);
+			}
+			if (ra->slots[ra->head].len < ra->buf_size) {
+				// Case: Seek past EOF; clamp like a short read
+				ra->pos = ra->slots[ra->head].len;
+				return (0);
+			}
+			release_head(ra);
+		}
+		if (wait_head(ra) != 0) {
+			return (-1);
+		}
+		size_t want = offset - ra->head_offset;
+		struct ra_slot *slot = &ra->slots[ra->head];
+		ra->pos = want > slot->len ? slot->len : want;
+		return (0);
+	}
+	long base = offset & ~((long)READAHEAD_ALIGNMENT - 1);
+	if (restart_at(ra, base) != 0) {
+		return (-1);
+	}
+	ra->pos = offset - base;
+	return (0);
+}
+
+const char *readahead_backend_name(const struct readahead *ra)
+{
+	switch (ra->backend) {
+	case READAHEAD_URING:
+		return ("io_uring");
+	case READAHEAD_THREAD:
+		return ("thread");
+	case READAHEAD_MMAP:
+		return ("mmap");
+	default:
+		return ("none");
+	}
+}
+
+void readahead_close(struct readahead *ra)
+// Stops any outstanding reads and releases the buffers.
+{
+	if (!ra) {
+		return;
+	}
+	if (ra->thread_started) {
+		pthread_mutex_lock(&ra->lock);
+		ra->stop = true;
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+		pthread_join(ra->thread, NULL);
+	}
+#ifdef HAVE_IO_URING
+	if (ra->backend == READAHEAD_URING) {
+		uring_teardown(ra);
+	}
+#endif
+	if (ra->map) {
+		munmap((void *)ra->map, ra->file_size);
+	}
+	if (ra->slots) {
+		for (size_t i = 0; i < ra->depth; ++i) {
+			free(ra->slots[i].data);
+		}
+		free(ra->slots);
+	}
+	pthread_mutex_destroy(&ra->lock);
+	pthread_cond_destroy(&ra->cond);
+	close(ra->fd);
+	free(ra);
+}
+
+static int restart_at(struct readahead *ra, long base)
+// Discards every queued buffer and queues the whole ring again
+// starting at the aligned file offset base.
+{
+	ra->head_offset = base;
+	ra->pos = 0;
+	if (ra->backend == READAHEAD_THREAD) {
+		if (ra->thread_started) {
+			thread_restart(ra, base);
+			return (0);
+		}
+		ra->next_offset = base;
+		return (thread_start(ra));
+	}
+#ifdef HAVE_IO_URING
+	while (ra->ring.in_flight > 0) {
+		// Case: Buffers still owned by the kernel; wait them out
+		if (uring_reap(ra, true) != 0) {
+			return (-1);
+		}
+	}
+	ra->head = 0;
+	ra->tail = 0;
+	ra->queue_eof = false;
+	ra->next_offset = base;
+	for (size_t i = 0; i < ra->depth; ++i) {
+		ra->slots[i].state = SLOT_FREE;
+		ra->slots[i].len = 0;
+	}
+	for (size_t i = 0; i < ra->depth; ++i) {
+		uring_queue(ra, i);
+	}
+	return (uring_submit(ra));
+#else
+	return (-1);
+#endif
+}
+
+static int wait_head(struct readahead *ra)
+// Blocks until the head buffer has finished reading.
+{
+	struct ra_slot *slot = &ra->slots[ra->head];
+	if (ra->backend == READAHEAD_THREAD) {
+		pthread_mutex_lock(&ra->lock);
+		while (slot->state != SLOT_READY) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+		}
+		pthread_mutex_unlock(&ra->lock);
+		return (0);
+	}
+#ifdef HAVE_IO_URING
+	while (slot->state == SLOT_PENDING) {
+		if (uring_reap(ra, true) != 0) {
+			return (-1);
+		}
+	}
+	if (slot->state == SLOT_FREE) {
+		// Case: Nothing queued past EOF; present an empty buffer
+		slot->len = 0;
+		slot->state = SLOT_READY;
+	}
+#endif
+	return (0);
+}
+
+static void release_head(struct readahead *ra)
+// Hands the head buffer back to the reader and advances to the next.
+{
+	struct ra_slot *slot = &ra->slots[ra->head];
+	size_t released = ra->head;
+
+	ra->head = (ra->head + 1) % ra->depth;
+	ra->head_offset += ra->buf_size;
+	ra->pos = 0;
+	if (ra->backend == READAHEAD_THREAD) {
+		pthread_mutex_lock(&ra->lock);
+		slot->state = SLOT_FREE;
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+		return;
+	}
+#ifdef HAVE_IO_URING
+	slot->state = SLOT_FREE;
+	uring_queue(ra, released);
+	uring_submit(ra);
+#endif
+}
+
+static int thread_start(struct readahead *ra)
+{
+	ra->stop = false;
+	if (pthread_create(&ra->thread, NULL, reader_thread, ra) != 0) {
+		return (-1);
+	}
+	ra->thread_started = true;
+	return (0);
+}
+
+static void thread_restart(struct readahead *ra, long base)
+// Parks the reader thread, resets the ring and lets it refill from base.
+{
+	pthread_mutex_lock(&ra->lock);
+	ra->restarting = true;
+	for (;;) {
+		bool pending = false;
+		for (size_t i = 0; i < ra->depth; ++i) {
+			if (ra->slots[i].state == SLOT_PENDING) {
+				pending = true;
+			}
+		}
+		if (!pending) {
+			break;
+		}
+		pthread_cond_wait(&ra->cond, &ra->lock);
+	}
+	for (size_t i = 0; i < ra->depth; ++i) {
+		ra->slots[i].state = SLOT_FREE;
+		ra->slots[i].len = 0;
+	}
+	ra->head = 0;
+	ra->tail = 0;
+	ra->next_offset = base;
+	ra->queue_eof = false;
+	ra->restarting = false;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+}
+
+static void *reader_thread(void *arg)
+// Keeps every free buffer filled with the next stretch of the file, in
+// ring order, so the parser only waits when it outruns the disk.
+{
+	struct readahead *ra = arg;
+
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		while (!ra->stop && (ra->restarting || ra->queue_eof ||
+				     ra->slots[ra->tail].state != SLOT_FREE)) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+		}
+		if (ra->stop) {
+			break;
+		}
+		struct ra_slot *slot = &ra->slots[ra->tail];
+		slot->state = SLOT_PENDING;
+		slot->offset = ra->next_offset;
+		ra->next_offset += ra->buf_size;
+		ra->tail = (ra->tail + 1) % ra->depth;
+		pthread_mutex_unlock(&ra->lock);
+
+		size_t filled = 0;
+		while (filled < ra->buf_size) {
+			ssize_t got = pread(ra->fd, slot->data + filled,
+					    ra->buf_size - filled,
+					    slot->offset + filled);
+			if (got < 0 && errno == EINTR) {
+				continue;
+			}
+			if (got <= 0) {
+				break;
+			}
+			filled += got;
+		}
+
+		pthread_mutex_lock(&ra->lock);
+		slot->len = filled;
+		slot->state = SLOT_READY;
+		if (filled < ra->buf_size) {
+			ra->queue_eof = true;
+		}
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->lock);
+	return (NULL);
+}
+
+#ifdef HAVE_IO_URING
+static int uring_setup(struct readahead *ra)
+// Creates an io_uring sized to the read-ahead depth and maps its rings.
+// Returns nonzero if the kernel refuses, in which case the caller
+// falls back to the reader thread.
+{
+	struct io_uring_params params;
+	struct ra_uring *ring = &ra->ring;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, (unsigned int)ra->depth,
+			   &params);
+	if (ring->fd < 0) {
+		return (-1);
+	}
+	ring->sq_ring_size = params.sq_off.array +
+	    params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes +
+	    params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size,
+			     PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		close(ring->fd);
+		return (-1);
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, ring->fd,
+				     IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			munmap(ring->sq_ring, ring->sq_ring_size);
+			close(ring->fd);
+			return (-1);
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_ring != ring->sq_ring) {
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		close(ring->fd);
+		return (-1);
+	}
+
+	char *sq = ring->sq_ring;
+	char *cq = ring->cq_ring;
+	ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	ring->in_flight = 0;
+	return (0);
+}
+
+static void uring_teardown(struct readahead *ra)
+{
+	struct ra_uring *ring = &ra->ring;
+
+	while (ring->in_flight > 0) {
+		if (uring_reap(ra, true) != 0) {
+			break;
+		}
+	}
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+static void uring_queue(struct readahead *ra, size_t index)
+// Places a read for slot index at the next file offset onto the
+// submission queue. Nothing is queued once the end of file is known.
+{
+	struct ra_uring *ring = &ra->ring;
+	struct ra_slot *slot = &ra->slots[index];
+
+	if (ra->queue_eof || ra->next_offset >= ra->file_size) {
+		ra->queue_eof = true;
+		return;
+	}
+	slot->offset = ra->next_offset;
+	slot->len = 0;
+	slot->want = ra->buf_size;
+	ra->next_offset += ra->buf_size;
+	slot->state = SLOT_PENDING;
+	slot->iov.iov_base = slot->data;
+	slot->iov.iov_len = slot->want;
+
+	unsigned int tail = *ring->sq_tail;
+	unsigned int sq_index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[sq_index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = ra->fd;
+	sqe->addr = (unsigned long)&slot->iov;
+	sqe->len = 1;
+	sqe->off = slot->offset;
+	sqe->user_data = index;
+	ring->sq_array[sq_index] = sq_index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++ring->in_flight;
+}
+
+static int uring_submit(struct readahead *ra)
+// Hands every queued submission to the kernel.
+{
+	struct ra_uring *ring = &ra->ring;
+	unsigned int to_submit = *ring->sq_tail -
+	    __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	while (to_submit > 0) {
+		int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, 0,
+				  0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (-1);
+		}
+		to_submit -= ret;
+	}
+	return (0);
+}
+
+static int uring_reap(struct readahead *ra, bool wait)
+// Collects completed reads and marks their slots ready. Short reads
+// before EOF are resubmitted for the remainder of the buffer.
+{
+	struct ra_uring *ring = &ra->ring;
+	unsigned int head = *ring->cq_head;
+
+	if (wait && head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		int ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+				  IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR) {
+			return (-1);
+		}
+	}
+	bool resubmit = false;
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		struct ra_slot *slot = &ra->slots[cqe->user_data];
+		int res = cqe->res;
+		++head;
+		--ring->in_flight;
+
+		if (res == -EINTR || res == -EAGAIN) {
+			res = 0;
+		} else if (res < 0) {
+			// Case: Read error; treat like EOF at this point
+			slot->state = SLOT_READY;
+			ra->queue_eof = true;
+			continue;
+		} else if (res == 0) {
+			// Case: File shrank underneath us
+			slot->want = slot->len;
+		}
+		slot->len += res;
+		if (slot->len < slot->want &&
+		    slot->offset + (long)slot->len < ra->file_size) {
+			// Case: Short read; ask for the rest of the buffer
+			unsigned int tail = *ring->sq_tail;
+			unsigned int sq_index = tail & *ring->sq_mask;
+			struct io_uring_sqe *sqe = &ring->sqes[sq_index];
+			slot->iov.iov_base = slot->data + slot->len;
+			slot->iov.iov_len = slot->want - slot->len;
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = ra->fd;
+			sqe->addr = (unsigned long)&slot->iov;
+			sqe->len = 1;
+			sqe->off = slot->offset + slot->len;
+			sqe->user_data = cqe->user_data;
+			ring->sq_array[sq_index] = sq_index;
+			__atomic_store_n(ring->sq_tail, tail + 1,
+					 __ATOMIC_RELEASE);
+			++ring->in_flight;
+			resubmit = true;
+			continue;
+		}
+		slot->state = SLOT_READY;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	if (resubmit) {
+		return (uring_submit(ra));
+	}
+	return (0);
+}
+#endif
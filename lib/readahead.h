@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+enum readahead_defaults {
+	READAHEAD_DEFAULT_DEPTH = 4,
+	READAHEAD_DEFAULT_BUF_SIZE = 1 << 20,
+	READAHEAD_ALIGNMENT = 4096
+};
+
+enum readahead_backend {
+	READAHEAD_AUTO = 0,
+	READAHEAD_URING = 1,
+	READAHEAD_THREAD = 2,
+	READAHEAD_MMAP = 3
+};
+
+struct readahead;
+
+struct readahead *readahead_open(const char *path, size_t depth,
+				 size_t buf_size,
+				 enum readahead_backend backend);
+
+size_t readahead_read(struct readahead *ra, void *dst, size_t len);
+
+long readahead_tell(const struct readahead *ra);
+
+int readahead_seek(struct readahead *ra, long offset);
+
+const char *readahead_backend_name(const struct readahead *ra);
+
+void readahead_close(struct readahead *ra);
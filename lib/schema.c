@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <string.h>
+#include "shared_fields.h"
+#include "tokenizer.h"
+#include "schema.h"
+
+enum schema_buffers {
+	FIELD_TEXT_MAX = 128	// Longest formatted non-string field
+};
+
+static const char *const zerg_type_names[] = {
+	"Overmind", "Larva", "Cerebrate", "Overlord", "Queen", "Drone",
+	"Zergling", "Lurker", "Broodling", "Hydralisk", "Guardian", "Scourge",
+	"Ultralisk", "Mutalisk", "Defiler", "Devourer"
+};
+
+static const char *const command_names[] = {
+	"GET_STATUS", "GOTO", "GET_GPS", NULL, "RETURN", "SET_GROUP", "STOP",
+	"REPEAT"
+};
+
+static const char *const action_names[] = { "Remove from", "Add to" };
+static const char *const latitude_names[] = { "N", "S" };
+static const char *const longitude_names[] = { "E", "W" };
+
+struct keyword_table zerg_types = { zerg_type_names, 16, false, 0, {0} };
+static struct keyword_table commands = { command_names, 8, false, 0, {0} };
+static struct keyword_table actions = { action_names, 2, false, 0, {0} };
+static struct keyword_table latitudes = { latitude_names, 2, false, 0, {0} };
+static struct keyword_table longitudes = { longitude_names, 2, false, 0, {0} };
+
+static const struct field message_fields[] = {
+	{"Message", FIELD_STRING, offsetof(struct zerg_message, message), 0,
+	 NULL, NULL}
+};
+
+// The 24-bit and 8-bit status fields are bitfields, so their offsets
+// are spelled out rather than taken with offsetof().
+static const struct field status_fields[] = {
+	{"Max Hit Points", FIELD_UINT, 4, 3, NULL, NULL},
+	{"Current Hit Points", FIELD_INT, 0, 3, NULL, NULL},
+	{"Armor", FIELD_UINT, 3, 1, NULL, NULL},
+	{"Type", FIELD_ENUM, 7, 1, NULL, &zerg_types},
+	{"Max Speed", FIELD_FLOAT, 8, 4, "m/s", NULL},
+	{"Name", FIELD_STRING, offsetof(struct zerg_status, name), 0, NULL,
+	 NULL}
+};
+
+static const struct field command_fields[] = {
+	{"Command", FIELD_ENUM, 0, 2, NULL, &commands}
+};
+
+static const struct field goto_fields[] = {
+	{"Bearing", FIELD_FLOAT, 4, 4, "degrees", NULL},
+	{"Distance", FIELD_UINT, 2, 2, "m", NULL}
+};
+
+// Action has always been written in host order, so only its
+// zero-ness is significant.
+static const struct field set_group_fields[] = {
+	{"Action", FIELD_FLAG, 2, 2, NULL, &actions},
+	{"Group", FIELD_INT, 4, 4, NULL, NULL}
+};
+
+static const struct field repeat_fields[] = {
+	{"Sequence", FIELD_UINT, 4, 4, NULL, NULL}
+};
+
+static const struct schema command_variants[] = {
+	{"GET_STATUS", NULL, 0, 2, NULL, 0},
+	{"GOTO", goto_fields, 2, 8, NULL, 0},
+	{"GET_GPS", NULL, 0, 2, NULL, 0},
+	{NULL, NULL, 0, 2, NULL, 0},
+	{"RETURN", NULL, 0, 2, NULL, 0},
+	{"SET_GROUP", set_group_fields, 2, 8, NULL, 0},
+	{"STOP", NULL, 0, 2, NULL, 0},
+	{"REPEAT", repeat_fields, 1, 8, NULL, 0}
+};
+
+static const struct field gps_fields[] = {
+	{"Latitude", FIELD_COORD, 8, 8, NULL, &latitudes},
+	{"Longitude", FIELD_COORD, 0, 8, NULL, &longitudes},
+	{"Altitude", FIELD_FLOAT_FIXED, 16, 4, "fathoms", NULL},
+	{"Bearing", FIELD_FLOAT_FIXED, 20, 4, "degrees", NULL},
+	{"Speed", FIELD_FLOAT_FIXED, 24, 4, "m/s", NULL},
+	{"Accuracy", FIELD_FLOAT, 28, 4, "m", NULL}
+};
+
+const struct schema payload_schemas[PAYLOAD_TYPES] = {
+	{"Message", message_fields, 1, 0, NULL, 0},
+	{"Status", status_fields, 6, 12, NULL, 0},
+	{"Command", command_fields, 1, 2, command_variants, 8},
+	{"GPS", gps_fields, 6, 32, NULL, 0}
+};
+
+static const char *leading_keys[PAYLOAD_TYPES];
+static struct keyword_table leading = {
+	leading_keys, PAYLOAD_TYPES, false, 0, {0}
+};
+
+static uint32_t keyword_hash(const char *text, size_t len, uint32_t seed);
+static void keyword_build(struct keyword_table *table);
+static uint32_t read_uint(const unsigned char *bytes, size_t width);
+static void write_uint(unsigned char *bytes, size_t width, uint32_t value);
+static int print_field(const struct field *field, const void *payload,
+		       schema_writer write, void *context);
+static bool parse_number(const struct field *field, struct span value,
+			 unsigned char *bytes, FILE * report);
+static bool parse_coord(const struct field *field, struct span value,
+			unsigned char *bytes, FILE * report);
+
+int keyword_lookup(struct keyword_table *table, const char *text,
+		   size_t len)
+// Returns the value named by text, or -1. The table is given a perfect
+// hash on first use, so a lookup is one hash and one comparison.
+{
+	if (!table->built) {
+		keyword_build(table);
+	}
+	uint32_t slot = keyword_hash(text, len, table->seed) &
+	    (KEYWORD_SLOTS - 1);
+	if (!table->slots[slot]) {
+		return (-1);
+	}
+	int value = table->slots[slot] - 1;
+	const char *name = table->names[value];
+	if (strlen(name) != len || memcmp(name, text, len) != 0) {
+		return (-1);
+	}
+	return (value);
+}
+
+const char *keyword_name(const struct keyword_table *table, uint32_t value)
+// Returns the name of value, or NULL if it has none.
+{
+	if (value >= table->count) {
+		return (NULL);
+	}
+	return (table->names[value]);
+}
+
+int schema_find(const struct span *key)
+// Returns the payload type whose first field is key, or -1.
+{
+	if (!leading.built) {
+		for (size_t i = 0; i < PAYLOAD_TYPES; ++i) {
+			leading_keys[i] = payload_schemas[i].fields[0].key;
+		}
+	}
+	return (keyword_lookup(&leading, key->start, key->len));
+}
+
+void schema_prepare(void)
+// Builds every keyword table up front. Lookups only read a built table,
+// so after this they are safe to make from several threads at once.
+{
+	struct keyword_table *tables[] = {
+		&zerg_types, &commands, &actions, &latitudes, &longitudes
+	};
+	for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); ++i) {
+		if (!tables[i]->built) {
+			keyword_build(tables[i]);
+		}
+	}
+	struct span key = { "", 0 };
+	schema_find(&key);
+}
+
+const struct schema *schema_variant(const struct schema *schema,
+				    const void *payload)
+// Returns the variant selected by the first field of payload, or NULL
+// if schema has no variants or the value names none.
+{
+	if (!schema->variants) {
+		return (NULL);
+	}
+	const struct field *field = &schema->fields[0];
+	uint32_t value =
+	    read_uint((const unsigned char *)payload + field->offset,
+		      field->width);
+	if (value >= schema->variant_count) {
+		return (NULL);
+	}
+	return (&schema->variants[value]);
+}
+
+int schema_print(const struct schema *schema, const void *payload,
+		 schema_writer write, void *context)
+// Writes each field of payload as a "Key: value" line, followed by the
+// fields of its variant. Returns the first nonzero result of write.
+{
+	for (size_t i = 0; i < schema->count; ++i) {
+		int result = print_field(&schema->fields[i], payload, write,
+					 context);
+		if (result != 0) {
+			return (result);
+		}
+	}
+	const struct schema *variant = schema_variant(schema, payload);
+	if (variant) {
+		return (schema_print(variant, payload, write, context));
+	}
+	return (0);
+}
+
+bool field_parse(const struct field *field, const struct span *value,
+		 void *payload, FILE * report)
+// Stores value, the text after "Key:", into payload in wire order.
+// Numbers are taken from the first word, so any units are ignored.
+// Problems are written to report. String fields are left to the
+// caller, which knows how long their storage must live.
+{
+	unsigned char *bytes = (unsigned char *)payload + field->offset;
+	struct span rest = *value;
+	struct span word;
+	int found;
+
+	switch (field->kind) {
+	case FIELD_ENUM:
+		if (!span_token(&rest, " \n", &word)) {
+			fprintf(report, "Missing %s\n", field->key);
+			return (false);
+		}
+		found = keyword_lookup(field->names, word.start, word.len);
+		if (found < 0) {
+			fprintf(report, "Expected %s; received \"%.*s\"\n",
+				field->key, (int)word.len, word.start);
+			return (false);
+		}
+		write_uint(bytes, field->width, found);
+		return (true);
+	case FIELD_FLAG:
+		if (rest.len > 0 && rest.start[0] == ' ') {
+			// Remove leading space if present
+			++rest.start;
+			--rest.len;
+		}
+		found = keyword_lookup(field->names, rest.start, rest.len);
+		if (found < 0) {
+			fprintf(report, "Expected %s; received \"%.*s\"\n",
+				field->key, (int)rest.len, rest.start);
+			return (false);
+		}
+		memset(bytes, 0, field->width);
+		bytes[0] = found;
+		return (true);
+	case FIELD_COORD:
+		return (parse_coord(field, rest, bytes, report));
+	case FIELD_STRING:
+		return (true);
+	default:
+		return (parse_number(field, rest, bytes, report));
+	}
+}
+
+const struct field *schema_field(const struct schema *schema,
+				 const char *key)
+// Returns the field of schema named key, or NULL.
+{
+	for (size_t i = 0; i < schema->count; ++i) {
+		if (strcmp(schema->fields[i].key, key) == 0) {
+			return (&schema->fields[i]);
+		}
+	}
+	return (NULL);
+}
+
+void field_store(const struct field *field, double value, void *payload)
+// Stores a number into payload in wire order, as field_parse() would
+// have stored its text. Enums and flags take the value they name.
+{
+	unsigned char *bytes = (unsigned char *)payload + field->offset;
+	float number;
+	uint32_t bits;
+
+	switch (field->kind) {
+	case FIELD_FLOAT:
+	case FIELD_FLOAT_FIXED:
+		number = value;
+		memcpy(&bits, &number, sizeof(bits));
+		write_uint(bytes, field->width, bits);
+		break;
+	case FIELD_FLAG:
+		memset(bytes, 0, field->width);
+		bytes[0] = (long)value != 0;
+		break;
+	case FIELD_COORD:
+		{
+			uint64_t raw;
+			memcpy(&raw, &value, sizeof(raw));
+			for (size_t i = field->width; i-- > 0;) {
+				bytes[i] = raw & 0xFF;
+				raw >>= 8;
+			}
+			break;
+		}
+	case FIELD_STRING:
+		break;
+	default:
+		write_uint(bytes, field->width, (uint32_t)(long)value);
+		break;
+	}
+}
+
+static uint32_t keyword_hash(const char *text, size_t len, uint32_t seed)
+// FNV-1a, perturbed by seed.
+{
+	uint32_t hash = 2166136261U ^ seed;
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ (unsigned char)text[i]) * 16777619U;
+	}
+	return (hash ^ (hash >> 15));
+}
+
+static void keyword_build(struct keyword_table *table)
+// Searches for a seed under which no two names share a slot.
+{
+	for (uint32_t seed = 0;; ++seed) {
+		bool collided = false;
+		memset(table->slots, 0, sizeof(table->slots));
+		for (size_t i = 0; i < table->count && !collided; ++i) {
+			const char *name = table->names[i];
+			if (!name) {
+				continue;
+			}
+			uint32_t slot = keyword_hash(name, strlen(name), seed) &
+			    (KEYWORD_SLOTS - 1);
+			if (table->slots[slot]) {
+				collided = true;
+			} else {
+				table->slots[slot] = i + 1;
+			}
+		}
+		if (!collided) {
+			table->seed = seed;
+			table->built = true;
+			return;
+		}
+	}
+}
+
+static uint32_t read_uint(const unsigned char *bytes, size_t width)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < width; ++i) {
+		value = value << 8 | bytes[i];
+	}
+	return (value);
+}
+
+static void write_uint(unsigned char *bytes, size_t width, uint32_t value)
+{
+	for (size_t i = width; i-- > 0;) {
+		bytes[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+static int print_field(const struct field *field, const void *payload,
+		       schema_writer write, void *context)
+{
+	const unsigned char *bytes =
+	    (const unsigned char *)payload + field->offset;
+	char text[FIELD_TEXT_MAX];
+	int len = snprintf(text, sizeof(text), "%s: ", field->key);
+	uint32_t bits = 0;
+	float number;
+
+	if (field->kind != FIELD_STRING && field->kind != FIELD_COORD) {
+		bits = read_uint(bytes, field->width);
+	}
+	switch (field->kind) {
+	case FIELD_UINT:
+		len += snprintf(text + len, sizeof(text) - len, "%u", bits);
+		break;
+	case FIELD_INT:
+		if (field->width < 4 && bits >> (field->width * 8 - 1)) {
+			// Sign-extend
+			bits |= UINT32_MAX << (field->width * 8);
+		}
+		len += snprintf(text + len, sizeof(text) - len, "%d",
+				(int32_t)bits);
+		break;
+	case FIELD_FLOAT:
+	case FIELD_FLOAT_FIXED:
+		memcpy(&number, &bits, sizeof(number));
+		len += snprintf(text + len, sizeof(text) - len,
+				field->kind == FIELD_FLOAT ? "%g" : "%f",
+				number);
+		break;
+	case FIELD_ENUM:
+		if (keyword_name(field->names, bits)) {
+			len += snprintf(text + len, sizeof(text) - len, "%s",
+					keyword_name(field->names, bits));
+		} else {
+			len += snprintf(text + len, sizeof(text) - len, "%u",
+					bits);
+		}
+		break;
+	case FIELD_FLAG:
+		bits = 0;
+		for (size_t i = 0; i < field->width; ++i) {
+			bits |= bytes[i];
+		}
+		len += snprintf(text + len, sizeof(text) - len, "%s",
+				field->names->names[bits != 0]);
+		break;
+	case FIELD_COORD:
+		{
+			uint64_t raw = 0;
+			for (size_t i = 0; i < field->width; ++i) {
+				raw = raw << 8 | bytes[i];
+			}
+			double coordinate;
+			double degrees;
+			double minutes;
+			double seconds;
+			memcpy(&coordinate, &raw, sizeof(coordinate));
+			format_gps_output(coordinate, &degrees, &minutes,
+					  &seconds);
+			len += snprintf(text + len, sizeof(text) - len,
+					"%g° %g' %g\" %s", degrees, minutes,
+					seconds,
+					field->names->names[!(coordinate >= 0)]);
+			break;
+		}
+	case FIELD_STRING:
+		{
+			const char *string;
+			memcpy(&string, bytes, sizeof(string));
+			int result = write(context, text, len);
+			if (result == 0) {
+				result = write(context, string, strlen(string));
+			}
+			if (result == 0) {
+				result = write(context, "\n", 1);
+			}
+			return (result);
+		}
+	}
+	if (field->units) {
+		len += snprintf(text + len, sizeof(text) - len, " %s",
+				field->units);
+	}
+	len += snprintf(text + len, sizeof(text) - len, "\n");
+	return (write(context, text, len));
+}
+
+static bool parse_number(const struct field *field, struct span value,
+			 unsigned char *bytes, FILE * report)
+{
+	struct span word;
+	long integer;
+	float number;
+	uint32_t bits;
+
+	if (!span_token(&value, " \n", &word)) {
+		fprintf(report, "Missing %s value\n", field->key);
+		return (false);
+	}
+	if (field->kind == FIELD_FLOAT || field->kind == FIELD_FLOAT_FIXED) {
+		if (!span_float(word, &number)) {
+			fprintf(report,
+				"Expected %s value; received \"%.*s\"\n",
+				field->key, (int)word.len, word.start);
+			return (false);
+		}
+		memcpy(&bits, &number, sizeof(bits));
+	} else {
+		if (!span_long(word, &integer)) {
+			fprintf(report,
+				"Expected %s value; received \"%.*s\"\n",
+				field->key, (int)word.len, word.start);
+			return (false);
+		}
+		if (field->width < 4) {
+			// Narrow fields would silently lose the high bits
+			long min = 0;
+			long max = (1L << (field->width * 8)) - 1;
+			if (field->kind == FIELD_INT) {
+				min = -(1L << (field->width * 8 - 1));
+				max = -min - 1;
+			}
+			if (integer < min || integer > max) {
+				fprintf(report,
+					"%s value %ld is outside %ld to %ld\n",
+					field->key, integer, min, max);
+				return (false);
+			}
+		}
+		bits = integer;
+	}
+	write_uint(bytes, field->width, bits);
+	return (true);
+}
+
+static bool parse_coord(const struct field *field, struct span value,
+			unsigned char *bytes, FILE * report)
+// Parses D° M' S" H. An unknown hemisphere is reported but leaves the
+// bare degrees in place.
+{
+	struct span word;
+	double degrees;
+	double minutes;
+	double seconds;
+
+	if (!span_token(&value, " \n", &word)) {
+		fprintf(report, "Missing %s degrees value\n", field->key);
+		return (false);
+	}
+	degrees = span_double_prefix(word);
+	if (!span_token(&value, " \n'", &word)) {
+		fprintf(report, "Missing %s minutes value\n", field->key);
+		return (false);
+	}
+	if (!span_double(word, &minutes)) {
+		fprintf(report,
+			"Expected %s minutes value; received \"%.*s\"\n",
+			field->key, (int)word.len, word.start);
+		return (false);
+	}
+	if (!span_token(&value, " \n\"", &word)) {
+		fprintf(report, "Missing %s seconds value\n", field->key);
+		return (false);
+	}
+	if (!span_double(word, &seconds)) {
+		fprintf(report,
+			"Expected %s seconds value; received \"%.*s\"\n",
+			field->key, (int)word.len, word.start);
+		return (false);
+	}
+	const char *positive = field->names->names[0];
+	const char *negative = field->names->names[1];
+	if (!span_token(&value, " \n\"-", &word)) {
+		fprintf(report, "Missing %s or %s\n", positive, negative);
+		return (false);
+	}
+	int hemisphere = keyword_lookup(field->names, word.start, word.len);
+	if (hemisphere == 0) {
+		degrees = (degrees + (minutes / 60) + (seconds / 3600));
+	} else if (hemisphere == 1) {
+		degrees =
+		    (((-1) * degrees) + ((-1) * minutes / 60) +
+		     ((-1) * seconds / 3600));
+	} else {
+		fprintf(report, "Expected %s or %s; received \"%.*s\"\n",
+			positive, negative, (int)word.len, word.start);
+	}
+
+	uint64_t raw;
+	memcpy(&raw, &degrees, sizeof(raw));
+	for (size_t i = field->width; i-- > 0;) {
+		bytes[i] = raw & 0xFF;
+		raw >>= 8;
+	}
+	return (true);
+}
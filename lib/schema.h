@@ -0,0 +1,76 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum schema_limits {
+	KEYWORD_SLOTS = 64,	// Power of two, well above any table's size
+	PAYLOAD_TYPES = 4
+};
+
+enum field_kind {
+	FIELD_UINT,		// Big-endian unsigned integer, printed %u
+	FIELD_INT,		// Big-endian signed integer, printed %d
+	FIELD_FLOAT,		// Big-endian float, printed %g
+	FIELD_FLOAT_FIXED,	// Big-endian float, printed %f
+	FIELD_ENUM,		// Big-endian unsigned integer named by names
+	FIELD_FLAG,		// names[0] if every byte is zero, else names[1]
+	FIELD_COORD,		// Big-endian double printed as D° M' S" names
+	FIELD_STRING		// char * to the text that ends the payload
+};
+
+struct keyword_table {
+	const char *const *names;	// Indexed by value; NULL for gaps
+	size_t count;
+	bool built;
+	uint32_t seed;		// Makes the hash collision-free over names
+	uint8_t slots[KEYWORD_SLOTS];	// Value + 1, or 0 when empty
+};
+
+struct field {
+	const char *key;
+	enum field_kind kind;
+	uint8_t offset;		// Offset in the payload struct
+	uint8_t width;		// Bytes on the wire
+	const char *units;	// Printed after the value, or NULL
+	struct keyword_table *names;
+};
+
+struct schema {
+	const char *title;
+	const struct field *fields;
+	size_t count;
+	size_t length;		// Wire bytes before any trailing string
+	const struct schema *variants;	// Chosen by the first field's value
+	size_t variant_count;
+};
+
+struct span;
+
+typedef int (*schema_writer)(void *context, const void *data, size_t len);
+
+extern const struct schema payload_schemas[PAYLOAD_TYPES];
+extern struct keyword_table zerg_types;
+
+int keyword_lookup(struct keyword_table *table, const char *text,
+		   size_t len);
+
+const char *keyword_name(const struct keyword_table *table, uint32_t value);
+
+int schema_find(const struct span *key);
+
+void schema_prepare(void);
+
+const struct schema *schema_variant(const struct schema *schema,
+				    const void *payload);
+
+int schema_print(const struct schema *schema, const void *payload,
+		 schema_writer write, void *context);
+
+bool field_parse(const struct field *field, const struct span *value,
+		 void *payload, FILE * report);
+
+const struct field *schema_field(const struct schema *schema,
+				 const char *key);
+
+void field_store(const struct field *field, double value, void *payload);
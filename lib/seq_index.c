@@ -0,0 +1,219 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "seq_index.h"
+
+enum seq_index_limits {
+	NUM_SOURCES = 65536,
+	WINDOW_WORDS = SEQ_WINDOW_BITS / 64
+};
+
+struct seq_source {
+	uint32_t first;		// First sequence number seen
+	uint32_t highest;	// Highest sequence number seen so far
+	uint64_t window[WINDOW_WORDS];	// Bit per sequence in
+	// (highest - SEQ_WINDOW_BITS, highest], indexed by sequence
+	unsigned long long received;
+	unsigned long long missing;
+	unsigned long long duplicates;
+	unsigned long long reordered;
+	unsigned long long stale;	// Too far behind to classify
+};
+
+struct seq_index {
+	struct seq_record *records;	// Direct-mapped; newer entries
+	size_t mask;			// replace colliding older ones
+	struct seq_source *sources[NUM_SOURCES];
+	FILE *report;
+};
+
+static size_t slot_for(const struct seq_index *si, uint64_t key);
+static bool window_test(const struct seq_source *source, uint32_t sequence);
+static void window_set(struct seq_source *source, uint32_t sequence);
+static void window_clear(struct seq_source *source, uint32_t sequence);
+static void advance(struct seq_index *si, uint16_t src,
+		    struct seq_source *source, uint32_t sequence);
+static void report_missing(struct seq_index *si, uint16_t src,
+			   struct seq_source *source, uint32_t first,
+			   uint32_t last);
+
+struct seq_index *seq_index_create(size_t slots, FILE * report)
+// Creates an index with room for slots recent (source, sequence)
+// records, rounded up to a power of two. Anomalies are written to
+// report as they are found.
+{
+	size_t size = 1;
+	while (size < slots) {
+		size <<= 1;
+	}
+	struct seq_index *si = calloc(1, sizeof(*si));
+	if (!si) {
+		return (NULL);
+	}
+	si->records = calloc(size, sizeof(*si->records));
+	if (!si->records) {
+		free(si);
+		return (NULL);
+	}
+	si->mask = size - 1;
+	si->report = report;
+	return (si);
+}
+
+void seq_index_add(struct seq_index *si, uint16_t src, uint32_t sequence,
+		   unsigned int type, long packet)
+// Records a packet and checks it against the sliding window of
+// sequence numbers already seen from src.
+{
+	uint64_t key = (uint64_t)src << 32 | sequence;
+	struct seq_record *record = &si->records[slot_for(si, key)];
+	record->key = key;
+	record->packet = packet;
+	record->type = type;
+	record->valid = 1;
+
+	struct seq_source *source = si->sources[src];
+	if (!source) {
+		source = calloc(1, sizeof(*source));
+		if (!source) {
+			return;
+		}
+		si->sources[src] = source;
+		source->first = sequence;
+		source->highest = sequence;
+		source->received = 1;
+		window_set(source, sequence);
+		return;
+	}
+	++source->received;
+
+	// Serial number arithmetic so the 32-bit sequence may wrap
+	int32_t distance = (int32_t)(sequence - source->highest);
+	if (distance > 0) {
+		advance(si, src, source, sequence);
+		return;
+	}
+	if (-(int64_t)distance >= SEQ_WINDOW_BITS) {
+		++source->stale;
+		fprintf(si->report,
+			"Source %u: sequence %u arrived far out of order (packet #%ld)\n",
+			src, sequence, packet);
+		return;
+	}
+	if (window_test(source, sequence)) {
+		++source->duplicates;
+		fprintf(si->report,
+			"Source %u: duplicate sequence %u (packet #%ld)\n",
+			src, sequence, packet);
+		return;
+	}
+	++source->reordered;
+	if ((int32_t)(sequence - source->first) > 0) {
+		// Case: Fills a gap that was counted as missing. Sequences
+		// before the first never were, so first stays put.
+		--source->missing;
+	}
+	window_set(source, sequence);
+	fprintf(si->report,
+		"Source %u: sequence %u arrived out of order (packet #%ld)\n",
+		src, sequence, packet);
+}
+
+const struct seq_record *seq_index_find(const struct seq_index *si,
+					uint16_t src, uint32_t sequence)
+// Returns the most recent packet from src with the given sequence, or
+// NULL if it was never seen or has since been evicted.
+{
+	uint64_t key = (uint64_t)src << 32 | sequence;
+	const struct seq_record *record = &si->records[slot_for(si, key)];
+	if (!record->valid || record->key != key) {
+		return (NULL);
+	}
+	return (record);
+}
+
+void seq_index_report(struct seq_index *si)
+// Writes a per-source summary of sequence continuity.
+{
+	for (size_t src = 0; src < NUM_SOURCES; ++src) {
+		struct seq_source *source = si->sources[src];
+		if (!source) {
+			continue;
+		}
+		fprintf(si->report,
+			"Source %zu: %llu packets, %llu missing, %llu duplicate, %llu out of order\n",
+			src, source->received, source->missing,
+			source->duplicates, source->reordered + source->stale);
+	}
+}
+
+void seq_index_destroy(struct seq_index *si)
+{
+	if (!si) {
+		return;
+	}
+	for (size_t src = 0; src < NUM_SOURCES; ++src) {
+		free(si->sources[src]);
+	}
+	free(si->records);
+	free(si);
+}
+
+static size_t slot_for(const struct seq_index *si, uint64_t key)
+// Fibonacci hashing spreads consecutive sequence numbers and sources.
+{
+	return ((key * 0x9E3779B97F4A7C15ULL) >> 20 & si->mask);
+}
+
+static bool window_test(const struct seq_source *source, uint32_t sequence)
+{
+	size_t bit = sequence % SEQ_WINDOW_BITS;
+	return (source->window[bit / 64] >> (bit % 64) & 1);
+}
+
+static void window_set(struct seq_source *source, uint32_t sequence)
+{
+	size_t bit = sequence % SEQ_WINDOW_BITS;
+	source->window[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static void window_clear(struct seq_source *source, uint32_t sequence)
+{
+	size_t bit = sequence % SEQ_WINDOW_BITS;
+	source->window[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+static void advance(struct seq_index *si, uint16_t src,
+		    struct seq_source *source, uint32_t sequence)
+// Slides the window forward so sequence becomes the highest seen. The
+// skipped sequence numbers are counted as missing until they arrive.
+{
+	uint32_t distance = sequence - source->highest;
+	if (distance > 1) {
+		report_missing(si, src, source, source->highest + 1,
+			       sequence - 1);
+	}
+	if (distance >= SEQ_WINDOW_BITS) {
+		memset(source->window, 0, sizeof(source->window));
+	} else {
+		for (uint32_t s = source->highest + 1; s != sequence; ++s) {
+			window_clear(source, s);
+		}
+	}
+	source->highest = sequence;
+	window_set(source, sequence);
+}
+
+static void report_missing(struct seq_index *si, uint16_t src,
+			   struct seq_source *source, uint32_t first,
+			   uint32_t last)
+{
+	source->missing += last - first + 1;
+	if (first == last) {
+		fprintf(si->report, "Source %u: gap at sequence %u\n", src,
+			first);
+	} else {
+		fprintf(si->report, "Source %u: gap at sequences %u-%u\n",
+			src, first, last);
+	}
+}
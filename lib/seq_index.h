@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <stdio.h>
+
+enum seq_index_defaults {
+	SEQ_INDEX_DEFAULT_SLOTS = 1 << 20,
+	SEQ_WINDOW_BITS = 1024
+};
+
+struct seq_record {
+	uint64_t key;		// zerg_src << 32 | zerg_sequence
+	long packet;		// Packet number within the capture
+	unsigned int type;	// Zerg payload type
+	unsigned int valid:1;
+};
+
+struct seq_index;
+
+struct seq_index *seq_index_create(size_t slots, FILE * report);
+
+void seq_index_add(struct seq_index *si, uint16_t src, uint32_t sequence,
+		   unsigned int type, long packet);
+
+const struct seq_record *seq_index_find(const struct seq_index *si,
+					uint16_t src, uint32_t sequence);
+
+void seq_index_report(struct seq_index *si);
+
+void seq_index_destroy(struct seq_index *si);
@@ -1,3 +1,6 @@
+#include <math.h>
+#include <stdlib.h>
+
 int shift_24_bit_int(int num)
 // Reverses the byte order of a 24 bit integer. Returns the reversed
 // integer.
@@ -53,3 +56,48 @@ double reverse_double(const double num)
 
 	return (ret_val);
 }
+
+void format_gps_output(const double num, double *degrees, double *minutes,
+		       double *seconds)
+// Accepts a double and three placeholder values that will hold the 
+// converted values after turning the decimal representation of the
+// longitude/latitude field into degrees/minutes/seconds format.
+{
+	*degrees = floor(fabs(num));
+	*minutes = floor((fabs(num) - *degrees) * 60);
+	*seconds = ((fabs(num)) - *degrees - (*minutes / 60)) * 3600;
+	return;
+}
+
+int parse_size(const char *arg, size_t *size)
+// Parses a byte count with an optional K, M or G suffix into size.
+// Returns 1 on success and 0 if arg is not a valid size.
+{
+	char *err = NULL;
+	unsigned long long value = strtoull(arg, &err, 10);
+	if (err == arg) {
+		return (0);
+	}
+	switch (*err) {
+	case 'K':
+	case 'k':
+		value <<= 10;
+		++err;
+		break;
+	case 'M':
+	case 'm':
+		value <<= 20;
+		++err;
+		break;
+	case 'G':
+	case 'g':
+		value <<= 30;
+		++err;
+		break;
+	}
+	if (*err) {
+		return (0);
+	}
+	*size = value;
+	return (1);
+}
@@ -1,3 +1,5 @@
+#include <stddef.h>
+
 enum return_codes {
 	SUCCESS = 0,
 	INVOCATION_ERROR = 1,
@@ -96,3 +98,8 @@ double reverse_double(const double num);
 float reverse_float(const float num);
 
 int shift_24_bit_int(int num);
+
+void format_gps_output(const double num, double *degrees, double *minutes,
+		       double *seconds);
+
+int parse_size(const char *arg, size_t *size);
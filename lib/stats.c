@@ -0,0 +1,120 @@
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+static const char *const stage_names[NUM_STAGES] = {
+	"read", "headers", "load_message", "load_status", "load_command",
+	"load_gps", "print_message", "print_status", "print_command",
+	"print_gps", "flush", "tokenize", "parse_message", "parse_status",
+	"parse_command", "parse_gps", "write_headers"
+};
+
+static const char *const counter_names[NUM_COUNTERS] = {
+	"records", "decoded", "discard_ethertype", "discard_ip_version",
+	"discard_protocol", "discard_port", "discard_zerg_version",
+	"discard_malformed", "discard_time_range", "discard_truncated",
+	"encoded", "skip_invalid", "skip_unknown_payload",
+	"skip_unexpected_eof"
+};
+
+static struct {
+	bool enabled;
+	bool json;
+	uint64_t calls[NUM_STAGES];
+	uint64_t nanoseconds[NUM_STAGES];
+	uint64_t counters[NUM_COUNTERS];
+} stats;
+
+int stats_enable(const char *format)
+// Turns on the report printed by stats_report(). format is NULL or
+// "table" for an aligned table, or "json". Returns 0 on success and -1
+// if format is unknown.
+{
+	if (!format || strcmp(format, "table") == 0) {
+		stats.json = false;
+	} else if (strcmp(format, "json") == 0) {
+		stats.json = true;
+	} else {
+		fprintf(stderr, "Unknown --stats format \"%s\"\n", format);
+		return (-1);
+	}
+	stats.enabled = true;
+	return (0);
+}
+
+uint64_t stats_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+void stats_time(enum stats_stage stage, uint64_t start)
+// Charges the time since start to stage. Like stats_count(), this may
+// be called from several threads at once.
+{
+	uint64_t elapsed = stats_now() - start;
+	__atomic_fetch_add(&stats.calls[stage], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats.nanoseconds[stage], elapsed,
+			   __ATOMIC_RELAXED);
+}
+
+void stats_count(enum stats_counter counter)
+{
+	__atomic_fetch_add(&stats.counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void stats_report(FILE * out)
+// Prints every stage that ran and every nonzero counter, if enabled.
+// Stage times are inclusive of any stage nested inside them.
+{
+	if (!stats.enabled) {
+		return;
+	}
+	if (stats.json) {
+		fprintf(out, "{\"stages\": {");
+		const char *separator = "";
+		for (size_t i = 0; i < NUM_STAGES; ++i) {
+			if (!stats.calls[i]) {
+				continue;
+			}
+			fprintf(out, "%s\"%s\": {\"calls\": %llu, \"ns\": %llu}",
+				separator, stage_names[i],
+				(unsigned long long)stats.calls[i],
+				(unsigned long long)stats.nanoseconds[i]);
+			separator = ", ";
+		}
+		fprintf(out, "}, \"counters\": {");
+		separator = "";
+		for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+			if (!stats.counters[i]) {
+				continue;
+			}
+			fprintf(out, "%s\"%s\": %llu", separator,
+				counter_names[i],
+				(unsigned long long)stats.counters[i]);
+			separator = ", ";
+		}
+		fprintf(out, "}}\n");
+		return;
+	}
+	fprintf(out, "%-22s %12s %14s %12s\n", "Stage", "Calls", "Total ms",
+		"ns/call");
+	for (size_t i = 0; i < NUM_STAGES; ++i) {
+		if (!stats.calls[i]) {
+			continue;
+		}
+		fprintf(out, "%-22s %12llu %14.3f %12.1f\n", stage_names[i],
+			(unsigned long long)stats.calls[i],
+			stats.nanoseconds[i] / 1e6,
+			(double)stats.nanoseconds[i] / stats.calls[i]);
+	}
+	fprintf(out, "%-22s %12s\n", "Counter", "Value");
+	for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+		if (stats.counters[i]) {
+			fprintf(out, "%-22s %12llu\n", counter_names[i],
+				(unsigned long long)stats.counters[i]);
+		}
+	}
+}
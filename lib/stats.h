@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// Instrumentation is only compiled in when CODEC_STATS is defined
+// ("make stats"), which also links stats.o and adds --stats; otherwise
+// every STATS_* macro expands to nothing.
+
+enum stats_stage {
+	STAGE_READ,
+	STAGE_HEADERS,
+	STAGE_LOAD_MESSAGE,
+	STAGE_LOAD_STATUS,
+	STAGE_LOAD_COMMAND,
+	STAGE_LOAD_GPS,
+	STAGE_PRINT_MESSAGE,
+	STAGE_PRINT_STATUS,
+	STAGE_PRINT_COMMAND,
+	STAGE_PRINT_GPS,
+	STAGE_FLUSH,
+	STAGE_TOKENIZE,
+	STAGE_PARSE_MESSAGE,
+	STAGE_PARSE_STATUS,
+	STAGE_PARSE_COMMAND,
+	STAGE_PARSE_GPS,
+	STAGE_WRITE_HEADERS,
+	NUM_STAGES
+};
+
+enum stats_counter {
+	COUNT_RECORDS,
+	COUNT_DECODED,
+	COUNT_DISCARD_ETHERTYPE,
+	COUNT_DISCARD_IP_VERSION,
+	COUNT_DISCARD_PROTOCOL,
+	COUNT_DISCARD_PORT,
+	COUNT_DISCARD_ZERG_VERSION,
+	COUNT_DISCARD_MALFORMED,
+	COUNT_DISCARD_TIME_RANGE,
+	COUNT_DISCARD_TRUNCATED,
+	COUNT_ENCODED,
+	COUNT_SKIP_INVALID,
+	COUNT_SKIP_UNKNOWN_PAYLOAD,
+	COUNT_SKIP_UNEXPECTED_EOF,
+	NUM_COUNTERS
+};
+
+#ifdef CODEC_STATS
+int stats_enable(const char *format);
+
+uint64_t stats_now(void);
+
+void stats_time(enum stats_stage stage, uint64_t start);
+
+void stats_count(enum stats_counter counter);
+
+void stats_report(FILE * out);
+
+#define STATS_START(timer) uint64_t timer = stats_now()
+#define STATS_STOP(stage, timer) stats_time((stage), (timer))
+#define STATS_COUNT(counter) stats_count(counter)
+#define STATS_REPORT(out) stats_report(out)
+#else
+#define STATS_START(timer) ((void)0)
+#define STATS_STOP(stage, timer) ((void)0)
+#define STATS_COUNT(counter) ((void)0)
+#define STATS_REPORT(out) ((void)0)
+#endif
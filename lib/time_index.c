@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "shared_fields.h"
+#include "readahead.h"
+#include "capture.h"
+#include "time_index.h"
+
+enum index_file_constants {
+	INDEX_MAGIC = 0x5849545A,	// "ZTIX"
+	INDEX_VERSION = 2	// Version 1 misread captures from an older encode
+};
+
+struct __attribute__((__packed__)) index_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capture_size;
+	int64_t capture_mtime;
+	uint32_t block_records;
+	uint32_t reserved;
+	uint64_t records;
+	uint64_t count;
+	int64_t end_offset;
+};
+
+struct time_index {
+	struct time_index_entry *entries;
+	uint64_t *prefix_max;	// Latest timestamp in blocks [0, i]
+	uint64_t *suffix_min;	// Earliest timestamp in blocks [i, count)
+	size_t count;
+	size_t records;		// Records in the capture
+	long end_offset;	// Offset just past the last whole record
+};
+
+static struct time_index *read_index(const char *path,
+				     const struct stat *st);
+static struct time_index *build_index(const struct capture *cap,
+				      const struct stat *st);
+static void write_index(const struct time_index *ti, const char *path,
+			const struct stat *st);
+static bool check_index(const struct time_index *ti,
+			const struct stat *st);
+static int finish_index(struct time_index *ti);
+
+struct time_index *time_index_load(const struct capture *cap)
+// Returns the block index for cap, reading the CAPTURE.tidx sidecar if
+// it matches the capture's size and mtime. Otherwise the index is built
+// by walking record headers through cap's stream, whose position is
+// restored afterwards, and saved for next time if possible.
+{
+	struct stat st;
+	if (stat(cap->name, &st) != 0) {
+		return (NULL);
+	}
+	char path[4096];
+	snprintf(path, sizeof(path), "%s.tidx", cap->name);
+
+	struct time_index *ti = read_index(path, &st);
+	if (ti) {
+		return (ti);
+	}
+	long position = readahead_tell(cap->fo);
+	ti = build_index(cap, &st);
+	readahead_seek(cap->fo, position);
+	if (ti) {
+		write_index(ti, path, &st);
+	}
+	return (ti);
+}
+
+void time_index_range(const struct time_index *ti, uint64_t from,
+		      uint64_t to, long *start, long *end, size_t *skipped)
+// Narrows [from, to] to the span of the capture that can hold matching
+// records. start is the first block whose latest timestamp reaches
+// from; end is just past the last block whose earliest timestamp is no
+// later than to. Because the bounds use running maxima and minima, a
+// capture that is only mostly ordered still yields every match.
+// skipped is the number of records before start.
+{
+	size_t low = 0;
+	size_t high = ti->count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (ti->prefix_max[mid] >= from) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	size_t first = low;
+
+	low = 0;
+	high = ti->count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (ti->suffix_min[mid] <= to) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	size_t last = low;	// One past the last block that may match
+
+	*start = first < ti->count ? ti->entries[first].offset :
+	    ti->end_offset;
+	*skipped = first < ti->count ? first * TIME_INDEX_BLOCK_RECORDS :
+	    ti->records;
+	*end = last < ti->count ? ti->entries[last].offset : ti->end_offset;
+	if (*end < *start) {
+		*end = *start;
+	}
+}
+
+void time_index_destroy(struct time_index *ti)
+{
+	if (!ti) {
+		return;
+	}
+	free(ti->entries);
+	free(ti->prefix_max);
+	free(ti->suffix_min);
+	free(ti);
+}
+
+static struct time_index *read_index(const char *path,
+				     const struct stat *st)
+{
+	FILE *fo = fopen(path, "rb");
+	if (!fo) {
+		return (NULL);
+	}
+	struct index_file_header header;
+	if (fread(&header, sizeof(header), 1, fo) != 1
+	    || header.magic != INDEX_MAGIC || header.version != INDEX_VERSION
+	    || header.capture_size != (uint64_t)st->st_size
+	    || header.capture_mtime != (int64_t)st->st_mtime
+	    || header.block_records != TIME_INDEX_BLOCK_RECORDS) {
+		// Case: Missing, foreign or stale index
+		fclose(fo);
+		return (NULL);
+	}
+	struct time_index *ti = calloc(1, sizeof(*ti));
+	if (!ti) {
+		fclose(fo);
+		return (NULL);
+	}
+	ti->count = header.count;
+	ti->records = header.records;
+	ti->end_offset = header.end_offset;
+	ti->entries = malloc((ti->count + 1) * sizeof(*ti->entries));
+	if (!ti->entries
+	    || fread(ti->entries, sizeof(*ti->entries), ti->count, fo)
+	    != ti->count || !check_index(ti, st) || finish_index(ti) != 0) {
+		// Case: Truncated or inconsistent index
+		fclose(fo);
+		time_index_destroy(ti);
+		return (NULL);
+	}
+	fclose(fo);
+	return (ti);
+}
+
+static struct time_index *build_index(const struct capture *cap,
+				      const struct stat *st)
+// Walks every record header with capture_skim(), so lengths are read
+// just as decoding reads them, and keeps one entry per
+// TIME_INDEX_BLOCK_RECORDS records.
+{
+	struct time_index *ti = calloc(1, sizeof(*ti));
+	if (!ti) {
+		return (NULL);
+	}
+	size_t capacity = 64;
+	ti->entries = malloc(capacity * sizeof(*ti->entries));
+	if (!ti->entries) {
+		free(ti);
+		return (NULL);
+	}
+
+	struct capture walk = *cap;
+	walk.next = sizeof(struct pcap_header);
+	walk.stop = -1;
+	size_t records = 0;
+	while (capture_skim(&walk)) {
+		if (records % TIME_INDEX_BLOCK_RECORDS == 0) {
+			if (ti->count == capacity) {
+				capacity *= 2;
+				struct time_index_entry *tmp =
+				    realloc(ti->entries,
+					    capacity * sizeof(*tmp));
+				if (!tmp) {
+					time_index_destroy(ti);
+					return (NULL);
+				}
+				ti->entries = tmp;
+			}
+			ti->entries[ti->count].offset = walk.record;
+			ti->entries[ti->count].min_time = walk.time;
+			ti->entries[ti->count].max_time = walk.time;
+			++ti->count;
+		}
+		struct time_index_entry *entry = &ti->entries[ti->count - 1];
+		if (walk.time < entry->min_time) {
+			entry->min_time = walk.time;
+		}
+		if (walk.time > entry->max_time) {
+			entry->max_time = walk.time;
+		}
+		++records;
+	}
+	ti->records = records;
+	// A truncated last record ends at EOF as far as reading goes
+	ti->end_offset = walk.next < st->st_size ? walk.next : st->st_size;
+	if (finish_index(ti) != 0) {
+		time_index_destroy(ti);
+		return (NULL);
+	}
+	return (ti);
+}
+
+static void write_index(const struct time_index *ti, const char *path,
+			const struct stat *st)
+// Saves the index next to the capture. Failure is not an error; the
+// index is simply rebuilt next time.
+{
+	char tmp_path[4096 + 8];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *fo = fopen(tmp_path, "wb");
+	if (!fo) {
+		return;
+	}
+	struct index_file_header header = {
+		INDEX_MAGIC, INDEX_VERSION, st->st_size, st->st_mtime,
+		TIME_INDEX_BLOCK_RECORDS, 0, ti->records, ti->count,
+		ti->end_offset
+	};
+	if (fwrite(&header, sizeof(header), 1, fo) != 1
+	    || fwrite(ti->entries, sizeof(*ti->entries), ti->count, fo)
+	    != ti->count) {
+		fclose(fo);
+		remove(tmp_path);
+		return;
+	}
+	if (fclose(fo) != 0 || rename(tmp_path, path) != 0) {
+		remove(tmp_path);
+	}
+}
+
+static bool check_index(const struct time_index *ti,
+			const struct stat *st)
+// Checks that a saved index could describe the capture: one block per
+// TIME_INDEX_BLOCK_RECORDS records, in order, with every offset within
+// the file.
+{
+	size_t blocks = (ti->records + TIME_INDEX_BLOCK_RECORDS - 1) /
+	    TIME_INDEX_BLOCK_RECORDS;
+	if (ti->count != blocks || ti->end_offset > st->st_size) {
+		return (false);
+	}
+	long previous = sizeof(struct pcap_header) - 1;
+	for (size_t i = 0; i < ti->count; ++i) {
+		if (ti->entries[i].offset <= previous
+		    || ti->entries[i].offset >= ti->end_offset
+		    || ti->entries[i].min_time > ti->entries[i].max_time) {
+			return (false);
+		}
+		previous = ti->entries[i].offset;
+	}
+	return (true);
+}
+
+static int finish_index(struct time_index *ti)
+// Computes the running bounds that make the index binary-searchable
+// even when timestamps are not monotonic.
+{
+	ti->prefix_max = malloc((ti->count + 1) * sizeof(*ti->prefix_max));
+	ti->suffix_min = malloc((ti->count + 1) * sizeof(*ti->suffix_min));
+	if (!ti->prefix_max || !ti->suffix_min) {
+		return (-1);
+	}
+	for (size_t i = 0; i < ti->count; ++i) {
+		ti->prefix_max[i] = ti->entries[i].max_time;
+		if (i > 0 && ti->prefix_max[i - 1] > ti->prefix_max[i]) {
+			ti->prefix_max[i] = ti->prefix_max[i - 1];
+		}
+	}
+	for (size_t i = ti->count; i-- > 0;) {
+		ti->suffix_min[i] = ti->entries[i].min_time;
+		if (i + 1 < ti->count
+		    && ti->suffix_min[i + 1] < ti->suffix_min[i]) {
+			ti->suffix_min[i] = ti->suffix_min[i + 1];
+		}
+	}
+	return (0);
+}
@@ -0,0 +1,23 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum time_index_defaults {
+	TIME_INDEX_BLOCK_RECORDS = 4096
+};
+
+struct time_index_entry {
+	int64_t offset;		// File offset of the block's first record
+	uint64_t min_time;	// Earliest timestamp in the block (us)
+	uint64_t max_time;	// Latest timestamp in the block (us)
+};
+
+struct time_index;
+struct capture;
+
+struct time_index *time_index_load(const struct capture *cap);
+
+void time_index_range(const struct time_index *ti, uint64_t from,
+		      uint64_t to, long *start, long *end, size_t *skipped);
+
+void time_index_destroy(struct time_index *ti);
@@ -0,0 +1,1022 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tokenizer.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum tokenizer_limits {
+	NUMBER_MAX = 64,	// Longest token handed to strto*()
+	STREAM_BUF_SIZE = 1 << 16,	// Initial window over piped input
+	LONG_DIGITS_MAX = 18,	// Digits that always fit in a long
+	MANTISSA_DIGITS_MAX = 19,	// Digits that always fit in a uint64_t
+	EXACT_POWER_MAX = 22	// Largest power of ten that is an exact double
+};
+
+// A decimal number as scanned, before any rounding: mantissa * 10^exponent
+struct decimal {
+	uint64_t mantissa;
+	int exponent;
+	bool negative;
+};
+
+static const double exact_powers[EXACT_POWER_MAX + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+struct tokenizer {
+	const char *data;
+	size_t size;
+	size_t pos;		// Start of the next line
+	bool mapped;		// data is mmap'd rather than malloc'd
+	bool borrowed;		// data belongs to another tokenizer
+	int fd;			// Input still to be read, or -1
+	size_t capacity;	// Size of the window when streaming
+	bool failed;		// A read failed before the end of input
+	enum input_format format;
+	size_t line_start;	// Offset of pos's line
+	size_t line_end;	// Offset of the newline ending it
+	bool line_known;	// Whether line_end is up to date
+	size_t column;		// CSV column of the cell at pos
+	char *header;		// CSV column names, which columns point into
+	struct span *columns;
+	size_t column_count;
+	char *scratch;		// Unescaped strings of the line's fields
+	size_t scratch_size;
+};
+
+static bool fill_line(struct tokenizer *tk);
+static size_t split_line(const struct tokenizer *tk, size_t pos,
+			 struct span *key, struct span *value);
+static size_t split_field(struct tokenizer *tk, struct span *key,
+			  struct span *value, size_t *column);
+static size_t first_key(const struct tokenizer *tk, size_t pos,
+			struct span *key);
+static size_t find_line_end(const struct tokenizer *tk, size_t pos);
+static bool read_header(struct tokenizer *tk);
+static const char *json_field(const char *p, const char *end,
+			      char *scratch, struct span *key,
+			      struct span *value);
+static const char *json_string(const char *p, const char *end,
+			       char *scratch, struct span *string);
+static const char *json_escape(const char *p, const char *end, char **out);
+static bool hex_digits(const char *p, const char *end, uint32_t *value);
+static const char *csv_field(const struct tokenizer *tk, const char *p,
+			     const char *end, char *scratch, size_t *column,
+			     struct span *key, struct span *value);
+static const char *csv_cell(const char *p, const char *end, char *scratch,
+			    struct span *cell);
+static const char *skip_blanks(const char *p, const char *end);
+static const char *find_delim(const char *p, const char *end,
+			      const char *set);
+static bool copy_number(struct span s, char *buf);
+static bool fast_long(struct span s, long *value);
+static size_t scan_decimal(struct span s, struct decimal *d);
+static bool fast_double(const struct decimal *d, double *value);
+static bool fast_float(const struct decimal *d, float *value);
+
+struct tokenizer *tokenizer_open(const char *path)
+// Opens path for a single forward pass; see tokenizer_fd(). Returns
+// NULL with errno set on failure.
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return (NULL);
+	}
+	return (tokenizer_fd(fd));
+}
+
+struct tokenizer *tokenizer_fd(int fd)
+// Takes ownership of fd. Regular files are mapped whole. Anything else,
+// such as a pipe, is read through a window that only grows to fit the
+// longest line, so memory use does not depend on the input's size.
+{
+	struct tokenizer *tk = calloc(1, sizeof(*tk));
+	if (!tk) {
+		close(fd);
+		return (NULL);
+	}
+	tk->fd = -1;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		tk->size = st.st_size;
+		if (tk->size == 0) {
+			close(fd);
+			return (tk);
+		}
+		void *data = mmap(NULL, tk->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, tk->size, MADV_SEQUENTIAL);
+			tk->data = data;
+			tk->mapped = true;
+			close(fd);
+			return (tk);
+		}
+		tk->size = 0;
+	}
+
+	tk->capacity = STREAM_BUF_SIZE;
+	tk->data = malloc(tk->capacity);
+	if (!tk->data) {
+		close(fd);
+		free(tk);
+		return (NULL);
+	}
+	tk->fd = fd;
+	return (tk);
+}
+
+bool tokenizer_format(struct tokenizer *tk, enum input_format format)
+// Sets how input is split into fields, before any is read. Each member
+// of an NDJSON object, or nonempty cell of a CSV row, is one field, in
+// order, and the record ends with an empty field, just as a packet in
+// text ends with a blank line. CSV cells are keyed by the header line,
+// which is read now. Returns false if memory runs out.
+{
+	tk->format = format;
+	return (format != INPUT_CSV || read_header(tk));
+}
+
+int tokenizer_next(struct tokenizer *tk, struct span *key,
+		   struct span *value)
+// Consumes the next line, splitting it at its first ':' into key and
+// value. Neither includes the newline. Lines without a ':' are all key.
+// NDJSON and CSV input gives its next field instead. The spans stay
+// valid until the next call, or for NDJSON and CSV until a field of the
+// next record is read. Returns 0 at EOF.
+{
+	if (!fill_line(tk)) {
+		return (0);
+	}
+	if (tk->format == INPUT_TEXT) {
+		tk->pos = split_line(tk, tk->pos, key, value);
+	} else {
+		tk->pos = split_field(tk, key, value, &tk->column);
+	}
+	return (1);
+}
+
+int tokenizer_peek(struct tokenizer *tk, struct span *key,
+		   struct span *value)
+// Like tokenizer_next() but leaves the line to be read again.
+{
+	size_t column = tk->column;
+
+	if (!fill_line(tk)) {
+		return (0);
+	}
+	if (tk->format == INPUT_TEXT) {
+		split_line(tk, tk->pos, key, value);
+	} else {
+		split_field(tk, key, value, &column);
+	}
+	return (1);
+}
+
+size_t tokenizer_tell(const struct tokenizer *tk)
+// Returns the offset of the next line or field. Only meaningful for
+// input that is mapped whole, where offsets never move.
+{
+	return (tk->pos);
+}
+
+size_t tokenizer_size(const struct tokenizer *tk)
+// Returns the size of the input if all of it is mapped, or 0 if it is
+// being streamed.
+{
+	return (tk->mapped ? tk->size : 0);
+}
+
+struct tokenizer *tokenizer_slice(const struct tokenizer *tk, size_t offset)
+// Returns a tokenizer that reads the same mapped input from offset,
+// which should be the start of a line, so that separate threads can
+// each take a part of it. The slice borrows the mapping and must be
+// closed before tk. Returns NULL if tk is not mapped.
+{
+	if (!tk->mapped) {
+		return (NULL);
+	}
+	struct tokenizer *slice = calloc(1, sizeof(*slice));
+	if (!slice) {
+		return (NULL);
+	}
+	slice->data = tk->data;
+	slice->size = tk->size;
+	slice->pos = offset < tk->size ? offset : tk->size;
+	slice->borrowed = true;
+	slice->fd = -1;
+	slice->format = tk->format;
+	slice->columns = tk->columns;
+	slice->column_count = tk->column_count;
+	return (slice);
+}
+
+void tokenizer_seek(struct tokenizer *tk, size_t offset)
+// Moves mapped input to offset, which should be the start of a line, so
+// that one slice can be reused for several parts of the input. Streamed
+// input cannot move.
+{
+	if (tk->mapped || tk->borrowed) {
+		tk->pos = offset < tk->size ? offset : tk->size;
+		tk->line_known = false;
+		tk->column = 0;
+	}
+}
+
+size_t tokenizer_find(const struct tokenizer *tk, size_t from,
+		      const char *key)
+// Returns the offset of the first whole line at or after from whose key
+// is key, or the size of the input if there is none. For NDJSON and CSV
+// that is the first field of the line. A NULL key matches any line.
+// Does not move tk.
+{
+	struct span line_key;
+	size_t pos = from;
+
+	if (!tk->mapped || from >= tk->size) {
+		return (tk->size);
+	}
+	if (from > 0 && tk->data[from - 1] != '\n') {
+		// Case: from is mid-line; start at the next one
+		const char *newline =
+		    memchr(tk->data + from, '\n', tk->size - from);
+		if (!newline) {
+			return (tk->size);
+		}
+		pos = newline - tk->data + 1;
+	}
+	if (!key) {
+		return (pos);
+	}
+	while (pos < tk->size) {
+		size_t next = first_key(tk, pos, &line_key);
+		if (span_equals(line_key, key)) {
+			return (pos);
+		}
+		pos = next;
+	}
+	return (tk->size);
+}
+
+bool tokenizer_failed(const struct tokenizer *tk)
+// Reports whether EOF was really a read error.
+{
+	return (tk->failed);
+}
+
+void tokenizer_close(struct tokenizer *tk)
+{
+	if (!tk) {
+		return;
+	}
+	if (!tk->borrowed) {
+		free(tk->header);
+		free(tk->columns);
+	}
+	free(tk->scratch);
+	if (tk->borrowed) {
+		// Case: Slice of another tokenizer's mapping
+	} else if (tk->mapped) {
+		munmap((void *)tk->data, tk->size);
+	} else {
+		free((void *)tk->data);
+	}
+	if (tk->fd >= 0) {
+		close(tk->fd);
+	}
+	free(tk);
+}
+
+bool span_equals(struct span s, const char *text)
+{
+	return (strlen(text) == s.len && memcmp(s.start, text, s.len) == 0);
+}
+
+bool span_token(struct span *rest, const char *delims, struct span *token)
+// strtok() over a span: skips leading delimiters, takes the token up to
+// the next delimiter and consumes that delimiter. Returns false if only
+// delimiters remain.
+{
+	const char *p = rest->start;
+	const char *end = rest->start + rest->len;
+	while (p < end && strchr(delims, *p)) {
+		++p;
+	}
+	if (p == end) {
+		rest->start = end;
+		rest->len = 0;
+		return (false);
+	}
+	token->start = p;
+	while (p < end && !strchr(delims, *p)) {
+		++p;
+	}
+	token->len = p - token->start;
+	if (p < end) {
+		++p;
+	}
+	rest->len = end - p;
+	rest->start = p;
+	return (true);
+}
+
+bool span_long(struct span s, long *value)
+// Parses all of s as a decimal integer. Digits with an optional sign are
+// converted directly; anything else is left to strtol().
+{
+	char buf[NUMBER_MAX];
+	char *err = NULL;
+	if (fast_long(s, value)) {
+		return (true);
+	}
+	if (!copy_number(s, buf)) {
+		return (false);
+	}
+	*value = strtol(buf, &err, 10);
+	return (*err == '\0');
+}
+
+bool span_float(struct span s, float *value)
+// Parses all of s as a float, rounding exactly as strtof() does.
+{
+	char buf[NUMBER_MAX];
+	char *err = NULL;
+	struct decimal d;
+	if (s.len < NUMBER_MAX && s.len > 0 && scan_decimal(s, &d) == s.len
+	    && fast_float(&d, value)) {
+		return (true);
+	}
+	if (!copy_number(s, buf)) {
+		return (false);
+	}
+	*value = strtof(buf, &err);
+	return (*err == '\0');
+}
+
+bool span_double(struct span s, double *value)
+// Parses all of s as a double, rounding exactly as strtod() does.
+{
+	char buf[NUMBER_MAX];
+	char *err = NULL;
+	struct decimal d;
+	if (s.len < NUMBER_MAX && s.len > 0 && scan_decimal(s, &d) == s.len
+	    && fast_double(&d, value)) {
+		return (true);
+	}
+	if (!copy_number(s, buf)) {
+		return (false);
+	}
+	*value = strtod(buf, &err);
+	return (*err == '\0');
+}
+
+double span_double_prefix(struct span s)
+// Parses the longest numeric prefix of s, ignoring any units or symbol
+// such as the degree sign after it.
+{
+	char buf[NUMBER_MAX];
+	struct decimal d;
+	double value;
+	if (s.len >= NUMBER_MAX) {
+		s.len = NUMBER_MAX - 1;
+	}
+	size_t len = scan_decimal(s, &d);
+	if (len > 0 && (len == s.len || (s.start[len] | 0x20) != 'x')
+	    && fast_double(&d, &value)) {
+		return (value);
+	}
+	memcpy(buf, s.start, s.len);
+	buf[s.len] = '\0';
+	return (strtod(buf, NULL));
+}
+
+float span_float_prefix(struct span s)
+{
+	char buf[NUMBER_MAX];
+	struct decimal d;
+	float value;
+	if (s.len >= NUMBER_MAX) {
+		s.len = NUMBER_MAX - 1;
+	}
+	size_t len = scan_decimal(s, &d);
+	if (len > 0 && (len == s.len || (s.start[len] | 0x20) != 'x')
+	    && fast_float(&d, &value)) {
+		return (value);
+	}
+	memcpy(buf, s.start, s.len);
+	buf[s.len] = '\0';
+	return (strtof(buf, NULL));
+}
+
+static bool fill_line(struct tokenizer *tk)
+// Makes sure a whole line starts at tk->pos, reading more input if it
+// is being streamed. The unread tail is moved to the front of the
+// window first, and the window doubles only when one line fills it.
+// Returns false at EOF.
+{
+	size_t scanned = tk->pos;
+	while (tk->fd >= 0
+	       && !memchr(tk->data + scanned, '\n', tk->size - scanned)) {
+		char *buf = (char *)tk->data;
+		if (tk->pos > 0) {
+			memmove(buf, buf + tk->pos, tk->size - tk->pos);
+			tk->size -= tk->pos;
+			tk->pos = 0;
+			tk->line_known = false;
+		}
+		scanned = tk->size;
+		if (tk->size == tk->capacity) {
+			char *tmp = realloc(buf, tk->capacity * 2);
+			if (!tmp) {
+				tk->failed = true;
+				close(tk->fd);
+				tk->fd = -1;
+				break;
+			}
+			tk->data = tmp;
+			tk->capacity *= 2;
+			buf = tmp;
+		}
+		ssize_t got =
+		    read(tk->fd, buf + tk->size, tk->capacity - tk->size);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			tk->failed = got < 0;
+			close(tk->fd);
+			tk->fd = -1;
+			break;
+		}
+		tk->size += got;
+	}
+	return (tk->pos < tk->size);
+}
+
+static size_t split_line(const struct tokenizer *tk, size_t pos,
+			 struct span *key, struct span *value)
+// Splits the line at pos. Returns the offset of the following line.
+{
+	const char *line = tk->data + pos;
+	size_t remaining = tk->size - pos;
+	const char *newline = memchr(line, '\n', remaining);
+	size_t len = newline ? (size_t)(newline - line) : remaining;
+
+	// Like strtok(line, ":"), leading colons are skipped
+	size_t start = 0;
+	while (start < len && line[start] == ':') {
+		++start;
+	}
+	const char *colon = memchr(line + start, ':', len - start);
+	key->start = line + start;
+	if (colon) {
+		key->len = colon - key->start;
+		value->start = colon + 1;
+		value->len = line + len - value->start;
+	} else {
+		key->len = len - start;
+		value->start = line + len;
+		value->len = 0;
+	}
+	return (pos + len + (newline != NULL));
+}
+
+static size_t split_field(struct tokenizer *tk, struct span *key,
+			  struct span *value, size_t *column)
+// Splits the NDJSON member or CSV cell at tk->pos, unescaping strings
+// into tk->scratch, which grows to fit the line. Each field is unescaped
+// at its own offset in the line, so all of a record's fields can be
+// held at once. column is that of the cell and is moved on. At the end
+// of the record, key and value are empty and the next field is on the
+// following line. Returns the offset of the next field.
+{
+	if (!tk->line_known || tk->pos > tk->line_end) {
+		tk->line_start = tk->pos;
+		tk->line_end = find_line_end(tk, tk->pos);
+		tk->line_known = true;
+	}
+	const char *line = tk->data + tk->line_start;
+	const char *start = tk->data + tk->pos;
+	const char *end = tk->data + tk->line_end;
+	if (end > start && end[-1] == '\r') {
+		--end;
+	}
+	size_t len = end - line;
+	if (tk->scratch_size < len) {
+		char *tmp = realloc(tk->scratch, len);
+		if (tmp) {
+			tk->scratch = tmp;
+			tk->scratch_size = len;
+		}
+	}
+	// Unescaped text never outgrows its escaped text, so fields never
+	// overlap. Without room, escapes are left in place.
+	char *scratch = tk->scratch_size >= len ?
+	    tk->scratch + (start - line) : NULL;
+	const char *next = tk->format == INPUT_CSV ?
+	    csv_field(tk, start, end, scratch, column, key, value) :
+	    json_field(start, end, scratch, key, value);
+	if (next) {
+		return (next - tk->data);
+	}
+	key->start = end;
+	key->len = 0;
+	*value = *key;
+	*column = 0;
+	return (tk->line_end + (tk->line_end < tk->size));
+}
+
+static size_t first_key(const struct tokenizer *tk, size_t pos,
+			struct span *key)
+// Finds the key of the first field on the line at pos, leaving any
+// escapes in it. Returns the offset of the following line.
+{
+	struct span value;
+	size_t column = 0;
+
+	if (tk->format == INPUT_TEXT) {
+		return (split_line(tk, pos, key, &value));
+	}
+	size_t line_end = find_line_end(tk, pos);
+	const char *start = tk->data + pos;
+	const char *end = tk->data + line_end;
+	if (end > start && end[-1] == '\r') {
+		--end;
+	}
+	const char *found = tk->format == INPUT_CSV ?
+	    csv_field(tk, start, end, NULL, &column, key, &value) :
+	    json_field(start, end, NULL, key, &value);
+	if (!found) {
+		key->start = end;
+		key->len = 0;
+	}
+	return (line_end + (line_end < tk->size));
+}
+
+static size_t find_line_end(const struct tokenizer *tk, size_t pos)
+// Returns the offset of the newline ending the line at pos, or the size
+// of the input.
+{
+	const char *newline = memchr(tk->data + pos, '\n', tk->size - pos);
+	return (newline ? (size_t)(newline - tk->data) : tk->size);
+}
+
+static bool read_header(struct tokenizer *tk)
+// Consumes the CSV header line, keeping a copy of its column names with
+// blanks trimmed. Empty input has no columns. Returns false if memory
+// runs out.
+{
+	if (!fill_line(tk)) {
+		return (true);
+	}
+	size_t line_end = find_line_end(tk, tk->pos);
+	const char *start = tk->data + tk->pos;
+	const char *end = tk->data + line_end;
+	if (end > start && end[-1] == '\r') {
+		--end;
+	}
+	if (end - start >= 3 && memcmp(start, "\xEF\xBB\xBF", 3) == 0) {
+		// Case: UTF-8 byte order mark
+		start += 3;
+	}
+	// Commas inside quotes are counted too, which only wastes a little
+	size_t count = 1;
+	for (const char *p = start; (p = find_delim(p, end, ",")) < end; ++p) {
+		++count;
+	}
+	tk->header = malloc(end - start + 1);
+	tk->columns = malloc(count * sizeof(*tk->columns));
+	if (!tk->header || !tk->columns) {
+		return (false);
+	}
+	// Names are never longer than their cells, so each fits behind
+	// the part of the line already read
+	char *name = tk->header;
+	for (const char *p = start;; ++p) {
+		struct span cell;
+		p = csv_cell(p, end, name, &cell);
+		const char *first =
+		    skip_blanks(cell.start, cell.start + cell.len);
+		cell.len -= first - cell.start;
+		cell.start = first;
+		while (cell.len > 0 && (cell.start[cell.len - 1] == ' '
+					|| cell.start[cell.len - 1] == '\t')) {
+			--cell.len;
+		}
+		memmove(name, cell.start, cell.len);
+		tk->columns[tk->column_count].start = name;
+		tk->columns[tk->column_count].len = cell.len;
+		++tk->column_count;
+		name += cell.len;
+		if (p == end) {
+			break;
+		}
+	}
+	tk->pos = line_end + (line_end < tk->size);
+	return (true);
+}
+
+static const char *json_field(const char *p, const char *end,
+			      char *scratch, struct span *key,
+			      struct span *value)
+// Splits the member of a JSON object at p, or the opening brace before
+// the first member. Strings are unescaped into scratch unless it is
+// NULL. Returns where the next member starts, or NULL at the end of the
+// object.
+{
+	p = skip_blanks(p, end);
+	if (p < end && (*p == '{' || *p == ',')) {
+		p = skip_blanks(p + 1, end);
+	}
+	if (p == end || *p == '}') {
+		return (NULL);
+	}
+	if (*p != '"') {
+		// Case: Not JSON; like a line without a ':', it is all key
+		key->start = p;
+		key->len = end - p;
+		value->start = end;
+		value->len = 0;
+		return (end);
+	}
+	p = json_string(p + 1, end, scratch, key);
+	if (scratch) {
+		// The key's unescaped text never outgrows its escaped text
+		scratch += key->len;
+	}
+	p = skip_blanks(p, end);
+	if (p < end && *p == ':') {
+		p = skip_blanks(p + 1, end);
+	}
+	if (p < end && *p == '"') {
+		return (json_string(p + 1, end, scratch, value));
+	}
+	// Numbers, true, false and null are passed on as they are written
+	const char *stop = find_delim(p, end, ",} \t");
+	value->start = p;
+	value->len = stop - p;
+	return (stop);
+}
+
+static const char *json_string(const char *p, const char *end,
+			       char *scratch, struct span *string)
+// Takes the string whose opening quote is just before p. Escapes are
+// decoded into scratch, or left in place if it is NULL. Returns the
+// position after the closing quote.
+{
+	const char *q = find_delim(p, end, "\"\\");
+	if (q == end || *q == '"' || !scratch) {
+		// Case: Nothing to unescape, or nowhere to do it
+		while (q < end && *q == '\\') {
+			q = find_delim(q + 1 < end ? q + 2 : end, end, "\"\\");
+		}
+		string->start = p;
+		string->len = q - p;
+		return (q < end ? q + 1 : end);
+	}
+	char *out = scratch;
+	while (q < end && *q == '\\') {
+		memcpy(out, p, q - p);
+		out += q - p;
+		p = json_escape(q + 1, end, &out);
+		q = find_delim(p, end, "\"\\");
+	}
+	memcpy(out, p, q - p);
+	out += q - p;
+	string->start = scratch;
+	string->len = out - scratch;
+	return (q < end ? q + 1 : end);
+}
+
+static const char *json_escape(const char *p, const char *end, char **out)
+// Decodes the escape whose backslash is just before p into *out, moving
+// it on, and returns the position after the escape. \u escapes become
+// UTF-8, surrogate pairs included. Unknown escapes stand for their
+// character, as do \u escapes without four hex digits.
+{
+	static const char escapes[] = "\"\\/bfnrt";
+	static const char decoded[] = "\"\\/\b\f\n\r\t";
+	char *w = *out;
+	uint32_t code;
+	uint32_t low;
+
+	if (p == end) {
+		return (end);
+	}
+	if (*p != 'u' || !hex_digits(p + 1, end, &code)) {
+		const char *found = *p ? strchr(escapes, *p) : NULL;
+		*w = found ? decoded[found - escapes] : *p;
+		++*out;
+		return (p + 1);
+	}
+	p += 5;
+	if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\'
+	    && p[1] == 'u' && hex_digits(p + 2, end, &low)
+	    && low >= 0xDC00 && low < 0xE000) {
+		code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+		p += 6;
+	}
+	if (code < 0x80) {
+		*w++ = code;
+	} else if (code < 0x800) {
+		*w++ = 0xC0 | code >> 6;
+		*w++ = 0x80 | (code & 0x3F);
+	} else if (code < 0x10000) {
+		*w++ = 0xE0 | code >> 12;
+		*w++ = 0x80 | (code >> 6 & 0x3F);
+		*w++ = 0x80 | (code & 0x3F);
+	} else {
+		*w++ = 0xF0 | code >> 18;
+		*w++ = 0x80 | (code >> 12 & 0x3F);
+		*w++ = 0x80 | (code >> 6 & 0x3F);
+		*w++ = 0x80 | (code & 0x3F);
+	}
+	*out = w;
+	return (p);
+}
+
+static bool hex_digits(const char *p, const char *end, uint32_t *value)
+// Reads the four hex digits of a \u escape.
+{
+	if (end - p < 4) {
+		return (false);
+	}
+	*value = 0;
+	for (int i = 0; i < 4; ++i) {
+		unsigned digit = (unsigned char)p[i] - '0';
+		unsigned letter = ((unsigned char)p[i] | 0x20) - 'a';
+		if (digit <= 9) {
+			*value = *value << 4 | digit;
+		} else if (letter <= 5) {
+			*value = *value << 4 | (letter + 10);
+		} else {
+			return (false);
+		}
+	}
+	return (true);
+}
+
+static const char *csv_field(const struct tokenizer *tk, const char *p,
+			     const char *end, char *scratch, size_t *column,
+			     struct span *key, struct span *value)
+// Takes the next nonempty cell of a CSV row that has a column name,
+// keyed by that name. column is the cell's at p and is moved on.
+// Returns where the following cell starts, or NULL at the end of the
+// row.
+{
+	while (p < end) {
+		size_t cell = (*column)++;
+		if (*p == ',') {
+			// Case: Empty cell, as most are in a wide table
+			++p;
+			continue;
+		}
+		p = csv_cell(p, end, scratch, value);
+		if (p < end) {
+			// Skip the comma
+			++p;
+		}
+		if (value->len > 0 && cell < tk->column_count) {
+			*key = tk->columns[cell];
+			return (p);
+		}
+	}
+	return (NULL);
+}
+
+static const char *csv_cell(const char *p, const char *end, char *scratch,
+			    struct span *cell)
+// Takes the cell at p. A quoted cell loses its quotes, and the doubled
+// quotes inside it are unescaped into scratch unless it is NULL;
+// anything between its closing quote and the comma is dropped. Returns
+// the position of the comma that ends the cell, or end.
+{
+	if (p == end || *p != '"') {
+		const char *comma = find_delim(p, end, ",");
+		cell->start = p;
+		cell->len = comma - p;
+		return (comma);
+	}
+	++p;
+	cell->start = p;
+	char *out = scratch;
+	const char *q = find_delim(p, end, "\"");
+	while (q + 1 < end && q[1] == '"') {
+		// Case: A doubled quote stands for one
+		if (scratch) {
+			memcpy(out, p, q + 1 - p);
+			out += q + 1 - p;
+			p = q + 2;
+		}
+		q = find_delim(q + 2, end, "\"");
+	}
+	if (out != scratch) {
+		memcpy(out, p, q - p);
+		out += q - p;
+		cell->start = scratch;
+		cell->len = out - scratch;
+	} else {
+		cell->len = q - cell->start;
+	}
+	return (find_delim(q, end, ","));
+}
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		++p;
+	}
+	return (p);
+}
+
+static const char *find_delim(const char *p, const char *end,
+			      const char *set)
+// Returns the first byte from p up to end that is in set, which holds
+// one to four bytes, or end if none is. With SSE2, sixteen bytes are
+// compared against every delimiter at once, which is what keeps JSON
+// and CSV fields as quick to split as memchr() is for lines.
+{
+#ifdef __SSE2__
+	size_t count = strlen(set);
+	__m128i d0 = _mm_set1_epi8(set[0]);
+	__m128i d1 = _mm_set1_epi8(set[count > 1 ? 1 : 0]);
+	__m128i d2 = _mm_set1_epi8(set[count > 2 ? 2 : 0]);
+	__m128i d3 = _mm_set1_epi8(set[count > 3 ? 3 : 0]);
+	for (; end - p >= 16; p += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)p);
+		__m128i hits =
+		    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, d0),
+					      _mm_cmpeq_epi8(bytes, d1)),
+				 _mm_or_si128(_mm_cmpeq_epi8(bytes, d2),
+					      _mm_cmpeq_epi8(bytes, d3)));
+		int mask = _mm_movemask_epi8(hits);
+		if (mask != 0) {
+			return (p + __builtin_ctz(mask));
+		}
+	}
+#endif
+	for (; p < end; ++p) {
+		if (*p != '\0' && strchr(set, *p)) {
+			return (p);
+		}
+	}
+	return (end);
+}
+
+static bool copy_number(struct span s, char *buf)
+// Copies s into buf as a C string for strto*(). Tokens too long to be
+// a number are rejected.
+{
+	if (s.len >= NUMBER_MAX) {
+		return (false);
+	}
+	memcpy(buf, s.start, s.len);
+	buf[s.len] = '\0';
+	return (true);
+}
+
+static bool fast_long(struct span s, long *value)
+// Converts an optional sign and up to LONG_DIGITS_MAX digits, which
+// cannot overflow. Returns false for anything else.
+{
+	size_t i = 0;
+	bool negative = false;
+	if (s.len > 0 && (s.start[0] == '-' || s.start[0] == '+')) {
+		negative = s.start[0] == '-';
+		i = 1;
+	}
+	if (i == s.len || s.len - i > LONG_DIGITS_MAX) {
+		return (false);
+	}
+	long n = 0;
+	for (; i < s.len; ++i) {
+		unsigned digit = (unsigned char)s.start[i] - '0';
+		if (digit > 9) {
+			return (false);
+		}
+		n = n * 10 + digit;
+	}
+	*value = negative ? -n : n;
+	return (true);
+}
+
+static size_t scan_decimal(struct span s, struct decimal *d)
+// Reads [+-]digits[.digits][e[+-]digits] from the start of s without
+// rounding. Returns the length read, or 0 if s does not start that way
+// or has too many significant digits to hold, leaving it to strto*().
+{
+	size_t i = 0;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	bool fraction = false;
+
+	d->negative = false;
+	if (i < s.len && (s.start[i] == '-' || s.start[i] == '+')) {
+		d->negative = s.start[i] == '-';
+		++i;
+	}
+	for (; i < s.len; ++i) {
+		unsigned digit = (unsigned char)s.start[i] - '0';
+		if (digit > 9) {
+			if (s.start[i] == '.' && !fraction) {
+				fraction = true;
+				continue;
+			}
+			break;
+		}
+		any = true;
+		if (fraction) {
+			--exponent;
+		}
+		if (mantissa == 0 && digit == 0) {
+			// Leading zeros are not significant
+			continue;
+		}
+		if (digits == MANTISSA_DIGITS_MAX) {
+			return (0);
+		}
+		mantissa = mantissa * 10 + digit;
+		++digits;
+	}
+	if (!any) {
+		return (0);
+	}
+	if (i < s.len && (s.start[i] | 0x20) == 'e') {
+		// An exponent counts only if it has digits, as with strtod()
+		size_t j = i + 1;
+		bool negative = false;
+		if (j < s.len && (s.start[j] == '-' || s.start[j] == '+')) {
+			negative = s.start[j] == '-';
+			++j;
+		}
+		int power = 0;
+		size_t first = j;
+		for (; j < s.len && (unsigned)(s.start[j] - '0') <= 9; ++j) {
+			if (power < 100000) {
+				power = power * 10 + (s.start[j] - '0');
+			}
+		}
+		if (j > first) {
+			exponent += negative ? -power : power;
+			i = j;
+		}
+	}
+	d->mantissa = mantissa;
+	d->exponent = exponent;
+	return (i);
+}
+
+static bool fast_double(const struct decimal *d, double *value)
+// Clinger's fast path: when the mantissa and the power of ten are both
+// exact doubles, one multiplication or division rounds correctly.
+// Returns false when that does not hold.
+{
+	double v = d->mantissa;
+	if (d->mantissa == 0) {
+		v = 0;
+	} else if (d->mantissa > (UINT64_C(1) << 53)
+		   || d->exponent < -EXACT_POWER_MAX
+		   || d->exponent > EXACT_POWER_MAX) {
+		return (false);
+	} else if (d->exponent < 0) {
+		v /= exact_powers[-d->exponent];
+	} else {
+		v *= exact_powers[d->exponent];
+	}
+	*value = d->negative ? -v : v;
+	return (true);
+}
+
+static bool fast_float(const struct decimal *d, float *value)
+// Rounds the exactly rounded double to float. That can only differ from
+// rounding the decimal straight to float when the double lands exactly
+// halfway between two floats, so those, and values outside the normal
+// float range, are refused.
+{
+	double v;
+	if (!fast_double(d, &v)) {
+		return (false);
+	}
+	double magnitude = v < 0 ? -v : v;
+	if (d->mantissa != 0 && (magnitude < FLT_MIN || magnitude > FLT_MAX)) {
+		return (false);
+	}
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	uint64_t dropped = bits & ((UINT64_C(1) << 29) - 1);
+	if (dropped == UINT64_C(1) << 28) {
+		return (false);
+	}
+	*value = v;
+	return (true);
+}
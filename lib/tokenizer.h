@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+struct span {
+	const char *start;
+	size_t len;
+};
+
+enum input_format {
+	INPUT_TEXT,		// "Key: value" lines, as decode writes them
+	INPUT_NDJSON,		// One JSON object per line
+	INPUT_CSV		// A header line naming the columns, then rows
+};
+
+struct tokenizer;
+
+struct tokenizer *tokenizer_open(const char *path);
+
+struct tokenizer *tokenizer_fd(int fd);
+
+bool tokenizer_format(struct tokenizer *tk, enum input_format format);
+
+int tokenizer_next(struct tokenizer *tk, struct span *key,
+		   struct span *value);
+
+int tokenizer_peek(struct tokenizer *tk, struct span *key,
+		   struct span *value);
+
+size_t tokenizer_tell(const struct tokenizer *tk);
+
+size_t tokenizer_size(const struct tokenizer *tk);
+
+struct tokenizer *tokenizer_slice(const struct tokenizer *tk, size_t offset);
+
+void tokenizer_seek(struct tokenizer *tk, size_t offset);
+
+size_t tokenizer_find(const struct tokenizer *tk, size_t from,
+		      const char *key);
+
+bool tokenizer_failed(const struct tokenizer *tk);
+
+void tokenizer_close(struct tokenizer *tk);
+
+bool span_equals(struct span s, const char *text);
+
+bool span_token(struct span *rest, const char *delims, struct span *token);
+
+bool span_long(struct span s, long *value);
+
+bool span_float(struct span s, float *value);
+
+bool span_double(struct span s, double *value);
+
+double span_double_prefix(struct span s);
+
+float span_float_prefix(struct span s);
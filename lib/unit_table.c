@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "shared_fields.h"
+#include "unit_table.h"
+#include <netinet/in.h>
+
+struct unit_table {
+	struct unit_state *slots;	// Indexed by zerg_src
+	size_t count;
+};
+
+struct unit_table *unit_table_create(void)
+// Creates an empty table with a slot for every possible zerg_src, so
+// updates never allocate or probe. Untouched slots stay zero pages.
+{
+	struct unit_table *ut = calloc(1, sizeof(*ut));
+	if (!ut) {
+		return (NULL);
+	}
+	ut->slots = calloc(UNIT_TABLE_SLOTS, sizeof(*ut->slots));
+	if (!ut->slots) {
+		free(ut);
+		return (NULL);
+	}
+	return (ut);
+}
+
+void unit_table_update(struct unit_table *ut, const struct zerg_header *zh,
+		       long packet)
+// Folds a status or GPS payload into the sending unit's entry. Other
+// payload types carry no unit state and are ignored.
+{
+	if (zh->zerg_packet_type != 1 && zh->zerg_packet_type != 3) {
+		return;
+	}
+	if (!zh->zerg_payload) {
+		return;
+	}
+	uint16_t src = ntohs(zh->zerg_src);
+	struct unit_state *unit = &ut->slots[src];
+	if (!unit->used) {
+		unit->used = true;
+		unit->src = src;
+		++ut->count;
+	}
+	unit->last_packet = packet;
+
+	if (zh->zerg_packet_type == 1) {
+		const struct zerg_status *zs = zh->zerg_payload;
+		unit->has_status = true;
+		unit->hp = shift_24_bit_int(zs->current_hp);
+		unit->max_hp = shift_24_bit_int(zs->max_hp);
+		unit->armor = zs->armor;
+		unit->type = zs->type;
+		unit->max_speed = reverse_float(zs->max_speed);
+		strncpy(unit->name, zs->name, sizeof(unit->name) - 1);
+		unit->name[sizeof(unit->name) - 1] = '\0';
+	} else {
+		const struct zerg_gps *zg = zh->zerg_payload;
+		unit->has_gps = true;
+		unit->latitude = reverse_double(zg->latitude);
+		unit->longitude = reverse_double(zg->longitude);
+		unit->altitude = reverse_float(zg->altitude);
+		unit->bearing = reverse_float(zg->bearing);
+		unit->speed = reverse_float(zg->speed);
+	}
+}
+
+size_t unit_table_size(const struct unit_table *ut)
+{
+	return (ut->count);
+}
+
+size_t unit_table_snapshot(const struct unit_table *ut,
+			   const struct unit_state **states)
+// Fills states (which must have room for unit_table_size() entries)
+// with pointers to every known unit ordered by zerg_src. Returns the
+// number of entries written.
+{
+	size_t count = 0;
+	for (size_t i = 0; i < UNIT_TABLE_SLOTS && count < ut->count; ++i) {
+		if (ut->slots[i].used) {
+			states[count++] = &ut->slots[i];
+		}
+	}
+	return (count);
+}
+
+void unit_table_destroy(struct unit_table *ut)
+{
+	if (!ut) {
+		return;
+	}
+	free(ut->slots);
+	free(ut);
+}
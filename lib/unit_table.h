@@ -0,0 +1,42 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum unit_table_defaults {
+	UNIT_TABLE_SLOTS = UINT16_MAX + 1,	// One per zerg_src
+	UNIT_NAME_LEN = 32
+};
+
+struct unit_state {
+	uint16_t src;
+	bool used;
+	bool has_status;
+	bool has_gps;
+	int hp;
+	unsigned int max_hp;
+	unsigned int armor;
+	unsigned int type;
+	float max_speed;
+	char name[UNIT_NAME_LEN];
+	double latitude;
+	double longitude;
+	float altitude;
+	float bearing;
+	float speed;
+	long last_packet;	// Packet number of the latest update
+};
+
+struct unit_table;
+struct zerg_header;
+
+struct unit_table *unit_table_create(void);
+
+void unit_table_update(struct unit_table *ut, const struct zerg_header *zh,
+		       long packet);
+
+size_t unit_table_size(const struct unit_table *ut);
+
+size_t unit_table_snapshot(const struct unit_table *ut,
+			   const struct unit_state **states);
+
+void unit_table_destroy(struct unit_table *ut);
@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lib/shared_fields.h"
+#include "lib/readahead.h"
+#include "lib/capture.h"
+#include "lib/frame.h"
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum replay_limits {
+	DEFAULT_BATCH = 64,
+	MAX_BATCH = 1024,	// UIO_MAXIOV caps a sendmmsg() call
+	FRAME_MAX = 14 + 65535	// Ethernet header and largest IP packet
+};
+
+enum pace_mode {
+	PACE_ORIGINAL,		// Keep the gaps between capture timestamps
+	PACE_RATE,		// A fixed number of packets per second
+	PACE_MAX		// As fast as sendmmsg() will go
+};
+
+struct replay {
+	int sock;
+	size_t batch;
+	size_t count;		// Packets queued in the current batch
+	struct mmsghdr *messages;
+	struct iovec *payloads;
+	unsigned char *frames;	// FRAME_MAX bytes per queued packet
+	uint64_t *due;		// When each queued packet should go (ns)
+	bool paced;
+	size_t sent;
+	size_t bytes;
+	size_t skipped;		// Records that were not zerg over UDP
+	size_t failed;		// Packets the kernel would not take
+	double lateness_sum;	// Of send time less due time (ns)
+	double lateness_squares;
+	uint64_t lateness_max;
+};
+
+static struct {
+	const char *destination;
+	enum pace_mode pace;
+	double rate;
+	size_t batch;
+} options = { "127.0.0.1:3751", PACE_ORIGINAL, 0, DEFAULT_BATCH };
+
+int open_destination(const char *destination,
+		     struct sockaddr_storage *address, socklen_t *len);
+int replay_capture(struct replay *rp, struct capture *cap);
+int send_batch(struct replay *rp);
+void print_report(const struct replay *rp, uint64_t elapsed);
+uint64_t now_ns(void);
+void sleep_until(uint64_t when);
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"batch", required_argument, NULL, 'B'},
+		{"destination", required_argument, NULL, 'd'},
+		{"pace", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	char *err = NULL;
+	while ((opt = getopt_long(argc, argv, "B:d:p:", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+			// a[scii sort]
+		case 'B':
+			options.batch = strtoul(optarg, &err, 10);
+			if (*optarg == '\0' || *err != '\0' || options.batch < 1
+			    || options.batch > MAX_BATCH) {
+				fprintf(stderr,
+					"Batch must be a number from 1 to %d\n",
+					MAX_BATCH);
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'd':
+			options.destination = optarg;
+			break;
+		case 'p':
+			if (strcmp(optarg, "original") == 0) {
+				options.pace = PACE_ORIGINAL;
+				break;
+			}
+			if (strcmp(optarg, "max") == 0) {
+				options.pace = PACE_MAX;
+				break;
+			}
+			options.pace = PACE_RATE;
+			options.rate = strtod(optarg, &err);
+			if (*optarg == '\0' || *err != '\0'
+			    || !(options.rate > 0)) {
+				fprintf(stderr,
+					"Expected \"original\", \"max\" or packets per second; received \"%s\"\n",
+					optarg);
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case '?':
+			return (INVOCATION_ERROR);
+		}
+	}
+	if (argc - optind != 1) {
+		printf("Usage: %s [OPTION]... CAPTURE\n", argv[0]);
+		return (INVOCATION_ERROR);
+	}
+	const char *file_name = argv[optind];
+
+	struct sockaddr_storage address;
+	socklen_t address_len;
+	int sock = open_destination(options.destination, &address,
+				    &address_len);
+	if (sock < 0) {
+		return (FILE_ERROR);
+	}
+	struct readahead *fo = readahead_open(file_name,
+					      READAHEAD_DEFAULT_DEPTH,
+					      READAHEAD_DEFAULT_BUF_SIZE,
+					      READAHEAD_MMAP);
+	if (!fo) {
+		fprintf(stderr, "%s could not be opened", file_name);
+		perror(" \b");
+		close(sock);
+		return (FILE_ERROR);
+	}
+	struct capture cap;
+	if (capture_init(&cap, file_name, fo) != 0) {
+		fprintf(stderr, "%s is not a pcap capture\n", file_name);
+		readahead_close(fo);
+		close(sock);
+		return (FILE_ERROR);
+	}
+
+	struct replay rp = {
+		.sock = sock,
+		.batch = options.batch,
+		.paced = options.pace != PACE_MAX
+	};
+	rp.messages = calloc(rp.batch, sizeof(*rp.messages));
+	rp.payloads = calloc(rp.batch, sizeof(*rp.payloads));
+	rp.frames = malloc(rp.batch * FRAME_MAX);
+	rp.due = calloc(rp.batch, sizeof(*rp.due));
+	int return_code = SUCCESS;
+	if (!rp.messages || !rp.payloads || !rp.frames || !rp.due) {
+		fprintf(stderr, "Memory allocation error\n");
+		return_code = MEMORY_ERROR;
+	} else {
+		for (size_t i = 0; i < rp.batch; ++i) {
+			rp.messages[i].msg_hdr.msg_name = &address;
+			rp.messages[i].msg_hdr.msg_namelen = address_len;
+			rp.messages[i].msg_hdr.msg_iov = &rp.payloads[i];
+			rp.messages[i].msg_hdr.msg_iovlen = 1;
+		}
+		uint64_t start = now_ns();
+		if (replay_capture(&rp, &cap) != 0) {
+			return_code = FILE_ERROR;
+		}
+		print_report(&rp, now_ns() - start);
+	}
+
+	free(rp.messages);
+	free(rp.payloads);
+	free(rp.frames);
+	free(rp.due);
+	readahead_close(fo);
+	close(sock);
+	return (return_code);
+}
+
+int open_destination(const char *destination,
+		     struct sockaddr_storage *address, socklen_t *len)
+// Resolves HOST:PORT, where an IPv6 HOST is written in brackets, and
+// opens an unconnected UDP socket for it. Sending without connecting
+// means a port nobody is listening on does not fail later sends.
+// Returns the socket, or -1 after reporting why not.
+{
+	char host[256];
+	const char *colon = strrchr(destination, ':');
+	if (!colon || colon == destination
+	    || (size_t)(colon - destination) >= sizeof(host)) {
+		fprintf(stderr, "Expected HOST:PORT; received \"%s\"\n",
+			destination);
+		return (-1);
+	}
+	size_t host_len = colon - destination;
+	memcpy(host, destination, host_len);
+	host[host_len] = '\0';
+	if (host[0] == '[' && host[host_len - 1] == ']') {
+		memmove(host, host + 1, host_len - 2);
+		host[host_len - 2] = '\0';
+	}
+
+	struct addrinfo hints;
+	struct addrinfo *found = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	int result = getaddrinfo(host, colon + 1, &hints, &found);
+	if (result != 0) {
+		fprintf(stderr, "%s could not be resolved: %s\n", destination,
+			gai_strerror(result));
+		return (-1);
+	}
+	int sock = socket(found->ai_family, found->ai_socktype,
+			  found->ai_protocol);
+	if (sock < 0) {
+		perror("socket");
+		freeaddrinfo(found);
+		return (-1);
+	}
+	memcpy(address, found->ai_addr, found->ai_addrlen);
+	*len = found->ai_addrlen;
+	freeaddrinfo(found);
+	return (sock);
+}
+
+int replay_capture(struct replay *rp, struct capture *cap)
+// Walks the records of cap, queueing each zerg payload once it is due.
+// The queue is sent when it is full or before waiting for a packet that
+// is not yet due. When packets fall due faster than they can be sent,
+// batches fill up, so the rate is limited by sendmmsg() rather than by
+// the schedule. Returns 0 on success.
+{
+	uint64_t start = now_ns();
+	uint64_t first_time = 0;
+	bool timed = false;	// first_time has been taken
+	size_t index = 0;	// Of the next packet to queue
+
+	while (capture_next(cap)) {
+		uint64_t due = 0;
+		if (options.pace == PACE_ORIGINAL) {
+			if (!timed) {
+				first_time = cap->time;
+				timed = true;
+			}
+			// Timestamps that go backwards are sent at once
+			due = start + (cap->time > first_time ?
+				       (cap->time - first_time) * 1000 : 0);
+		} else if (options.pace == PACE_RATE) {
+			due = start + (uint64_t)(index * 1e9 / options.rate);
+		}
+		if (rp->paced && now_ns() < due) {
+			if (rp->count > 0 && send_batch(rp) != 0) {
+				return (-1);
+			}
+			sleep_until(due);
+		}
+
+		unsigned char *frame = rp->frames + rp->count * FRAME_MAX;
+		size_t len = cap->capture_len < FRAME_MAX ?
+		    cap->capture_len : FRAME_MAX;
+		if (readahead_read(cap->fo, frame, len) != len) {
+			// Case: Truncated final record
+			break;
+		}
+		struct frame_layout layout;
+		if (!frame_locate(frame, len, &layout)) {
+			++rp->skipped;
+			continue;
+		}
+		rp->payloads[rp->count].iov_base = frame + layout.zerg;
+		rp->payloads[rp->count].iov_len = layout.zerg_len;
+		++index;
+		rp->due[rp->count] = due;
+		if (++rp->count == rp->batch && send_batch(rp) != 0) {
+			return (-1);
+		}
+	}
+	if (rp->count > 0 && send_batch(rp) != 0) {
+		return (-1);
+	}
+	return (0);
+}
+
+int send_batch(struct replay *rp)
+// Sends every queued packet, retrying partial sends. A packet the
+// kernel refuses, for example for want of buffer space, is counted and
+// dropped rather than ending the replay. Returns 0 on success.
+{
+	size_t done = 0;
+	while (done < rp->count) {
+		int sent = sendmmsg(rp->sock, rp->messages + done,
+				    rp->count - done, 0);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == ENOBUFS || errno == EAGAIN
+			    || errno == ECONNREFUSED || errno == EMSGSIZE) {
+				++rp->failed;
+				++done;
+				continue;
+			}
+			perror("sendmmsg");
+			return (-1);
+		}
+		for (int i = 0; i < sent; ++i) {
+			rp->bytes += rp->messages[done + i].msg_len;
+		}
+		rp->sent += sent;
+		done += sent;
+	}
+
+	if (rp->paced) {
+		uint64_t sent_at = now_ns();
+		for (size_t i = 0; i < rp->count; ++i) {
+			uint64_t late = sent_at > rp->due[i] ?
+			    sent_at - rp->due[i] : 0;
+			rp->lateness_sum += late;
+			rp->lateness_squares += (double)late * late;
+			if (late > rp->lateness_max) {
+				rp->lateness_max = late;
+			}
+		}
+	}
+	rp->count = 0;
+	return (0);
+}
+
+void print_report(const struct replay *rp, uint64_t elapsed)
+// Prints the achieved rate and, when pacing, how late packets went
+// relative to their schedule, which is the jitter the pacing added.
+{
+	double seconds = elapsed / 1e9;
+	printf("Sent %zu packets (%zu bytes) in %.6f s\n", rp->sent,
+	       rp->bytes, seconds);
+	if (seconds > 0) {
+		printf("Rate: %.0f packets/s, %.1f Mbit/s\n",
+		       rp->sent / seconds, rp->bytes * 8 / seconds / 1e6);
+	}
+	size_t timed = rp->sent + rp->failed;
+	if (rp->paced && timed > 0) {
+		double mean = rp->lateness_sum / timed;
+		double variance = rp->lateness_squares / timed - mean * mean;
+		printf("Lateness: mean %.1f us, stddev %.1f us, max %.1f us\n",
+		       mean / 1e3, sqrt(variance > 0 ? variance : 0) / 1e3,
+		       rp->lateness_max / 1e3);
+	}
+	if (rp->skipped) {
+		printf("Skipped %zu records that were not zerg over UDP\n",
+		       rp->skipped);
+	}
+	if (rp->failed) {
+		printf("%zu packets could not be sent\n", rp->failed);
+	}
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+void sleep_until(uint64_t when)
+{
+	struct timespec until = {
+		.tv_sec = when / 1000000000ULL,
+		.tv_nsec = when % 1000000000ULL
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)
+	       == EINTR) {
+	}
+}
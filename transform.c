@@ -0,0 +1,584 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "lib/shared_fields.h"
+#include "lib/readahead.h"
+#include "lib/capture.h"
+#include "lib/frame.h"
+#include "lib/checksum.h"
+#include "lib/schema.h"
+#include <arpa/inet.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+enum transform_limits {
+	MAX_RULES = 16,
+	MAX_VALUES = 64,
+	OUT_BUF_SIZE = 1 << 20,
+	// Ethernet, longest IPv4 header, UDP and zerg headers
+	HEADERS_MAX = 14 + 60 + 8 + 12,
+	ZERG_HEADER_LEN = sizeof(struct zerg_header) - sizeof(void *)
+};
+
+enum rule_field {
+	RULE_TYPE,
+	RULE_SRC,
+	RULE_DST,
+	RULE_SEQUENCE,
+	NUM_RULE_FIELDS
+};
+
+enum copy_mode {
+	COPY_RANGE,		// copy_file_range(), file to file
+	COPY_SENDFILE,		// sendfile(), into a pipe or socket
+	COPY_READ_WRITE		// Through a buffer when neither works
+};
+
+struct keep_rule {
+	enum rule_field field;
+	size_t count;
+	uint32_t values[MAX_VALUES];
+};
+
+struct map_rule {
+	enum rule_field field;
+	bool any;		// Rewrite every value, not just from
+	uint32_t from;
+	uint32_t to;
+};
+
+struct transform {
+	int in_fd;
+	int out_fd;
+	enum copy_mode copy_mode;
+	off_t run_start;	// Input bytes to copy verbatim, not yet sent
+	off_t run_end;
+	unsigned char *buf;	// Rewritten bytes not yet written
+	size_t buf_len;
+};
+
+static const char *const field_names[NUM_RULE_FIELDS] = {
+	"type", "src", "dst", "seq"
+};
+
+static const uint32_t field_max[NUM_RULE_FIELDS] = {
+	15, UINT16_MAX, UINT16_MAX, UINT32_MAX
+};
+
+static struct {
+	struct keep_rule keeps[MAX_RULES];
+	size_t keep_count;
+	struct map_rule maps[MAX_RULES];
+	size_t map_count;
+} rules;
+
+int parse_keep(const char *arg);
+int parse_map(const char *arg);
+int parse_field(const char *arg, const char **rest);
+bool parse_value(enum rule_field field, const char *text, size_t len,
+		 uint32_t *value);
+int transform_capture(struct transform *tf, struct capture *cap);
+bool keep_packet(bool zerg, const struct zerg_header *zh);
+bool map_packet(struct zerg_header *zh);
+uint32_t field_get(const struct zerg_header *zh, enum rule_field field);
+void field_set(struct zerg_header *zh, enum rule_field field,
+	       uint32_t value);
+int emit_copy(struct transform *tf, off_t offset, size_t len);
+int emit_bytes(struct transform *tf, const void *data, size_t len);
+int flush_run(struct transform *tf);
+int flush_buf(struct transform *tf);
+int copy_range(struct transform *tf, off_t offset, size_t len);
+int write_all(int fd, const void *data, size_t len);
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"keep", required_argument, NULL, 'k'},
+		{"map", required_argument, NULL, 'm'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "k:m:", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+			// a[scii sort]
+		case 'k':
+			if (parse_keep(optarg) != 0) {
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case 'm':
+			if (parse_map(optarg) != 0) {
+				return (INVOCATION_ERROR);
+			}
+			break;
+		case '?':
+			return (INVOCATION_ERROR);
+		}
+	}
+	if (argc - optind != 2) {
+		printf("Usage: %s [OPTION]... INFILE OUTFILE\n", argv[0]);
+		return (INVOCATION_ERROR);
+	}
+	const char *in_name = argv[optind];
+	const char *out_name = argv[optind + 1];
+
+	struct readahead *fo = readahead_open(in_name, READAHEAD_DEFAULT_DEPTH,
+					      READAHEAD_DEFAULT_BUF_SIZE,
+					      READAHEAD_MMAP);
+	int in_fd = open(in_name, O_RDONLY);
+	if (!fo || in_fd < 0) {
+		fprintf(stderr, "%s could not be opened", in_name);
+		perror(" \b");
+		readahead_close(fo);
+		if (in_fd >= 0) {
+			close(in_fd);
+		}
+		return (FILE_ERROR);
+	}
+	struct capture cap;
+	if (capture_init(&cap, in_name, fo) != 0) {
+		fprintf(stderr, "%s is not a pcap capture\n", in_name);
+		readahead_close(fo);
+		close(in_fd);
+		return (FILE_ERROR);
+	}
+	// "-" writes stdout, so the output can be piped straight on
+	int out_fd = strcmp(out_name, "-") == 0 ? STDOUT_FILENO :
+	    open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		fprintf(stderr, "%s could not be opened", out_name);
+		perror(" \b");
+		readahead_close(fo);
+		close(in_fd);
+		return (FILE_ERROR);
+	}
+
+	struct transform tf = {
+		.in_fd = in_fd,
+		.out_fd = out_fd,
+		.copy_mode = COPY_RANGE
+	};
+	int return_code = SUCCESS;
+	tf.buf = malloc(OUT_BUF_SIZE);
+	if (!tf.buf) {
+		fprintf(stderr, "Memory allocation error\n");
+		return_code = MEMORY_ERROR;
+	} else if (transform_capture(&tf, &cap) != 0) {
+		fprintf(stderr, "%s could not be written", out_name);
+		perror(" \b");
+		return_code = FILE_ERROR;
+	}
+
+	free(tf.buf);
+	readahead_close(fo);
+	close(in_fd);
+	if (out_fd != STDOUT_FILENO && close(out_fd) != 0
+	    && return_code == SUCCESS) {
+		fprintf(stderr, "%s could not be written", out_name);
+		perror(" \b");
+		return_code = FILE_ERROR;
+	}
+	return (return_code);
+}
+
+int parse_keep(const char *arg)
+// Parses FIELD=VALUE[,VALUE]... into a rule that keeps only zerg
+// packets whose FIELD has one of the values. Returns 0 on success.
+{
+	const char *rest;
+	int field = parse_field(arg, &rest);
+	if (field < 0) {
+		return (-1);
+	}
+	if (rules.keep_count == MAX_RULES) {
+		fprintf(stderr, "At most %d --keep rules are supported\n",
+			MAX_RULES);
+		return (-1);
+	}
+	struct keep_rule *rule = &rules.keeps[rules.keep_count];
+	rule->field = field;
+	rule->count = 0;
+	for (;;) {
+		size_t len = strcspn(rest, ",");
+		if (rule->count == MAX_VALUES) {
+			fprintf(stderr, "At most %d values per rule\n",
+				MAX_VALUES);
+			return (-1);
+		}
+		if (!parse_value(field, rest, len,
+				 &rule->values[rule->count++])) {
+			return (-1);
+		}
+		if (rest[len] == '\0') {
+			break;
+		}
+		rest += len + 1;
+	}
+	++rules.keep_count;
+	return (0);
+}
+
+int parse_map(const char *arg)
+// Parses FIELD=FROM:TO, where FROM may be "*" for any value, into a
+// rewrite rule. The payload type cannot be rewritten, as that would
+// leave the payload meaning something else. Returns 0 on success.
+{
+	const char *rest;
+	int field = parse_field(arg, &rest);
+	if (field < 0) {
+		return (-1);
+	}
+	if (field == RULE_TYPE) {
+		fprintf(stderr, "--map only rewrites src, dst or seq\n");
+		return (-1);
+	}
+	if (rules.map_count == MAX_RULES) {
+		fprintf(stderr, "At most %d --map rules are supported\n",
+			MAX_RULES);
+		return (-1);
+	}
+	struct map_rule *rule = &rules.maps[rules.map_count];
+	rule->field = field;
+	const char *colon = strchr(rest, ':');
+	if (!colon) {
+		fprintf(stderr, "Expected %s=FROM:TO; received \"%s\"\n",
+			field_names[field], arg);
+		return (-1);
+	}
+	rule->any = colon - rest == 1 && rest[0] == '*';
+	rule->from = 0;
+	if (!rule->any
+	    && !parse_value(field, rest, colon - rest, &rule->from)) {
+		return (-1);
+	}
+	if (!parse_value(field, colon + 1, strlen(colon + 1), &rule->to)) {
+		return (-1);
+	}
+	++rules.map_count;
+	return (0);
+}
+
+int parse_field(const char *arg, const char **rest)
+// Parses the FIELD= that starts a rule, leaving rest after the '='.
+// Returns the field, or -1 after reporting an unknown one.
+{
+	size_t len = strcspn(arg, "=");
+	for (size_t i = 0; i < NUM_RULE_FIELDS; ++i) {
+		if (arg[len] == '=' && strlen(field_names[i]) == len
+		    && strncmp(arg, field_names[i], len) == 0) {
+			*rest = arg + len + 1;
+			return (i);
+		}
+	}
+	fprintf(stderr,
+		"Expected type=, src=, dst= or seq=; received \"%s\"\n", arg);
+	return (-1);
+}
+
+bool parse_value(enum rule_field field, const char *text, size_t len,
+		 uint32_t *value)
+// Parses a decimal value that fits field or, for the type, its name
+// as decode prints it.
+{
+	char buf[32];
+	char *err = NULL;
+	if (len == 0 || len >= sizeof(buf)) {
+		fprintf(stderr, "Expected a %s value; received \"%.*s\"\n",
+			field_names[field], (int)len, text);
+		return (false);
+	}
+	memcpy(buf, text, len);
+	buf[len] = '\0';
+	if (field == RULE_TYPE) {
+		for (size_t i = 0; i < PAYLOAD_TYPES; ++i) {
+			if (strcasecmp(buf, payload_schemas[i].title) == 0) {
+				*value = i;
+				return (true);
+			}
+		}
+	}
+	errno = 0;
+	unsigned long long number = strtoull(buf, &err, 10);
+	if (*err != '\0' || errno != 0 || buf[0] == '-'
+	    || number > field_max[field]) {
+		fprintf(stderr,
+			"Expected a %s value from 0 to %lu; received \"%s\"\n",
+			field_names[field], (unsigned long)field_max[field],
+			buf);
+		return (false);
+	}
+	*value = number;
+	return (true);
+}
+
+int transform_capture(struct transform *tf, struct capture *cap)
+// Copies the file header and each record that passes every --keep rule
+// to the output. Records that no --map rule changes are copied
+// verbatim, and consecutive ones in a single call, so that a file
+// system can share or copy them without them passing through here.
+// Rewritten records have their zerg header and UDP checksum patched;
+// their lengths and everything after the headers are unchanged.
+// Returns 0 on success.
+{
+	struct packet_header ph;
+	unsigned char headers[HEADERS_MAX];
+
+	if (emit_copy(tf, 0, sizeof(struct pcap_header)) != 0) {
+		return (-1);
+	}
+	while (capture_next(cap)) {
+		size_t len = cap->capture_len < HEADERS_MAX ?
+		    cap->capture_len : HEADERS_MAX;
+		if (readahead_read(cap->fo, headers, len) != len) {
+			// Case: Truncated final record
+			break;
+		}
+		struct frame_layout layout;
+		struct zerg_header zh;
+		bool zerg = frame_locate(headers, len, &layout)
+		    && layout.zerg_len >= ZERG_HEADER_LEN;
+		if (zerg) {
+			memcpy(&zh, headers + layout.zerg, ZERG_HEADER_LEN);
+		}
+		if (!keep_packet(zerg, &zh)) {
+			continue;
+		}
+		if (!zerg || !map_packet(&zh)) {
+			if (emit_copy(tf, cap->record,
+				      sizeof(ph) + cap->capture_len) != 0) {
+				return (-1);
+			}
+			continue;
+		}
+
+		// Case: Rewritten; the UDP checksum is updated only for the
+		// changed bytes, and zero still means there is none
+		unsigned char *zerg_header = headers + layout.zerg;
+		unsigned char *udp_checksum = headers + layout.udp + 6;
+		uint16_t checksum;
+		memcpy(&checksum, udp_checksum, sizeof(checksum));
+		if (checksum != 0) {
+			checksum = checksum_update(checksum, zerg_header, &zh,
+						   ZERG_HEADER_LEN);
+			if (checksum == 0) {
+				checksum = 0xFFFF;
+			}
+			memcpy(udp_checksum, &checksum, sizeof(checksum));
+		}
+		memcpy(zerg_header, &zh, ZERG_HEADER_LEN);
+		if (pread(tf->in_fd, &ph, sizeof(ph), cap->record)
+		    != sizeof(ph)) {
+			return (-1);
+		}
+		if (emit_bytes(tf, &ph, sizeof(ph)) != 0
+		    || emit_bytes(tf, headers, len) != 0
+		    || emit_copy(tf, cap->record + sizeof(ph) + len,
+				 cap->capture_len - len) != 0) {
+			return (-1);
+		}
+	}
+	if (flush_buf(tf) != 0 || flush_run(tf) != 0) {
+		return (-1);
+	}
+	return (0);
+}
+
+bool keep_packet(bool zerg, const struct zerg_header *zh)
+// Applies the --keep rules. Frames that are not zerg packets are only
+// kept when there are none.
+{
+	for (size_t i = 0; i < rules.keep_count; ++i) {
+		const struct keep_rule *rule = &rules.keeps[i];
+		if (!zerg) {
+			return (false);
+		}
+		uint32_t value = field_get(zh, rule->field);
+		bool found = false;
+		for (size_t j = 0; j < rule->count && !found; ++j) {
+			found = rule->values[j] == value;
+		}
+		if (!found) {
+			return (false);
+		}
+	}
+	return (true);
+}
+
+bool map_packet(struct zerg_header *zh)
+// Applies the --map rules in order. Returns whether any value changed.
+{
+	bool changed = false;
+	for (size_t i = 0; i < rules.map_count; ++i) {
+		const struct map_rule *rule = &rules.maps[i];
+		uint32_t value = field_get(zh, rule->field);
+		if ((rule->any || value == rule->from) && value != rule->to) {
+			field_set(zh, rule->field, rule->to);
+			changed = true;
+		}
+	}
+	return (changed);
+}
+
+uint32_t field_get(const struct zerg_header *zh, enum rule_field field)
+{
+	switch (field) {
+	case RULE_TYPE:
+		return (zh->zerg_packet_type);
+	case RULE_SRC:
+		return (ntohs(zh->zerg_src));
+	case RULE_DST:
+		return (ntohs(zh->zerg_dst));
+	default:
+		return (ntohl(zh->zerg_sequence));
+	}
+}
+
+void field_set(struct zerg_header *zh, enum rule_field field,
+	       uint32_t value)
+{
+	switch (field) {
+	case RULE_TYPE:
+		zh->zerg_packet_type = value;
+		break;
+	case RULE_SRC:
+		zh->zerg_src = htons(value);
+		break;
+	case RULE_DST:
+		zh->zerg_dst = htons(value);
+		break;
+	default:
+		zh->zerg_sequence = htonl(value);
+		break;
+	}
+}
+
+int emit_copy(struct transform *tf, off_t offset, size_t len)
+// Queues len input bytes from offset to be copied to the output,
+// joining them to the queued run when they follow on from it.
+{
+	if (flush_buf(tf) != 0) {
+		return (-1);
+	}
+	if (offset != tf->run_end) {
+		if (flush_run(tf) != 0) {
+			return (-1);
+		}
+		tf->run_start = offset;
+	}
+	tf->run_end = offset + len;
+	return (0);
+}
+
+int emit_bytes(struct transform *tf, const void *data, size_t len)
+// Buffers rewritten bytes for the output, after any queued run.
+{
+	if (flush_run(tf) != 0) {
+		return (-1);
+	}
+	if (len > OUT_BUF_SIZE - tf->buf_len && flush_buf(tf) != 0) {
+		return (-1);
+	}
+	memcpy(tf->buf + tf->buf_len, data, len);
+	tf->buf_len += len;
+	return (0);
+}
+
+int flush_run(struct transform *tf)
+{
+	if (tf->run_end == tf->run_start) {
+		return (0);
+	}
+	int result = copy_range(tf, tf->run_start, tf->run_end - tf->run_start);
+	tf->run_start = tf->run_end;
+	return (result);
+}
+
+int flush_buf(struct transform *tf)
+{
+	if (tf->buf_len == 0) {
+		return (0);
+	}
+	int result = write_all(tf->out_fd, tf->buf, tf->buf_len);
+	tf->buf_len = 0;
+	return (result);
+}
+
+int copy_range(struct transform *tf, off_t offset, size_t len)
+// Copies len input bytes from offset to the output inside the kernel
+// where it can: copy_file_range() between files, which may share
+// extents instead of copying, or sendfile() into a pipe. Anything else
+// goes through tf->buf, which is empty whenever a run is copied.
+// Returns 0 on success.
+{
+	while (len > 0) {
+		ssize_t done;
+		switch (tf->copy_mode) {
+		case COPY_RANGE:
+			done = copy_file_range(tf->in_fd, &offset, tf->out_fd,
+					       NULL, len, 0);
+			if (done < 0 && (errno == EXDEV || errno == EINVAL
+					 || errno == ENOSYS
+					 || errno == EOPNOTSUPP
+					 || errno == EBADF)) {
+				tf->copy_mode = COPY_SENDFILE;
+				continue;
+			}
+			break;
+		case COPY_SENDFILE:
+			done = sendfile(tf->out_fd, tf->in_fd, &offset, len);
+			if (done < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				tf->copy_mode = COPY_READ_WRITE;
+				continue;
+			}
+			break;
+		default:
+			done = pread(tf->in_fd, tf->buf,
+				     len < OUT_BUF_SIZE ? len : OUT_BUF_SIZE,
+				     offset);
+			if (done > 0) {
+				if (write_all(tf->out_fd, tf->buf, done) != 0) {
+					return (-1);
+				}
+				offset += done;
+			}
+			break;
+		}
+		if (done < 0 && errno == EINTR) {
+			continue;
+		}
+		if (done <= 0) {
+			if (done == 0) {
+				// Case: Input shorter than its records claim
+				errno = EIO;
+			}
+			return (-1);
+		}
+		len -= done;
+	}
+	return (0);
+}
+
+int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	while (len > 0) {
+		ssize_t done = write(fd, p, len);
+		if (done < 0 && errno == EINTR) {
+			continue;
+		}
+		if (done < 0) {
+			return (-1);
+		}
+		p += done;
+		len -= done;
+	}
+	return (0);
+}